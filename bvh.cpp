@@ -0,0 +1,523 @@
+// This file has the bounding volume hierarchy (BVH), which is what lets a ray skip testing most of the triangles in the scene
+// The BVH is a binary tree of bounding boxes (see bounding_box in specific_structs.cpp): the root's box holds every triangle, each node's two
+// children split up the triangles of their parent between them, and the leaves hold a handful of triangles each. A ray only goes into a node if it
+// hits that node's box, so whole groups of triangles get thrown out with a single box test
+// The tree is built once on the host and stored "flattened" as one array of nodes (no pointers), so it can be packed into the scene and sent to the
+// GPU in the same copy as everything else (see scene_packing.cpp)
+
+#define BVH_BINS 16                     // How many buckets triangles get sorted into along each axis when looking for the best split (see below)
+#define BVH_MAX_LEAF_SIZE 4             // The most triangles a leaf can have (unless they can't be split up at all)
+#define BVH_MAX_DEPTH 64                // Nodes this deep always become leaves, which also caps how big the traversal stack needs to be
+#define BVH_TRAVERSAL_COST 1.0          // How expensive stepping into a node is compared to testing one triangle, for the SAH
+
+// One node of a flattened BVH
+// The nodes are stored in depth-first order, so the left child of an interior node is always the very next node in the array, and only the index of
+// the right child needs to be stored
+struct bvh_node {
+    bounding_box bounds;
+    int offset;                         // For a leaf, the index of its first triangle (a leaf's triangles are always next to each other in the
+                                        // triangle array), and for an interior node, the index of its right child
+    int num_triangles;                  // How many triangles this leaf has, or 0 if this is an interior node
+
+    __device__ __host__ bool is_leaf() const {
+        return num_triangles > 0;
+    }
+};
+
+struct bvh {
+    bvh_node* nodes;
+    int num_nodes;
+};
+
+// Everything the builder needs to keep track of while it recursively builds the tree
+struct bvh_build_state {
+    bounding_box* triangle_bounds;      // The box around each triangle (or around each item, see build_bvh_over_bounds())
+    vec3* centroids;                    // The center of each triangle's box, which decides which side of a split the triangle goes on
+    int* order;                         // The triangle indices, which get rearranged so that every node's triangles end up next to each other
+    bvh_node* nodes;
+    int num_nodes;
+};
+
+
+__device__ __host__ bounding_box triangle_bounds(triangle_record* tri) {
+    bounding_box result;
+    result.grow(tri->v0);
+    result.grow(tri->v0.add(tri->e1));
+    result.grow(tri->v0.add(tri->e2));
+    return result;
+}
+
+
+// Returns which of the BVH_BINS buckets the given centroid falls into along the given axis
+__host__ int bvh_bin_index(vec3 centroid, int axis, real axis_min, real axis_extent) {
+    int bin = (int) (BVH_BINS * (centroid.component(axis) - axis_min) / axis_extent);
+    return bin < 0 ? 0 : (bin >= BVH_BINS ? BVH_BINS - 1 : bin);
+}
+
+
+// Fills in the node at the given index with the triangles order[first] through order[first + count - 1], splitting it into two children (and
+// building those too) if that is expected to be faster than testing all of the triangles directly
+// The split is chosen with the surface area heuristic (SAH): the chance of a ray hitting a child's box is roughly proportional to the box's surface
+// area, so the expected cost of a split is
+//     traversal cost + (area of left / area of parent) * triangles in left + (area of right / area of parent) * triangles in right
+// Trying every possible split is too slow, so instead the triangles are sorted into BVH_BINS evenly spaced buckets along each axis by their
+// centroids, and only the splits between buckets are tried ("binned" SAH)
+__host__ void build_bvh_node(bvh_build_state* state, int node_index, int first, int count, int depth) {
+    bvh_node* node = &state->nodes[node_index];
+
+    bounding_box bounds;
+    bounding_box centroid_bounds;
+    for (int i = first; i < first + count; i++) {
+        bounds.grow(state->triangle_bounds[state->order[i]]);
+        centroid_bounds.grow(state->centroids[state->order[i]]);
+    }
+    node->bounds = bounds;
+    node->offset = first;
+    node->num_triangles = count;                                                        // A leaf, unless a good enough split is found below
+    if (count == 1 || depth >= BVH_MAX_DEPTH) {
+        return;
+    }
+
+    // Finding the cheapest split out of every bucket boundary on every axis
+    real parent_area = bounds.surface_area();
+    real best_cost = INFINITY;
+    int best_axis = -1;
+    int best_split = 0;                                                                 // Buckets below this go left, the rest go right
+    for (int axis = 0; axis < 3; axis++) {
+        real axis_min = centroid_bounds.min.component(axis);
+        real axis_extent = centroid_bounds.max.component(axis) - axis_min;
+        if (axis_extent <= 0) {
+            continue;                                                                   // Every centroid is in the same spot along this axis
+        }
+
+        int bin_counts[BVH_BINS] = {0};
+        bounding_box bin_bounds[BVH_BINS];
+        for (int i = first; i < first + count; i++) {
+            int triangle = state->order[i];
+            int bin = bvh_bin_index(state->centroids[triangle], axis, axis_min, axis_extent);
+            bin_counts[bin]++;
+            bin_bounds[bin].grow(state->triangle_bounds[triangle]);
+        }
+
+        // Sweeping from the right first to get the area and count of everything right of each boundary, then sweeping from the left to finish off
+        // the cost of each boundary
+        real right_areas[BVH_BINS];
+        int right_counts[BVH_BINS];
+        bounding_box right_bounds;
+        int right_count = 0;
+        for (int split = BVH_BINS - 1; split > 0; split--) {
+            right_bounds.grow(bin_bounds[split]);
+            right_count += bin_counts[split];
+            right_areas[split] = right_bounds.surface_area();
+            right_counts[split] = right_count;
+        }
+
+        bounding_box left_bounds;
+        int left_count = 0;
+        for (int split = 1; split < BVH_BINS; split++) {
+            left_bounds.grow(bin_bounds[split - 1]);
+            left_count += bin_counts[split - 1];
+            if (left_count == 0 || right_counts[split] == 0) {
+                continue;                                                               // Not actually a split
+            }
+
+            real cost = BVH_TRAVERSAL_COST + (left_bounds.surface_area() * left_count + right_areas[split] * right_counts[split]) / parent_area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    if (best_axis == -1) {
+        return;                                                                         // Every centroid is in the same spot
+    }
+    if (count <= BVH_MAX_LEAF_SIZE && best_cost >= count) {
+        return;                                                                         // Testing every triangle in a leaf is cheaper
+    }
+
+    // Moving the triangles that go left to the front of this node's range, and the rest to the back
+    real axis_min = centroid_bounds.min.component(best_axis);
+    real axis_extent = centroid_bounds.max.component(best_axis) - axis_min;
+    int left_end = first;
+    for (int i = first; i < first + count; i++) {
+        if (bvh_bin_index(state->centroids[state->order[i]], best_axis, axis_min, axis_extent) < best_split) {
+            int temp = state->order[i];
+            state->order[i] = state->order[left_end];
+            state->order[left_end] = temp;
+            left_end++;
+        }
+    }
+
+    // The left child goes right after this node, and the right child goes after everything in the left child's subtree (depth-first order)
+    int left_index = state->num_nodes++;
+    build_bvh_node(state, left_index, first, left_end - first, depth + 1);
+    int right_index = state->num_nodes++;
+    build_bvh_node(state, right_index, left_end, first + count - left_end, depth + 1);
+
+    node->offset = right_index;
+    node->num_triangles = 0;
+}
+
+
+// Builds a BVH over any list of items given just the box around each one, using binned SAH (see build_bvh_node())
+// The items themselves are never touched -- instead, order gets filled with the item indices in the order the leaves expect, so that a leaf's
+// offset and num_triangles refer to order[offset] through order[offset + num_triangles - 1]. Used both for triangles (see build_bvh()) and for
+// whole mesh instances (see build_tlas() in instancing.cpp)
+__host__ bvh build_bvh_over_bounds(bounding_box* item_bounds, int num_items, int* order) {
+    bvh result;
+    result.nodes = nullptr;
+    result.num_nodes = 0;
+    if (num_items == 0) {
+        return result;
+    }
+
+    bvh_build_state state;
+    state.triangle_bounds = item_bounds;
+    state.centroids = new vec3[num_items];
+    state.order = order;
+    for (int i = 0; i < num_items; i++) {
+        state.centroids[i] = item_bounds[i].center();
+        state.order[i] = i;
+    }
+    state.nodes = new bvh_node[2 * num_items - 1];                                      // A binary tree with n leaves has 2n - 1 nodes, and there
+                                                                                        // can't be more leaves than items
+    state.num_nodes = 1;
+    build_bvh_node(&state, 0, 0, num_items, 0);
+    delete[] state.centroids;
+
+    result.nodes = state.nodes;
+    result.num_nodes = state.num_nodes;
+    return result;
+}
+
+
+// Builds a BVH over the given triangles using binned SAH (see build_bvh_node())
+// The triangles are rearranged in place so that the triangles of every leaf sit next to each other, which is what lets a leaf refer to its
+// triangles with just a first index and a count -- so the triangle indices of any hits found with the BVH are indices into the rearranged array
+__host__ bvh build_bvh(triangle_record* triangles, int num_triangles) {
+    bounding_box* bounds = new bounding_box[num_triangles];
+    int* order = new int[num_triangles];
+    for (int i = 0; i < num_triangles; i++) {
+        bounds[i] = triangle_bounds(&triangles[i]);
+    }
+    bvh result = build_bvh_over_bounds(bounds, num_triangles, order);
+
+    // Putting the triangles in the order the leaves expect
+    triangle_record* reordered = new triangle_record[num_triangles];
+    for (int i = 0; i < num_triangles; i++) {
+        reordered[i] = triangles[order[i]];
+    }
+    memcpy(triangles, reordered, sizeof(triangle_record) * num_triangles);
+
+    delete[] reordered;
+    delete[] bounds;
+    delete[] order;
+    return result;
+}
+
+
+// Returns the SAH cost of a whole tree: the expected cost of tracing a random ray through it, counting BVH_TRAVERSAL_COST for every interior node
+// and 1 for every triangle the ray is expected to be tested against (where the chance of reaching a node is its box's area over the root's area)
+// Lower is better, and it only depends on the tree's shape, so it is a fair way to compare trees from different builders
+__host__ real bvh_sah_cost(bvh_node* nodes, int num_nodes) {
+    if (num_nodes == 0) {
+        return 0;
+    }
+    real root_area = nodes[0].bounds.surface_area();
+    if (root_area <= 0) {
+        return nodes[0].is_leaf() ? nodes[0].num_triangles : BVH_TRAVERSAL_COST;
+    }
+
+    real cost = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        real chance = nodes[i].bounds.surface_area() / root_area;
+        cost += chance * (nodes[i].is_leaf() ? nodes[i].num_triangles : BVH_TRAVERSAL_COST);
+    }
+    return cost;
+}
+
+
+// Finds the closest triangle the given ray hits (closer than t_max, and in front of the ray's origin) by walking the given BVH
+// Works on both the GPU and the CPU. Instead of recursing (which is slow on the GPU), it keeps its own small stack of nodes it still has to visit:
+// at every interior node, it goes into the closer child that the ray hits first and saves the other one for later, so that hits found in the closer
+// child shrink t_max and let the farther child (and everything else behind the hit) get skipped
+// With moller_trumbore_only, the triangles are tested with Möller–Trumbore even if compiled with -DUSE_WATERTIGHT_INTERSECTION (see
+// bvh_closest_hit_moller_trumbore())
+template <bool moller_trumbore_only>
+__device__ __host__ collision bvh_closest_hit_using(ray* r, bvh_node* nodes, int num_nodes, triangle_record* triangles, real t_max) {
+    collision closest;
+    if (num_nodes == 0) {
+        return closest;
+    }
+
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    if (nodes[0].bounds.intersect(origin, inverse_direction, t_max) == INFINITY) {
+        return closest;
+    }
+
+    int stack[BVH_MAX_DEPTH];                                                           // Every level of the tree pushes at most one node
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        bvh_node* node = &nodes[node_index];
+        if (node->is_leaf()) {
+            for (int i = node->offset; i < node->offset + node->num_triangles; i++) {
+                collision hit = moller_trumbore_only ? ray_triangle_intersection_moller_trumbore(r, &triangles[i], i, t_max)
+                                                     : ray_triangle_intersection_t(r, &triangles[i], i, t_max);
+                if (hit.has_collision) {
+                    closest = hit;
+                    t_max = hit.collision_distance;
+                }
+            }
+        } else {
+            int near_index = node_index + 1;
+            int far_index = node->offset;
+            real t_near = nodes[near_index].bounds.intersect(origin, inverse_direction, t_max);
+            real t_far = nodes[far_index].bounds.intersect(origin, inverse_direction, t_max);
+            if (t_far < t_near) {
+                int temp_index = near_index;
+                near_index = far_index;
+                far_index = temp_index;
+                real temp_t = t_near;
+                t_near = t_far;
+                t_far = temp_t;
+            }
+
+            if (t_near != INFINITY) {
+                if (t_far != INFINITY) {
+                    stack[stack_size++] = far_index;
+                }
+                node_index = near_index;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        node_index = stack[--stack_size];
+    }
+    return closest;
+}
+
+
+// The BVH walk everything else uses, testing triangles with ray_triangle_intersection_t()
+__device__ __host__ collision bvh_closest_hit(ray* r, bvh_node* nodes, int num_nodes, triangle_record* triangles, real t_max) {
+    return bvh_closest_hit_using<false>(r, nodes, num_nodes, triangles, t_max);
+}
+
+
+// Same as bvh_closest_hit(), but always with Möller–Trumbore, which is what ray packets and triangle blocks use, so their benchmarks have a
+// single-ray reference that does the same triangle math no matter which test the rest of the build uses
+__device__ __host__ collision bvh_closest_hit_moller_trumbore(ray* r, bvh_node* nodes, int num_nodes, triangle_record* triangles, real t_max) {
+    return bvh_closest_hit_using<true>(r, nodes, num_nodes, triangles, t_max);
+}
+
+
+// Finds the closest hit by testing the ray against every single triangle, which is what the kernels did before the BVH -- only kept around to
+// check the BVH's results against and to compare its speed to
+__device__ __host__ collision brute_force_closest_hit(ray* r, triangle_record* triangles, int num_triangles, real t_max) {
+    collision closest;
+    for (int i = 0; i < num_triangles; i++) {
+        collision hit = ray_triangle_intersection_t(r, &triangles[i], i, t_max);
+        if (hit.has_collision) {
+            closest = hit;
+            t_max = hit.collision_distance;
+        }
+    }
+    return closest;
+}
+
+
+// A small, fast random number generator (xorshift) for making benchmark scenes, returning a number from 0 to 1
+// Always gives the same numbers for the same starting state, so every benchmark run uses the exact same scene
+__host__ real benchmark_random(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (*state & 0xFFFFFF) / (real) 0x1000000;
+}
+
+
+// Makes a benchmark scene of the given number of random triangles, scattered through a 100x100x100 box in front of the camera and getting smaller as
+// there get to be more of them, so that the scene stays about as crowded no matter how many there are
+__host__ triangle_record* make_benchmark_triangles(int num_triangles, uint32_t* random_state) {
+    real triangle_size = 150 / cbrt((real) num_triangles);
+    triangle_record* triangles = new triangle_record[num_triangles];
+    for (int i = 0; i < num_triangles; i++) {
+        vec3 a = vec3(benchmark_random(random_state) * 100 - 50, benchmark_random(random_state) * 100 - 50, benchmark_random(random_state) * 100 + 10);
+        vec3 b = a.add(vec3(benchmark_random(random_state) - 0.5, benchmark_random(random_state) - 0.5, benchmark_random(random_state) - 0.5).scale(triangle_size));
+        vec3 c = a.add(vec3(benchmark_random(random_state) - 0.5, benchmark_random(random_state) - 0.5, benchmark_random(random_state) - 0.5).scale(triangle_size));
+        triangles[i] = make_triangle_record(a, b, c, 0, i);
+    }
+    return triangles;
+}
+
+
+// Makes the given number of rays from the origin toward random points across the middle of the benchmark scene
+__host__ ray* make_benchmark_rays(int num_rays, uint32_t* random_state) {
+    ray* rays = new ray[num_rays];
+    for (int i = 0; i < num_rays; i++) {
+        vec3 target = vec3(benchmark_random(random_state) * 100 - 50, benchmark_random(random_state) * 100 - 50, 60);
+        rays[i] = ray(vec3(0, 0, 0), target.normalize());
+    }
+    return rays;
+}
+
+
+// Traces every ray through the given BVH and returns how many of them found a different closest hit distance than the given reference hits
+__host__ int count_hit_mismatches(ray* rays, int num_rays, collision* reference_hits, bvh_node* nodes, int num_nodes, triangle_record* triangles) {
+    int num_mismatches = 0;
+    for (int i = 0; i < num_rays; i++) {
+        collision hit = bvh_closest_hit(&rays[i], nodes, num_nodes, triangles, INFINITY);
+        if (hit.has_collision != reference_hits[i].has_collision ||
+            (hit.has_collision && hit.collision_distance != reference_hits[i].collision_distance)) {
+            num_mismatches++;
+        }
+    }
+    return num_mismatches;
+}
+
+
+// Compares the BVH against testing every triangle, on the host, for a scene of the given number of randomly placed triangles, and prints how long
+// the build and both kinds of traversal took, plus how many rays the two disagreed on (which should always be 0)
+// Runs the exact same traversal code as the kernels, just on the CPU, so that the huge triangle counts don't need a GPU to test
+__host__ void benchmark_bvh(int num_triangles, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, &random_state);
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+
+    auto build_start = std::chrono::high_resolution_clock::now();
+    bvh tree = build_bvh(triangles, num_triangles);
+    auto build_end = std::chrono::high_resolution_clock::now();
+
+    collision* brute_force_hits = new collision[num_rays];
+    auto brute_force_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_rays; i++) {
+        brute_force_hits[i] = brute_force_closest_hit(&rays[i], triangles, num_triangles, INFINITY);
+    }
+    auto brute_force_end = std::chrono::high_resolution_clock::now();
+
+    auto bvh_start = std::chrono::high_resolution_clock::now();
+    int num_mismatches = count_hit_mismatches(rays, num_rays, brute_force_hits, tree.nodes, tree.num_nodes, triangles);
+    auto bvh_end = std::chrono::high_resolution_clock::now();
+
+    int num_hits = 0;
+    for (int i = 0; i < num_rays; i++) {
+        num_hits += brute_force_hits[i].has_collision;
+    }
+
+    double build_ms = std::chrono::duration_cast<std::chrono::microseconds>(build_end - build_start).count() / 1000.0;
+    double brute_force_ms = std::chrono::duration_cast<std::chrono::microseconds>(brute_force_end - brute_force_start).count() / 1000.0;
+    double bvh_ms = std::chrono::duration_cast<std::chrono::microseconds>(bvh_end - bvh_start).count() / 1000.0;
+    printf("bvh benchmark: %i triangles, %i rays\n", num_triangles, num_rays);
+    printf("  build: %.3f ms, %i nodes\n", build_ms, tree.num_nodes);
+    printf("  brute force: %.3f ms, bvh: %.3f ms (%.1fx faster)\n", brute_force_ms, bvh_ms, bvh_ms > 0 ? brute_force_ms / bvh_ms : 0);
+    printf("  %i hit(s), %i mismatch(es)\n", num_hits, num_mismatches);
+    assert(num_mismatches == 0);
+
+    delete[] tree.nodes;
+    delete[] triangles;
+    delete[] rays;
+    delete[] brute_force_hits;
+}
+
+
+// Tests every one of the given rays against every one of the given triangles with the given ray-triangle test, and returns how many pairs hit
+// (only hits in front of the ray count, like in a closest-hit loop)
+template <typename intersection_test>
+__host__ int count_triangle_hits(ray* rays, int num_rays, triangle_record* triangles, int num_triangles, intersection_test test) {
+    int num_hits = 0;
+    for (int i = 0; i < num_rays; i++) {
+        for (int j = 0; j < num_triangles; j++) {
+            collision hit = test(&rays[i], &triangles[j], j);
+            num_hits += hit.has_collision && hit.collision_distance > 0;
+        }
+    }
+    return num_hits;
+}
+
+
+// Returns how many ray-triangle pairs the two given tests disagree on, either on whether the ray hits (in front of its origin) or on how far away
+// the hit is (past a little rounding)
+template <typename first_test, typename second_test>
+__host__ int count_intersection_mismatches(ray* rays, int num_rays, triangle_record* triangles, int num_triangles, first_test first,
+                                           second_test second) {
+    int num_mismatches = 0;
+    for (int i = 0; i < num_rays; i++) {
+        for (int j = 0; j < num_triangles; j++) {
+            collision a = first(&rays[i], &triangles[j], j);
+            collision b = second(&rays[i], &triangles[j], j);
+            bool a_hit = a.has_collision && a.collision_distance > 0;
+            bool b_hit = b.has_collision && b.collision_distance > 0;
+            if (a_hit != b_hit || (a_hit && fabs(a.collision_distance - b.collision_distance) > (real) 1e-4 * a.collision_distance)) {
+                num_mismatches++;
+            }
+        }
+    }
+    return num_mismatches;
+}
+
+
+// Checks the Möller–Trumbore and watertight ray-triangle tests against the original one on triangles that face along z (where the original is
+// as good as it gets, see ray_triangle_intersection_t()), counts how many pairs the original gets wrong on vertical triangles, and then times
+// how many ray-triangle tests per second each of the three does on randomly facing triangles, testing every ray against every triangle
+__host__ void benchmark_triangle_intersection(int num_triangles, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+    triangle_record* facing_triangles = new triangle_record[num_triangles];
+    triangle_record* vertical_triangles = new triangle_record[num_triangles];
+    for (int i = 0; i < num_triangles; i++) {
+        vec3 a = vec3(benchmark_random(&random_state) * 100 - 50, benchmark_random(&random_state) * 100 - 50, benchmark_random(&random_state) * 100 + 10);
+        vec3 b = a.add(vec3(benchmark_random(&random_state) - 0.5, benchmark_random(&random_state) - 0.5, 0).scale(20));
+        vec3 c = a.add(vec3(benchmark_random(&random_state) - 0.5, benchmark_random(&random_state) - 0.5, 0).scale(20));
+        facing_triangles[i] = make_triangle_record(a, b, c, 0, i);
+        vertical_triangles[i] = make_triangle_record(a, b, a.add(vec3(0, 0, benchmark_random(&random_state) * 20)), 0, i);
+    }
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, &random_state);
+
+    auto original = [](ray* r, triangle_record* tri, int index) { return ray_triangle_intersection_xy(r, tri, index); };
+    auto moller_trumbore = [](ray* r, triangle_record* tri, int index) {
+        return ray_triangle_intersection_moller_trumbore(r, tri, index, INFINITY);
+    };
+    auto watertight = [](ray* r, triangle_record* tri, int index) { return ray_triangle_intersection_watertight(r, tri, index, INFINITY); };
+
+    int facing_moller_trumbore_mismatches =
+        count_intersection_mismatches(rays, num_rays, facing_triangles, num_triangles, original, moller_trumbore);
+    int facing_watertight_mismatches = count_intersection_mismatches(rays, num_rays, facing_triangles, num_triangles, original, watertight);
+    int vertical_watertight_mismatches =
+        count_intersection_mismatches(rays, num_rays, vertical_triangles, num_triangles, moller_trumbore, watertight);
+    printf("triangle intersection benchmark: %i triangles, %i rays\n", num_triangles, num_rays);
+    printf("  facing z: %i hit(s), moller-trumbore %i mismatch(es), watertight %i mismatch(es) against the original\n",
+           count_triangle_hits(rays, num_rays, facing_triangles, num_triangles, original), facing_moller_trumbore_mismatches,
+           facing_watertight_mismatches);
+    printf("  vertical: %i hit(s), original wrong on %i pair(s), watertight %i mismatch(es) against moller-trumbore\n",
+           count_triangle_hits(rays, num_rays, vertical_triangles, num_triangles, moller_trumbore),
+           count_intersection_mismatches(rays, num_rays, vertical_triangles, num_triangles, moller_trumbore, original),
+           vertical_watertight_mismatches);
+    assert(facing_moller_trumbore_mismatches == 0 && facing_watertight_mismatches == 0 && vertical_watertight_mismatches == 0);
+
+    double num_tests = (double) num_triangles * num_rays;
+    auto original_start = std::chrono::high_resolution_clock::now();
+    int original_hits = count_triangle_hits(rays, num_rays, triangles, num_triangles, original);
+    auto original_end = std::chrono::high_resolution_clock::now();
+    int moller_trumbore_hits = count_triangle_hits(rays, num_rays, triangles, num_triangles, moller_trumbore);
+    auto moller_trumbore_end = std::chrono::high_resolution_clock::now();
+    int watertight_hits = count_triangle_hits(rays, num_rays, triangles, num_triangles, watertight);
+    auto watertight_end = std::chrono::high_resolution_clock::now();
+
+    double original_ms = std::chrono::duration_cast<std::chrono::microseconds>(original_end - original_start).count() / 1000.0;
+    double moller_trumbore_ms = std::chrono::duration_cast<std::chrono::microseconds>(moller_trumbore_end - original_end).count() / 1000.0;
+    double watertight_ms = std::chrono::duration_cast<std::chrono::microseconds>(watertight_end - moller_trumbore_end).count() / 1000.0;
+    printf("  original: %.1f M tests/s (%i hits), moller-trumbore: %.1f M tests/s (%i hits), watertight: %.1f M tests/s (%i hits)\n",
+           num_tests / original_ms / 1000.0, original_hits, num_tests / moller_trumbore_ms / 1000.0, moller_trumbore_hits,
+           num_tests / watertight_ms / 1000.0, watertight_hits);
+
+    delete[] rays;
+    delete[] facing_triangles;
+    delete[] vertical_triangles;
+    delete[] triangles;
+}
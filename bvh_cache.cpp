@@ -0,0 +1,379 @@
+// This file has the BVH cache, which saves a built BVH to a file next to the scene it was built for, so that the next time the same scene is
+// loaded (like on the next start of the JVM, which reloads the library and calls Java_Main_test() from scratch) the BVH can be read back
+// instead of built again
+// The file holds the triangle records (already in the BVH's order) and the nodes exactly as they sit in memory, found by their offsets from the
+// start of the file like the arrays of a packed scene (see scene_packing.cpp), so nothing in it has to be parsed or fixed up: the file is just
+// memory-mapped (the OS makes the file show up as a block of memory, and only reads in the parts that actually get touched), and the packer copies
+// straight out of the mapping into the scene block that gets uploaded
+// A cache file is only used if the hash stored in it matches a hash of the scene's geometry and of every setting that changes how the BVH gets
+// built, so editing the scene or the builder just makes the next load rebuild the BVH and write over the file
+// A scene loaded from a file gets its cache next to that file (see bvh_cache_path_for_asset()), and the scene built in code by run() gets its cache
+// next to the native library it is built into, unless the build sets a path of its own with -DBVH_CACHE_PATH (see default_bvh_cache_path() and
+// run.bat.tmp). Either way the cache never depends on which folder the JVM happened to be started from
+
+#define BVH_CACHE_MAGIC 0x43485642u     // "BVHC" (read as little-endian bytes), to tell cache files apart from any other file
+#define BVH_CACHE_VERSION 1             // Goes up whenever the file layout changes, so files in an old layout get rebuilt instead of misread
+#define BVH_CACHE_EXTENSION ".bvhcache" // Added to the end of an asset's path to get the path of its cache file
+
+// The header at the start of every cache file
+struct bvh_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t scene_hash;                // See hash_bvh_scene()
+    uint32_t real_size;                 // sizeof(real) when the file was written, since float and double builds lay out records differently
+    uint32_t record_size;
+    uint32_t node_size;
+    int num_triangles;
+    int num_nodes;
+    uint64_t triangles_offset;          // Offsets (in bytes, counted from the start of the file) of the two arrays
+    uint64_t nodes_offset;
+    uint64_t total_size;                // The size of the whole file in bytes, so a file that got cut off while being written is never used
+};
+
+// A file mapped into memory, read-only
+struct mapped_file {
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int file;
+#endif
+};
+
+// A BVH along with its triangle records in the BVH's order, either read out of a mapped cache file (in which case both arrays point into the
+// mapping, and must not be deleted or written to) or just built
+struct cached_bvh {
+    triangle_record* triangles;
+    bvh_node* nodes;
+    int num_triangles;
+    int num_nodes;
+    bool from_cache;
+    mapped_file mapping;                // Only used when from_cache is true
+};
+
+
+// Mixes the given bytes into a running FNV-1a hash (a simple, fast hash that is plenty for telling scenes apart, though not for security)
+__host__ uint64_t fnv1a_hash(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+// Hashes everything that decides what BVH gets built for the given triangles: every vertex and material index, plus the builder's settings and
+// the size of real (anything else that changes the output of build_bvh() should be added here too, or BVH_CACHE_VERSION bumped)
+__host__ uint64_t hash_bvh_scene(triangle_soa* triangles) {
+    uint64_t hash = 14695981039346656037ull;
+    int n = triangles->num_triangles;
+    int settings[] = {n, (int) sizeof(real), BVH_BINS, BVH_MAX_LEAF_SIZE, BVH_MAX_DEPTH};
+    real traversal_cost = BVH_TRAVERSAL_COST;
+    hash = fnv1a_hash(hash, settings, sizeof(settings));
+    hash = fnv1a_hash(hash, &traversal_cost, sizeof(real));
+
+    real* vertex_arrays[] = {triangles->v0_x, triangles->v0_y, triangles->v0_z, triangles->v1_x, triangles->v1_y, triangles->v1_z,
+                             triangles->v2_x, triangles->v2_y, triangles->v2_z};
+    for (int i = 0; i < 9; i++) {
+        hash = fnv1a_hash(hash, vertex_arrays[i], sizeof(real) * n);
+    }
+    return fnv1a_hash(hash, triangles->material_index, sizeof(uint16_t) * n);
+}
+
+
+// Maps the whole file at the given path into memory for reading, returning false if it doesn't exist or can't be mapped
+__host__ bool map_file(const char* path, mapped_file* result) {
+    result->data = nullptr;
+    result->size = 0;
+#ifdef _WIN32
+    result->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (result->file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(result->file, &size) || size.QuadPart == 0) {
+        CloseHandle(result->file);
+        return false;
+    }
+    result->mapping = CreateFileMappingA(result->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (result->mapping == nullptr) {
+        CloseHandle(result->file);
+        return false;
+    }
+    result->data = (const char*) MapViewOfFile(result->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (result->data == nullptr) {
+        CloseHandle(result->mapping);
+        CloseHandle(result->file);
+        return false;
+    }
+    result->size = (size_t) size.QuadPart;
+#else
+    result->file = open(path, O_RDONLY);
+    if (result->file == -1) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(result->file, &info) != 0 || info.st_size == 0) {
+        close(result->file);
+        return false;
+    }
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, result->file, 0);
+    if (data == MAP_FAILED) {
+        close(result->file);
+        return false;
+    }
+    result->data = (const char*) data;
+    result->size = info.st_size;
+#endif
+    return true;
+}
+
+
+__host__ void unmap_file(mapped_file* file) {
+    if (file->data == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->mapping);
+    CloseHandle(file->file);
+#else
+    munmap((void*) file->data, file->size);
+    close(file->file);
+#endif
+    file->data = nullptr;
+    file->size = 0;
+}
+
+
+// Returns the header of the given mapped cache file if it is a complete cache file for a scene with the given hash, built with this build's
+// layout, or null if it isn't (in which case it should be rebuilt)
+__host__ const bvh_cache_header* check_bvh_cache(mapped_file* file, uint64_t scene_hash) {
+    if (file->size < sizeof(bvh_cache_header)) {
+        return nullptr;
+    }
+    const bvh_cache_header* header = (const bvh_cache_header*) file->data;
+    if (header->magic != BVH_CACHE_MAGIC || header->version != BVH_CACHE_VERSION || header->scene_hash != scene_hash ||
+        header->real_size != sizeof(real) || header->record_size != sizeof(triangle_record) || header->node_size != sizeof(bvh_node) ||
+        header->total_size != file->size) {
+        return nullptr;
+    }
+    if (header->triangles_offset + sizeof(triangle_record) * (uint64_t) header->num_triangles > file->size ||
+        header->nodes_offset + sizeof(bvh_node) * (uint64_t) header->num_nodes > file->size ||
+        header->triangles_offset % alignof(triangle_record) != 0 || header->nodes_offset % alignof(bvh_node) != 0) {
+        return nullptr;
+    }
+    return header;
+}
+
+
+// Writes the given BVH and its records to a cache file at the given path, returning false if the file couldn't be written
+__host__ bool write_bvh_cache(const char* path, uint64_t scene_hash, triangle_record* triangles, int num_triangles, bvh_node* nodes,
+                              int num_nodes) {
+    bvh_cache_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BVH_CACHE_MAGIC;
+    header.version = BVH_CACHE_VERSION;
+    header.scene_hash = scene_hash;
+    header.real_size = sizeof(real);
+    header.record_size = sizeof(triangle_record);
+    header.node_size = sizeof(bvh_node);
+    header.num_triangles = num_triangles;
+    header.num_nodes = num_nodes;
+    header.triangles_offset = (sizeof(bvh_cache_header) + alignof(triangle_record) - 1) & ~(alignof(triangle_record) - 1);
+    header.nodes_offset = (header.triangles_offset + sizeof(triangle_record) * num_triangles + alignof(bvh_node) - 1) & ~(alignof(bvh_node) - 1);
+    header.total_size = header.nodes_offset + sizeof(bvh_node) * num_nodes;
+
+    // Laid out in memory first, exactly as it will be in the file, so it goes out in a single write
+    char* block = new char[header.total_size];
+    memset(block, 0, header.total_size);
+    memcpy(block, &header, sizeof(header));
+    memcpy(block + header.triangles_offset, triangles, sizeof(triangle_record) * num_triangles);
+    memcpy(block + header.nodes_offset, nodes, sizeof(bvh_node) * num_nodes);
+
+    FILE* file = fopen(path, "wb");
+    bool written = file != nullptr && fwrite(block, 1, header.total_size, file) == header.total_size;
+    if (file != nullptr) {
+        written = fclose(file) == 0 && written;
+    }
+    delete[] block;
+    return written;
+}
+
+
+// Returns the path of the cache file for a scene loaded from the file at the given path, which is just the asset's path with BVH_CACHE_EXTENSION
+// added (so "models/bunny.obj" gets "models/bunny.obj.bvhcache", right next to it). The result is a new string that has to be delete[]d
+__host__ char* bvh_cache_path_for_asset(const char* asset_path) {
+    size_t length = strlen(asset_path);
+    char* result = new char[length + sizeof(BVH_CACHE_EXTENSION)];
+    memcpy(result, asset_path, length);
+    memcpy(result + length, BVH_CACHE_EXTENSION, sizeof(BVH_CACHE_EXTENSION));                 // sizeof() counts the null terminator too
+    return result;
+}
+
+
+// Returns the full path of the native library (or program) this code was built into, or null if the OS won't say. The result is a new string
+// that has to be delete[]d
+__host__ char* native_library_path() {
+#ifdef _WIN32
+    HMODULE module;
+    if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCSTR) &native_library_path,
+                            &module)) {
+        return nullptr;
+    }
+    char* result = new char[MAX_PATH];
+    DWORD length = GetModuleFileNameA(module, result, MAX_PATH);
+    if (length == 0 || length == MAX_PATH) {                                            // MAX_PATH means the path got cut off
+        delete[] result;
+        return nullptr;
+    }
+    return result;
+#else
+    Dl_info info;
+    if (dladdr((void*) &native_library_path, &info) == 0 || info.dli_fname == nullptr) {
+        return nullptr;
+    }
+    char* result = new char[strlen(info.dli_fname) + 1];
+    strcpy(result, info.dli_fname);
+    return result;
+#endif
+}
+
+
+// Returns the path of a file with the given name in the same folder as the native library, for anything the library writes out on its own (so it
+// doesn't end up wherever the JVM happened to be started from), or just the name if the library can't be found. The result is a new string that
+// has to be delete[]d
+__host__ char* path_next_to_native_library(const char* file_name) {
+    char* library_path = native_library_path();
+    size_t folder_length = 0;
+    if (library_path != nullptr) {
+        for (size_t i = 0; library_path[i] != 0; i++) {
+            if (library_path[i] == '/' || library_path[i] == '\\') {
+                folder_length = i + 1;                                                  // Keeping the slash
+            }
+        }
+    }
+    size_t name_length = strlen(file_name);
+    char* result = new char[folder_length + name_length + 1];
+    if (folder_length > 0) {
+        memcpy(result, library_path, folder_length);
+    }
+    memcpy(result + folder_length, file_name, name_length + 1);
+    delete[] library_path;
+    return result;
+}
+
+
+// Returns the path of the cache file for the scene run() builds in code: the path given with -DBVH_CACHE_PATH if there is one, or otherwise the
+// native library's own path with BVH_CACHE_EXTENSION added (native.dll.bvhcache), since that scene comes from the library itself. If the library
+// can't be found, it falls back to scene.bvhcache in the working directory. The result is a new string that has to be delete[]d
+__host__ char* default_bvh_cache_path() {
+#ifdef BVH_CACHE_PATH
+    char* result = new char[sizeof(BVH_CACHE_PATH)];
+    memcpy(result, BVH_CACHE_PATH, sizeof(BVH_CACHE_PATH));
+    return result;
+#else
+    char* library_path = native_library_path();
+    if (library_path == nullptr) {
+        return bvh_cache_path_for_asset("scene");
+    }
+    char* result = bvh_cache_path_for_asset(library_path);
+    delete[] library_path;
+    return result;
+#endif
+}
+
+
+// Gets the BVH for the given triangles, from the cache file at the given path if it holds one for these exact triangles and builder settings, or
+// otherwise by building it (and then saving it to that path for next time). Returns true if it came from the cache
+// Either way, the result has to be released with release_cached_bvh() once it isn't needed anymore
+__host__ bool load_or_build_bvh(const char* cache_path, triangle_soa* triangles, cached_bvh* result) {
+    uint64_t scene_hash = hash_bvh_scene(triangles);
+    result->num_triangles = triangles->num_triangles;
+    result->from_cache = false;
+
+    if (map_file(cache_path, &result->mapping)) {
+        const bvh_cache_header* header = check_bvh_cache(&result->mapping, scene_hash);
+        if (header != nullptr && header->num_triangles == triangles->num_triangles) {
+            result->triangles = (triangle_record*) (result->mapping.data + header->triangles_offset);
+            result->nodes = (bvh_node*) (result->mapping.data + header->nodes_offset);
+            result->num_nodes = header->num_nodes;
+            result->from_cache = true;
+            return true;
+        }
+        unmap_file(&result->mapping);                                                   // Out of date, so it gets rebuilt and written over
+    }
+
+    result->triangles = build_triangle_records(triangles);
+    bvh tree = build_bvh(result->triangles, triangles->num_triangles);
+    result->nodes = tree.nodes;
+    result->num_nodes = tree.num_nodes;
+    if (!write_bvh_cache(cache_path, scene_hash, result->triangles, result->num_triangles, result->nodes, result->num_nodes)) {
+        printf("couldn't write bvh cache file %s\n", cache_path);
+    }
+    return false;
+}
+
+
+__host__ void release_cached_bvh(cached_bvh* cached) {
+    if (cached->from_cache) {
+        unmap_file(&cached->mapping);
+    } else {
+        delete[] cached->triangles;
+        delete[] cached->nodes;
+    }
+    cached->triangles = nullptr;
+    cached->nodes = nullptr;
+}
+
+
+// Times how long it takes to get a BVH ready for a scene of the given number of random triangles on a cold start, first with no cache file
+// (building it and writing the file), then with the file from that first run (mapping it and touching every byte, like the packer's copy would),
+// and checks that the two BVHs trace the same (which should always be 0 mismatches). The cache file is written to the given path and deleted after
+__host__ void benchmark_bvh_cache(int num_triangles, const char* cache_path) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* records = make_benchmark_triangles(num_triangles, &random_state);
+    int num_rays = 1000;
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+    triangle_soa triangles = triangle_soa_from_records(records, num_triangles, 1);
+    remove(cache_path);
+
+    auto cold_start = std::chrono::high_resolution_clock::now();
+    cached_bvh built;
+    load_or_build_bvh(cache_path, &triangles, &built);
+    auto cold_end = std::chrono::high_resolution_clock::now();
+
+    auto cached_start = std::chrono::high_resolution_clock::now();
+    cached_bvh loaded;
+    bool hit = load_or_build_bvh(cache_path, &triangles, &loaded);
+    char* upload_copy = new char[sizeof(triangle_record) * num_triangles + sizeof(bvh_node) * loaded.num_nodes];
+    memcpy(upload_copy, loaded.triangles, sizeof(triangle_record) * num_triangles);
+    memcpy(upload_copy + sizeof(triangle_record) * num_triangles, loaded.nodes, sizeof(bvh_node) * loaded.num_nodes);
+    auto cached_end = std::chrono::high_resolution_clock::now();
+
+    collision* reference_hits = new collision[num_rays];
+    for (int i = 0; i < num_rays; i++) {
+        reference_hits[i] = bvh_closest_hit(&rays[i], built.nodes, built.num_nodes, built.triangles, INFINITY);
+    }
+    int num_mismatches = count_hit_mismatches(rays, num_rays, reference_hits, loaded.nodes, loaded.num_nodes, loaded.triangles);
+
+    double cold_ms = std::chrono::duration_cast<std::chrono::microseconds>(cold_end - cold_start).count() / 1000.0;
+    double cached_ms = std::chrono::duration_cast<std::chrono::microseconds>(cached_end - cached_start).count() / 1000.0;
+    printf("bvh cache benchmark: %i triangles\n", num_triangles);
+    printf("  cold start without cache: %.3f ms (build and write), with cache: %.3f ms (%s)\n", cold_ms, cached_ms,
+           hit ? "mapped" : "cache missed!");
+    printf("  %i mismatch(es)\n", num_mismatches);
+    assert(hit && num_mismatches == 0);
+
+    release_cached_bvh(&built);
+    release_cached_bvh(&loaded);
+    remove(cache_path);
+    delete[] upload_copy;
+    delete[] reference_hits;
+    delete[] records;
+    delete[] rays;
+    destroy_triangle_soa(&triangles);
+}
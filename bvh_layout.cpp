@@ -0,0 +1,475 @@
+// This file has the BVH layout pass, which rewrites a built BVH into a different order in memory
+// build_bvh() leaves its nodes in depth-first order with the left child always right after its parent, which the traversals rely on. But which
+// nodes are next to each other in memory decides how many of them come in on the same cache line (or the same page), and for big trees that
+// don't fit in the cache, the order can matter as much as the tree itself
+// The reordered tree stores the two children of every interior node next to each other (a "sibling pair") and points to the pair, so that any
+// order of pairs works, not just depth-first, and a ray testing both children's boxes (which it always does) touches one spot in memory. The
+// layouts are:
+//     depth-first: each pair, then the whole subtree under its first child, then the one under its second child
+//     van Emde Boas: the top half of the tree's levels first, then each of the subtrees hanging off of the bottom of that, each laid out the same
+//         way, so that any small subtree (whatever the cache line or page size is) ends up close together in memory
+//     hot path: the pairs rays go into most often first (from a profile of sample rays, see count_bvh_visits()), so that the hot part of the tree
+//         is packed together at the front instead of spread out across the whole array
+// The triangles aren't moved, only the nodes
+// Compiling with -DBVH_NODE_LAYOUT=BVH_LAYOUT_VAN_EMDE_BOAS (or any of the other layouts below) packs scenes with their BVH reordered into that
+// layout, and traces them with paired_bvh_closest_hit() and paired_bvh_any_hit() (see scene_closest_hit()). It is ignored with -DUSE_WIDE_BVH,
+// -DUSE_TRIANGLE_BLOCKS, or -DUSE_STACKLESS_TRAVERSAL, which all need the BVH in its own format
+
+enum bvh_layout {
+    BVH_LAYOUT_DEPTH_FIRST,
+    BVH_LAYOUT_VAN_EMDE_BOAS,
+    BVH_LAYOUT_HOT_PATH
+};
+
+#if defined(BVH_NODE_LAYOUT) && !defined(USE_WIDE_BVH) && !defined(USE_TRIANGLE_BLOCKS) && !defined(USE_STACKLESS_TRAVERSAL)
+#define USE_PAIRED_BVH                  // Scenes get packed and traced with a reordered BVH
+#endif
+#define BVH_LAYOUT_PROFILE_RAYS 4096    // About how many camera rays the hot path layout gets profiled with when a scene is packed
+
+// A node of a reordered BVH. The same as bvh_node, except that an interior node's offset is the index of its first child, with the second child
+// always right after it
+struct paired_bvh_node {
+    bounding_box bounds;
+    int offset;                         // For a leaf, the index of its first triangle, and for an interior node, the index of its first child
+    int num_triangles;                  // How many triangles this leaf has, or 0 if this is an interior node
+
+    __device__ __host__ bool is_leaf() const {
+        return num_triangles > 0;
+    }
+};
+
+struct paired_bvh {
+    paired_bvh_node* nodes;
+    int num_nodes;
+};
+
+
+// Finds the closest triangle the given ray hits (closer than t_max) in a reordered BVH, the same way as bvh_closest_hit()
+__device__ __host__ collision paired_bvh_closest_hit(ray* r, paired_bvh_node* nodes, int num_nodes, triangle_record* triangles, real t_max) {
+    collision closest;
+    if (num_nodes == 0) {
+        return closest;
+    }
+
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    if (nodes[0].bounds.intersect(origin, inverse_direction, t_max) == INFINITY) {
+        return closest;
+    }
+
+    int stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        paired_bvh_node* node = &nodes[node_index];
+        if (node->is_leaf()) {
+            for (int i = node->offset; i < node->offset + node->num_triangles; i++) {
+                collision hit = ray_triangle_intersection_t(r, &triangles[i], i, t_max);
+                if (hit.has_collision) {
+                    closest = hit;
+                    t_max = hit.collision_distance;
+                }
+            }
+        } else {
+            int near_index = node->offset;
+            int far_index = node->offset + 1;
+            real t_near = nodes[near_index].bounds.intersect(origin, inverse_direction, t_max);
+            real t_far = nodes[far_index].bounds.intersect(origin, inverse_direction, t_max);
+            if (t_far < t_near) {
+                int temp_index = near_index;
+                near_index = far_index;
+                far_index = temp_index;
+                real temp_t = t_near;
+                t_near = t_far;
+                t_far = temp_t;
+            }
+
+            if (t_near != INFINITY) {
+                if (t_far != INFINITY) {
+                    stack[stack_size++] = far_index;
+                }
+                node_index = near_index;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        node_index = stack[--stack_size];
+    }
+    return closest;
+}
+
+
+// Traces the given rays through the given (regular) BVH and returns how many times each node was visited, for the hot path layout
+// Mirrors bvh_closest_hit(), counting every node whose triangles or children's boxes got tested
+__host__ int* count_bvh_visits(bvh_node* nodes, int num_nodes, triangle_record* triangles, ray* rays, int num_rays) {
+    int* visits = new int[num_nodes];
+    memset(visits, 0, sizeof(int) * num_nodes);
+    for (int ray_index = 0; ray_index < num_rays && num_nodes > 0; ray_index++) {
+        ray* r = &rays[ray_index];
+        vec3 origin = r->origin;
+        vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+        real t_max = INFINITY;
+        if (nodes[0].bounds.intersect(origin, inverse_direction, t_max) == INFINITY) {
+            continue;
+        }
+
+        int stack[BVH_MAX_DEPTH];
+        int stack_size = 0;
+        int node_index = 0;
+        while (true) {
+            bvh_node* node = &nodes[node_index];
+            visits[node_index]++;
+            if (node->is_leaf()) {
+                for (int i = node->offset; i < node->offset + node->num_triangles; i++) {
+                    collision hit = ray_triangle_intersection_t(r, &triangles[i], i, t_max);
+                    if (hit.has_collision) {
+                        t_max = hit.collision_distance;
+                    }
+                }
+            } else {
+                int near_index = node_index + 1;
+                int far_index = node->offset;
+                real t_near = nodes[near_index].bounds.intersect(origin, inverse_direction, t_max);
+                real t_far = nodes[far_index].bounds.intersect(origin, inverse_direction, t_max);
+                if (t_far < t_near) {
+                    int temp_index = near_index;
+                    near_index = far_index;
+                    far_index = temp_index;
+                    real temp_t = t_near;
+                    t_near = t_far;
+                    t_far = temp_t;
+                }
+                if (t_near != INFINITY) {
+                    if (t_far != INFINITY) {
+                        stack[stack_size++] = far_index;
+                    }
+                    node_index = near_index;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) {
+                break;
+            }
+            node_index = stack[--stack_size];
+        }
+    }
+    return visits;
+}
+
+
+// Adds every interior node exactly depth levels of interior nodes below the given one to the end of result
+__host__ void collect_bvh_descendants(bvh_node* nodes, int node_index, int depth, int* result, int* result_size) {
+    if (nodes[node_index].is_leaf()) {
+        return;
+    }
+    if (depth == 0) {
+        result[(*result_size)++] = node_index;
+        return;
+    }
+    collect_bvh_descendants(nodes, node_index + 1, depth - 1, result, result_size);
+    collect_bvh_descendants(nodes, nodes[node_index].offset, depth - 1, result, result_size);
+}
+
+
+// Adds the interior nodes of the top levels levels of the subtree under the given interior node to the end of order, in van Emde Boas order:
+// the top half of those levels first (recursively laid out the same way), then every subtree hanging off of the bottom of it, one at a time
+// heights has the height of every node, counted in interior nodes (so 0 for a leaf)
+__host__ void van_emde_boas_order(bvh_node* nodes, int num_nodes, int* heights, int node_index, int levels, int* order, int* order_size) {
+    if (levels <= 1) {
+        order[(*order_size)++] = node_index;
+        return;
+    }
+    int top_levels = levels / 2;
+    van_emde_boas_order(nodes, num_nodes, heights, node_index, top_levels, order, order_size);
+
+    int max_bottom_roots = top_levels < 30 && (1 << top_levels) < num_nodes ? 1 << top_levels : num_nodes;
+    int* bottom_roots = new int[max_bottom_roots];
+    int num_bottom_roots = 0;
+    collect_bvh_descendants(nodes, node_index, top_levels, bottom_roots, &num_bottom_roots);
+    for (int i = 0; i < num_bottom_roots; i++) {
+        int bottom_levels = levels - top_levels;
+        int root = bottom_roots[i];
+        van_emde_boas_order(nodes, num_nodes, heights, root, heights[root] < bottom_levels ? heights[root] : bottom_levels, order, order_size);
+    }
+    delete[] bottom_roots;
+}
+
+
+// Fills order with the hottest interior nodes (by visits) first: starting from the root, it always takes the hottest interior node whose parent
+// has already been taken, so that the front of the array holds the parts of the tree that most rays go through (with their parents before them)
+// Keeps the nodes that could be taken next in a binary heap, with the most visited one on top
+__host__ void hot_path_order(bvh_node* nodes, int num_nodes, int* visits, int* order, int* order_size) {
+    int* heap = new int[num_nodes];
+    int heap_size = 0;
+    heap[heap_size++] = 0;
+    while (heap_size > 0) {
+        int node_index = heap[0];
+        heap[0] = heap[--heap_size];
+        for (int i = 0; 2 * i + 1 < heap_size;) {                                       // Sifting the new top down to where it belongs
+            int child = 2 * i + 1;
+            if (child + 1 < heap_size && visits[heap[child + 1]] > visits[heap[child]]) {
+                child++;
+            }
+            if (visits[heap[child]] <= visits[heap[i]]) {
+                break;
+            }
+            int temp = heap[i];
+            heap[i] = heap[child];
+            heap[child] = temp;
+            i = child;
+        }
+        order[(*order_size)++] = node_index;
+
+        int children[2] = {node_index + 1, nodes[node_index].offset};
+        for (int c = 0; c < 2; c++) {
+            if (nodes[children[c]].is_leaf()) {
+                continue;
+            }
+            int i = heap_size++;                                                        // Sifting the new node up to where it belongs
+            heap[i] = children[c];
+            while (i > 0 && visits[heap[(i - 1) / 2]] < visits[heap[i]]) {
+                int temp = heap[i];
+                heap[i] = heap[(i - 1) / 2];
+                heap[(i - 1) / 2] = temp;
+                i = (i - 1) / 2;
+            }
+        }
+    }
+    delete[] heap;
+}
+
+
+// Rewrites the given BVH (from build_bvh() or anything else with the same layout) in the given layout, and returns the reordered copy
+// visits is only needed for BVH_LAYOUT_HOT_PATH (see count_bvh_visits()). The root always stays at index 0, and the triangles don't move
+__host__ paired_bvh reorder_bvh(bvh_node* nodes, int num_nodes, bvh_layout layout, int* visits) {
+    paired_bvh result;
+    result.num_nodes = num_nodes;
+    result.nodes = new paired_bvh_node[num_nodes];
+    if (num_nodes == 0) {
+        return result;
+    }
+
+    // Putting the interior nodes in order, since every interior node means one sibling pair (its children) to place
+    int* order = new int[num_nodes];
+    int order_size = 0;
+    if (layout == BVH_LAYOUT_DEPTH_FIRST) {
+        for (int i = 0; i < num_nodes; i++) {
+            if (!nodes[i].is_leaf()) {
+                order[order_size++] = i;                                                // build_bvh() already leaves its nodes depth-first
+            }
+        }
+    } else if (layout == BVH_LAYOUT_VAN_EMDE_BOAS) {
+        int* heights = new int[num_nodes];
+        for (int i = num_nodes - 1; i >= 0; i--) {                                      // Children always come after their parents
+            if (nodes[i].is_leaf()) {
+                heights[i] = 0;
+            } else {
+                int left_height = heights[i + 1];
+                int right_height = heights[nodes[i].offset];
+                heights[i] = 1 + (left_height > right_height ? left_height : right_height);
+            }
+        }
+        if (!nodes[0].is_leaf()) {
+            van_emde_boas_order(nodes, num_nodes, heights, 0, heights[0], order, &order_size);
+        }
+        delete[] heights;
+    } else if (!nodes[0].is_leaf()) {
+        hot_path_order(nodes, num_nodes, visits, order, &order_size);
+    }
+
+    // Placing the root, then each interior node's pair of children in order, and then writing every node to its new spot
+    int* new_index = new int[num_nodes];
+    new_index[0] = 0;
+    int next_index = 1;
+    for (int i = 0; i < order_size; i++) {
+        new_index[order[i] + 1] = next_index;
+        new_index[nodes[order[i]].offset] = next_index + 1;
+        next_index += 2;
+    }
+    for (int i = 0; i < num_nodes; i++) {
+        paired_bvh_node* node = &result.nodes[new_index[i]];
+        node->bounds = nodes[i].bounds;
+        node->num_triangles = nodes[i].num_triangles;
+        node->offset = nodes[i].is_leaf() ? nodes[i].offset : new_index[i + 1];
+    }
+
+    delete[] order;
+    delete[] new_index;
+    return result;
+}
+
+
+// generate_camera_ray() is defined in Main.hip, after all of the library files, so it is declared here for profiling scenes with their own camera
+__device__ __host__ ray generate_camera_ray(camera* curr_cam, dimensions* img_dim, int pixel_x, int pixel_y);
+
+// Reorders a scene's BVH into the given layout for packing. The hot path layout gets profiled with the scene's own camera rays, through an evenly
+// spaced grid of about BVH_LAYOUT_PROFILE_RAYS of the image's pixels
+__host__ paired_bvh layout_scene_bvh(bvh_node* nodes, int num_nodes, triangle_record* triangles, camera* cam, dimensions* img_dimensions,
+                                     bvh_layout layout) {
+    int* visits = nullptr;
+    if (layout == BVH_LAYOUT_HOT_PATH) {
+        int width = img_dimensions->width;
+        int height = img_dimensions->height;
+        int step = 1;
+        while ((width / step) * (height / step) > BVH_LAYOUT_PROFILE_RAYS) {
+            step++;
+        }
+        ray* rays = new ray[(width / step + 1) * (height / step + 1)];
+        int num_rays = 0;
+        for (int y = step / 2; y < height; y += step) {
+            for (int x = step / 2; x < width; x += step) {
+                rays[num_rays++] = generate_camera_ray(cam, img_dimensions, x, y);
+            }
+        }
+        visits = count_bvh_visits(nodes, num_nodes, triangles, rays, num_rays);
+        delete[] rays;
+    }
+
+    paired_bvh result = reorder_bvh(nodes, num_nodes, layout, visits);
+    delete[] visits;
+    return result;
+}
+
+
+// Counts cache misses on the host with the CPU's performance counters, around a stretch of code (Linux only, and only where the kernel allows it,
+// so the counts are -1 when it isn't available)
+struct cache_miss_counter {
+    int files[2];                       // The counters for last level cache misses and L1 data cache read misses, or -1 if they couldn't be opened
+};
+
+__host__ cache_miss_counter start_cache_miss_counter() {
+    cache_miss_counter counter;
+    counter.files[0] = -1;
+    counter.files[1] = -1;
+#ifdef __linux__
+    uint64_t configs[2] = {PERF_COUNT_HW_CACHE_MISSES,
+                           PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+    uint32_t types[2] = {PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+    for (int i = 0; i < 2; i++) {
+        perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = types[i];
+        attributes.config = configs[i];
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        counter.files[i] = (int) syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);      // This thread, on any CPU
+        if (counter.files[i] != -1) {
+            ioctl(counter.files[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter.files[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    return counter;
+}
+
+// Stops the given counter and writes how many misses it counted to last_level_misses and l1_misses (-1 for any that weren't available)
+__host__ void stop_cache_miss_counter(cache_miss_counter* counter, long long* last_level_misses, long long* l1_misses) {
+    long long* results[2] = {last_level_misses, l1_misses};
+    for (int i = 0; i < 2; i++) {
+        *results[i] = -1;
+#ifdef __linux__
+        if (counter->files[i] != -1) {
+            ioctl(counter->files[i], PERF_EVENT_IOC_DISABLE, 0);
+            long long count;
+            if (read(counter->files[i], &count, sizeof(count)) == sizeof(count)) {
+                *results[i] = count;
+            }
+            close(counter->files[i]);
+        }
+#endif
+    }
+}
+
+
+// Writes a miss count from stop_cache_miss_counter() into the given buffer for printing, as "n/a" if the counter wasn't available (so that it can't
+// be mistaken for a real count), and returns the buffer
+__host__ const char* format_cache_misses(long long count, char* buffer, size_t size) {
+    if (count < 0) {
+        snprintf(buffer, size, "n/a");
+    } else {
+        snprintf(buffer, size, "%lld", count);
+    }
+    return buffer;
+}
+
+
+// Builds a BVH over the given number of random triangles, reorders it into each layout, and traces both primary and incoherent rays (see
+// make_incoherent_benchmark_rays()) through the original order and every layout, printing the rays per second, the cache misses ("n/a" where
+// the performance counters aren't available, see start_cache_miss_counter()), and how many rays each layout disagreed with the original order on
+// (which should always be 0)
+// The hot path layout is profiled with a separate, smaller set of rays of the same kind than the ones it is timed with
+__host__ void benchmark_bvh_layout(int num_triangles, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, &random_state);
+    bvh tree = build_bvh(triangles, num_triangles);
+    printf("bvh layout benchmark: %i triangles, %i nodes (%.1f MB), %i rays\n", num_triangles, tree.num_nodes,
+           sizeof(bvh_node) * tree.num_nodes / (1024.0 * 1024.0), num_rays);
+
+    const char* layout_names[3] = {"depth-first", "van emde boas", "hot path"};
+    for (int incoherent = 0; incoherent < 2; incoherent++) {
+        int num_profile_rays = num_rays / 10 + 1;
+        ray* profile_rays = incoherent ? make_incoherent_benchmark_rays(num_profile_rays, &random_state)
+                                       : make_benchmark_rays(num_profile_rays, &random_state);
+        ray* rays = incoherent ? make_incoherent_benchmark_rays(num_rays, &random_state) : make_benchmark_rays(num_rays, &random_state);
+        int* visits = count_bvh_visits(tree.nodes, tree.num_nodes, triangles, profile_rays, num_profile_rays);
+        printf("  %s rays:\n", incoherent ? "incoherent" : "primary");
+
+        collision* reference_hits = new collision[num_rays];
+        long long last_level_misses;
+        long long l1_misses;
+        char last_level_text[32];
+        char l1_text[32];
+        cache_miss_counter counter = start_cache_miss_counter();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < num_rays; i++) {
+            reference_hits[i] = bvh_closest_hit(&rays[i], tree.nodes, tree.num_nodes, triangles, INFINITY);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        stop_cache_miss_counter(&counter, &last_level_misses, &l1_misses);
+        double ms = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+        printf("    build order: %.2f Mrays/s, %s llc misses, %s l1d misses\n", num_rays / ms / 1000.0,
+               format_cache_misses(last_level_misses, last_level_text, sizeof(last_level_text)),
+               format_cache_misses(l1_misses, l1_text, sizeof(l1_text)));
+
+        for (int layout = 0; layout < 3; layout++) {
+            auto reorder_start = std::chrono::high_resolution_clock::now();
+            paired_bvh reordered = reorder_bvh(tree.nodes, tree.num_nodes, (bvh_layout) layout, visits);
+            auto reorder_end = std::chrono::high_resolution_clock::now();
+
+            int num_mismatches = 0;
+            counter = start_cache_miss_counter();
+            start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < num_rays; i++) {
+                collision hit = paired_bvh_closest_hit(&rays[i], reordered.nodes, reordered.num_nodes, triangles, INFINITY);
+                if (hit.has_collision != reference_hits[i].has_collision ||
+                    (hit.has_collision && hit.collision_distance != reference_hits[i].collision_distance)) {
+                    num_mismatches++;
+                }
+            }
+            end = std::chrono::high_resolution_clock::now();
+            stop_cache_miss_counter(&counter, &last_level_misses, &l1_misses);
+
+            double reorder_ms = std::chrono::duration_cast<std::chrono::microseconds>(reorder_end - reorder_start).count() / 1000.0;
+            ms = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+            printf("    %s: reorder %.3f ms, %.2f Mrays/s, %s llc misses, %s l1d misses, %i mismatch(es)\n", layout_names[layout], reorder_ms,
+                   num_rays / ms / 1000.0, format_cache_misses(last_level_misses, last_level_text, sizeof(last_level_text)),
+                   format_cache_misses(l1_misses, l1_text, sizeof(l1_text)), num_mismatches);
+            assert(num_mismatches == 0);
+            delete[] reordered.nodes;
+        }
+
+        delete[] visits;
+        delete[] reference_hits;
+        delete[] profile_rays;
+        delete[] rays;
+    }
+
+    delete[] tree.nodes;
+    delete[] triangles;
+}
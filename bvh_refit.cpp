@@ -0,0 +1,366 @@
+// This file has BVH refitting, for scenes where triangles move around but never get added, removed, or reconnected (like a character mesh bending
+// as it animates)
+// Since the triangles are the same, the shape of the tree can stay the same too -- only the boxes need to grow or shrink to fit the triangles'
+// new positions, which is much cheaper than building a whole new tree. Like the bounds step of the LBVH builder (see lbvh.cpp), every leaf walks
+// up the tree fixing boxes as it goes, and at every node the first child to arrive stops while the second one (which knows both children are
+// done) fixes the node's box and keeps going. That runs split across threads on the host, or as one kernel on the device
+// The catch is that the tree was built for where the triangles used to be, so the more they move, the worse the tree fits them (boxes grow and
+// overlap) and the slower it is to trace. A bvh_quality_monitor keeps track of that with the tree's SAH cost, and does a full rebuild once the
+// cost has grown too much
+
+// Keeps track of how much a refitted tree has gotten worse since it was last built from scratch
+struct bvh_quality_monitor {
+    real rebuild_threshold;             // How many times the built cost the refitted cost is allowed to reach before a rebuild (1.5 means rebuild
+                                        // once tracing is expected to be 50% slower than with a fresh tree)
+    real built_cost;                    // The SAH cost (see bvh_sah_cost()) of the tree right after it was last built
+    real current_cost;                  // The SAH cost after the latest refit
+    int refits_since_rebuild;
+    int num_rebuilds;
+};
+
+// A BVH that can be refitted, along with everything refitting needs
+struct refittable_bvh {
+    bvh tree;
+    int* parents;                       // The node above each node, or -1 for the root
+    triangle_record* triangles;         // The triangle records, in the tree's order
+    int num_triangles;
+    bvh_quality_monitor monitor;
+};
+
+
+// Finds the parent of every node in the given tree, which the node layout itself doesn't store (it only points down)
+__host__ int* build_bvh_parents(bvh_node* nodes, int num_nodes) {
+    int* parents = new int[num_nodes];
+    if (num_nodes > 0) {
+        parents[0] = -1;
+    }
+    for (int i = 0; i < num_nodes; i++) {
+        if (!nodes[i].is_leaf()) {
+            parents[i + 1] = i;
+            parents[nodes[i].offset] = i;
+        }
+    }
+    return parents;
+}
+
+
+// Remakes the triangle record at the given index from the triangle's new vertices, which are found in vertices at the record's source_index
+__device__ __host__ void refit_triangle(triangle_soa* vertices, triangle_record* triangles, int index) {
+    triangle_record* record = &triangles[index];
+    int source = record->source_index;
+    *record = make_triangle_record(vertices->get_a(source), vertices->get_b(source), vertices->get_c(source), record->material_index, source);
+}
+
+
+// Fixes the box of the given node if it is a leaf, and then walks up the tree from it, fixing the box of every node whose other child has
+// already finished too
+__device__ __host__ void refit_from_leaf(bvh_node* nodes, int* parents, int* arrival_counts, triangle_record* triangles, int node_index) {
+    bvh_node* leaf = &nodes[node_index];
+    if (!leaf->is_leaf()) {
+        return;
+    }
+    bounding_box leaf_bounds;
+    for (int i = leaf->offset; i < leaf->offset + leaf->num_triangles; i++) {
+        leaf_bounds.grow(triangle_bounds(&triangles[i]));
+    }
+    leaf->bounds = leaf_bounds;
+
+    int node = parents[node_index];
+    while (node != -1) {
+        if (lbvh_arrive(&arrival_counts[node]) == 0) {
+            return;                                                                     // The other child will finish this node when it gets here
+        }
+#ifdef __HIP_DEVICE_COMPILE__
+        __threadfence();
+#endif
+        bounding_box bounds = lbvh_load_bounds(&nodes[node + 1].bounds);
+        bounds.grow(lbvh_load_bounds(&nodes[nodes[node].offset].bounds));
+        nodes[node].bounds = bounds;
+        node = parents[node];
+    }
+}
+
+
+// Refits the given tree on the host, split across the given number of threads, after the triangles' vertices have been changed to the ones in
+// vertices (which must hold the triangles in their original order, the same one their records' source_index values refer to)
+__host__ void refit_bvh(bvh_node* nodes, int num_nodes, int* parents, triangle_record* triangles, int num_triangles, triangle_soa* vertices,
+                        int num_threads) {
+    if (num_triangles < 4096) {
+        num_threads = 1;                                                                // Not worth starting threads for
+    }
+
+    parallel_for(num_triangles, num_threads, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            refit_triangle(vertices, triangles, i);
+        }
+    });
+
+    int* arrival_counts = new int[num_nodes];
+    memset(arrival_counts, 0, sizeof(int) * num_nodes);
+    parallel_for(num_nodes, num_threads, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            refit_from_leaf(nodes, parents, arrival_counts, triangles, i);
+        }
+    });
+    delete[] arrival_counts;
+}
+
+
+__global__ void refit_triangles_kernel(triangle_soa vertices, triangle_record* triangles, int num_triangles) {
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i < num_triangles) {
+        refit_triangle(&vertices, triangles, i);
+    }
+}
+
+__global__ void refit_nodes_kernel(bvh_node* nodes, int num_nodes, int* parents, int* arrival_counts, triangle_record* triangles) {
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i < num_nodes) {
+        refit_from_leaf(nodes, parents, arrival_counts, triangles, i);
+    }
+}
+
+
+// Refits a tree that lives on the device, where gpu_vertices is a triangle_soa whose vertex arrays are in device memory
+// Everything is queued up on the given stream without waiting for any of it. The arrival counters come out of the arena's frame region, and this
+// returns false if the arena ran out of space for them
+__host__ bool refit_bvh_gpu(memory_arena* arena, bvh_node* nodes, int num_nodes, int* parents, triangle_record* triangles, int num_triangles,
+                            triangle_soa gpu_vertices, hipStream_t stream) {
+    if (num_nodes == 0) {
+        return true;
+    }
+    int* arrival_counts = (int*) arena_allocate(&arena->frame, sizeof(int) * num_nodes, 256);
+    if (arrival_counts == nullptr) {
+        return false;
+    }
+
+    hipMemsetAsync(arrival_counts, 0, sizeof(int) * num_nodes, stream);
+    refit_triangles_kernel<<<
+        dim3((num_triangles + LBVH_BLOCK_SIZE - 1) / LBVH_BLOCK_SIZE),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(gpu_vertices, triangles, num_triangles);
+    refit_nodes_kernel<<<
+        dim3((num_nodes + LBVH_BLOCK_SIZE - 1) / LBVH_BLOCK_SIZE),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(nodes, num_nodes, parents, arrival_counts, triangles);
+    return true;
+}
+
+
+// (Re)builds the whole tree from scratch out of the given triangles, and resets the quality monitor to the new tree's cost
+__host__ void rebuild_refittable_bvh(refittable_bvh* result, triangle_soa* vertices) {
+    delete[] result->tree.nodes;
+    delete[] result->parents;
+    delete[] result->triangles;
+
+    result->num_triangles = vertices->num_triangles;
+    result->triangles = build_triangle_records(vertices);
+    result->tree = build_bvh(result->triangles, result->num_triangles);
+    result->parents = build_bvh_parents(result->tree.nodes, result->tree.num_nodes);
+
+    result->monitor.built_cost = bvh_sah_cost(result->tree.nodes, result->tree.num_nodes);
+    result->monitor.current_cost = result->monitor.built_cost;
+    result->monitor.refits_since_rebuild = 0;
+}
+
+
+// Builds a refittable tree over the given triangles, which gets fully rebuilt once refitting has made its SAH cost rebuild_threshold times worse
+__host__ refittable_bvh create_refittable_bvh(triangle_soa* vertices, real rebuild_threshold) {
+    refittable_bvh result;
+    result.tree.nodes = nullptr;
+    result.tree.num_nodes = 0;
+    result.parents = nullptr;
+    result.triangles = nullptr;
+    result.monitor.rebuild_threshold = rebuild_threshold;
+    result.monitor.num_rebuilds = 0;
+    rebuild_refittable_bvh(&result, vertices);
+    return result;
+}
+
+
+__host__ void destroy_refittable_bvh(refittable_bvh* refittable) {
+    delete[] refittable->tree.nodes;
+    delete[] refittable->parents;
+    delete[] refittable->triangles;
+    refittable->tree.nodes = nullptr;
+    refittable->parents = nullptr;
+    refittable->triangles = nullptr;
+}
+
+
+// Updates the tree for the triangles' new vertices: refits it, then checks the refitted tree's SAH cost and rebuilds it from scratch instead if
+// the cost has gotten too much worse than it was right after the last build. Returns true if it rebuilt
+// The vertices must have the same triangles in the same order as when the tree was made (only their positions can change)
+__host__ bool update_refittable_bvh(refittable_bvh* refittable, triangle_soa* vertices, int num_threads) {
+    assert(vertices->num_triangles == refittable->num_triangles);
+    refit_bvh(refittable->tree.nodes, refittable->tree.num_nodes, refittable->parents, refittable->triangles, refittable->num_triangles,
+              vertices, num_threads);
+
+    bvh_quality_monitor* monitor = &refittable->monitor;
+    monitor->current_cost = bvh_sah_cost(refittable->tree.nodes, refittable->tree.num_nodes);
+    monitor->refits_since_rebuild++;
+    if (monitor->current_cost <= monitor->built_cost * monitor->rebuild_threshold) {
+        return false;
+    }
+
+    rebuild_refittable_bvh(refittable, vertices);
+    monitor->num_rebuilds++;
+    return true;
+}
+
+
+// Animates a scene of the given number of random triangles for the given number of frames (every triangle drifts in its own direction, so the tree
+// slowly stops fitting them), updating the tree every frame, and prints how long refitting took compared to rebuilding, how far the SAH cost
+// drifted, and how many rebuilds the quality monitor asked for -- plus how many of a batch of rays found a different closest hit on the last
+// frame than with a freshly built tree (which should always be 0), and the same for one refit of the final positions on the device
+__host__ void benchmark_refit(int num_triangles, int num_frames, real rebuild_threshold) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* start_triangles = make_benchmark_triangles(num_triangles, &random_state);
+    int num_rays = 1000;
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+    int num_threads = std::thread::hardware_concurrency();
+    num_threads = num_threads > 0 ? num_threads : 1;
+
+    // The "vertex buffer" that gets animated, plus a random drift direction for every triangle
+    triangle_soa vertices = triangle_soa_from_records(start_triangles, num_triangles, 1);
+    vec3* drift = new vec3[num_triangles];
+    for (int i = 0; i < num_triangles; i++) {
+        drift[i] = vec3(benchmark_random(&random_state) - 0.5, benchmark_random(&random_state) - 0.5, benchmark_random(&random_state) - 0.5);
+    }
+
+    refittable_bvh refittable = create_refittable_bvh(&vertices, rebuild_threshold);
+    double update_ms = 0;
+    double worst_cost_ratio = 1;
+    for (int frame = 0; frame < num_frames; frame++) {
+        for (int i = 0; i < num_triangles; i++) {
+            vertices.v0_x[i] += drift[i].x;
+            vertices.v0_y[i] += drift[i].y;
+            vertices.v0_z[i] += drift[i].z;
+            vertices.v1_x[i] += drift[i].x;
+            vertices.v1_y[i] += drift[i].y;
+            vertices.v1_z[i] += drift[i].z;
+            vertices.v2_x[i] += drift[i].x;
+            vertices.v2_y[i] += drift[i].y;
+            vertices.v2_z[i] += drift[i].z;
+        }
+
+        auto update_start = std::chrono::high_resolution_clock::now();
+        bool rebuilt = update_refittable_bvh(&refittable, &vertices, num_threads);
+        auto update_end = std::chrono::high_resolution_clock::now();
+        update_ms += std::chrono::duration_cast<std::chrono::microseconds>(update_end - update_start).count() / 1000.0;
+        if (!rebuilt) {
+            real ratio = refittable.monitor.current_cost / refittable.monitor.built_cost;
+            worst_cost_ratio = ratio > worst_cost_ratio ? ratio : worst_cost_ratio;
+        }
+    }
+
+    // Timing one refit and one full rebuild of the final positions on their own, and checking the refitted tree against the rebuilt one
+    auto refit_start = std::chrono::high_resolution_clock::now();
+    refit_bvh(refittable.tree.nodes, refittable.tree.num_nodes, refittable.parents, refittable.triangles, num_triangles, &vertices, num_threads);
+    auto refit_end = std::chrono::high_resolution_clock::now();
+
+    auto rebuild_start = std::chrono::high_resolution_clock::now();
+    triangle_record* rebuilt_triangles = build_triangle_records(&vertices);
+    bvh rebuilt_tree = build_bvh(rebuilt_triangles, num_triangles);
+    auto rebuild_end = std::chrono::high_resolution_clock::now();
+
+    collision* reference_hits = new collision[num_rays];
+    for (int i = 0; i < num_rays; i++) {
+        reference_hits[i] = bvh_closest_hit(&rays[i], rebuilt_tree.nodes, rebuilt_tree.num_nodes, rebuilt_triangles, INFINITY);
+    }
+    int num_mismatches = count_hit_mismatches(rays, num_rays, reference_hits, refittable.tree.nodes, refittable.tree.num_nodes, refittable.triangles);
+
+    // The same refit on the device, timed on the GPU without the uploads and downloads around it. The tree goes up with every box emptied, so the
+    // boxes that come back were all made by refit_bvh_gpu(), and have to match the host's exactly (both just take mins and maxes of the same
+    // vertices)
+    int num_nodes = refittable.tree.num_nodes;
+    size_t vertices_size = sizeof(real) * num_triangles;
+    size_t nodes_size = sizeof(bvh_node) * num_nodes;
+    size_t triangles_size = sizeof(triangle_record) * num_triangles;
+    memory_arena arena = create_arena(MEMORY_TARGET_GPU, 9 * vertices_size + nodes_size + sizeof(int) * num_nodes + triangles_size + 13 * 256,
+                                      sizeof(int) * num_nodes + 256);
+    real** cpu_vertex_arrays[9] = {&vertices.v0_x, &vertices.v0_y, &vertices.v0_z, &vertices.v1_x, &vertices.v1_y, &vertices.v1_z,
+                                   &vertices.v2_x, &vertices.v2_y, &vertices.v2_z};
+    triangle_soa gpu_vertices = vertices;
+    real** gpu_vertex_arrays[9] = {&gpu_vertices.v0_x, &gpu_vertices.v0_y, &gpu_vertices.v0_z, &gpu_vertices.v1_x, &gpu_vertices.v1_y,
+                                   &gpu_vertices.v1_z, &gpu_vertices.v2_x, &gpu_vertices.v2_y, &gpu_vertices.v2_z};
+    for (int i = 0; i < 9; i++) {
+        *gpu_vertex_arrays[i] = (real*) arena_allocate(&arena.scene, vertices_size, 256);
+        arena_copy_from_cpu(&arena, *gpu_vertex_arrays[i], *cpu_vertex_arrays[i], vertices_size);
+    }
+    gpu_vertices.material_index = nullptr;                                              // Refitting only reads the vertices
+    gpu_vertices.materials = nullptr;
+
+    bvh_node* gpu_tree_nodes = new bvh_node[num_nodes];
+    memcpy(gpu_tree_nodes, refittable.tree.nodes, nodes_size);
+    for (int i = 0; i < num_nodes; i++) {
+        gpu_tree_nodes[i].bounds = bounding_box();
+    }
+    triangle_record* gpu_tree_triangles = new triangle_record[num_triangles];
+    memcpy(gpu_tree_triangles, refittable.triangles, triangles_size);
+    bvh_node* gpu_nodes = (bvh_node*) arena_allocate(&arena.scene, nodes_size, 256);
+    int* gpu_parents = (int*) arena_allocate(&arena.scene, sizeof(int) * num_nodes, 256);
+    triangle_record* gpu_triangles = (triangle_record*) arena_allocate(&arena.scene, triangles_size, 256);
+    arena_copy_from_cpu(&arena, gpu_nodes, gpu_tree_nodes, nodes_size);
+    arena_copy_from_cpu(&arena, gpu_parents, refittable.parents, sizeof(int) * num_nodes);
+    arena_copy_from_cpu(&arena, gpu_triangles, gpu_tree_triangles, triangles_size);
+
+    hipStream_t stream;
+    hipEvent_t gpu_start;
+    hipEvent_t gpu_end;
+    hipStreamCreate(&stream);
+    hipEventCreate(&gpu_start);
+    hipEventCreate(&gpu_end);
+    hipEventRecord(gpu_start, stream);
+    bool gpu_refitted = refit_bvh_gpu(&arena, gpu_nodes, num_nodes, gpu_parents, gpu_triangles, num_triangles, gpu_vertices, stream);
+    hipEventRecord(gpu_end, stream);
+    hipEventSynchronize(gpu_end);
+    float gpu_ms = 0;
+    hipEventElapsedTime(&gpu_ms, gpu_start, gpu_end);
+
+    arena_copy_to_cpu(&arena, gpu_tree_nodes, gpu_nodes, nodes_size);
+    arena_copy_to_cpu(&arena, gpu_tree_triangles, gpu_triangles, triangles_size);
+    int num_gpu_box_mismatches = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        bounding_box* host_box = &refittable.tree.nodes[i].bounds;
+        bounding_box* gpu_box = &gpu_tree_nodes[i].bounds;
+        if (host_box->min.x != gpu_box->min.x || host_box->min.y != gpu_box->min.y || host_box->min.z != gpu_box->min.z ||
+            host_box->max.x != gpu_box->max.x || host_box->max.y != gpu_box->max.y || host_box->max.z != gpu_box->max.z) {
+            num_gpu_box_mismatches++;
+        }
+    }
+    int num_gpu_mismatches = count_hit_mismatches(rays, num_rays, reference_hits, gpu_tree_nodes, num_nodes, gpu_tree_triangles);
+
+    double refit_ms = std::chrono::duration_cast<std::chrono::microseconds>(refit_end - refit_start).count() / 1000.0;
+    double rebuild_ms = std::chrono::duration_cast<std::chrono::microseconds>(rebuild_end - rebuild_start).count() / 1000.0;
+    printf("refit benchmark: %i triangles, %i frames, rebuild threshold %.2f\n", num_triangles, num_frames, (double) rebuild_threshold);
+    printf("  one refit: %.3f ms, one rebuild: %.3f ms, average update: %.3f ms\n", refit_ms, rebuild_ms, update_ms / num_frames);
+    printf("  %i rebuild(s), worst refitted sah cost %.2fx the built cost, %i mismatch(es)\n", refittable.monitor.num_rebuilds,
+           worst_cost_ratio, num_mismatches);
+    assert(num_mismatches == 0);
+    if (gpu_refitted) {
+        printf("  one refit on device: %.3f ms, %i box(es) different from the host refit, %i mismatch(es)\n", gpu_ms, num_gpu_box_mismatches,
+               num_gpu_mismatches);
+        assert(num_gpu_box_mismatches == 0 && num_gpu_mismatches == 0);
+    }
+
+    hipEventDestroy(gpu_start);
+    hipEventDestroy(gpu_end);
+    hipStreamDestroy(stream);
+    destroy_arena(&arena);
+    delete[] gpu_tree_nodes;
+    delete[] gpu_tree_triangles;
+
+    destroy_refittable_bvh(&refittable);
+    delete[] rebuilt_tree.nodes;
+    delete[] rebuilt_triangles;
+    delete[] reference_hits;
+    delete[] drift;
+    destroy_triangle_soa(&vertices);
+    delete[] start_triangles;
+    delete[] rays;
+}
@@ -0,0 +1,174 @@
+// This file has a stackless way of walking the BVH, for the GPU
+// bvh_closest_hit() keeps a stack of BVH_MAX_DEPTH node indices per thread. On the GPU that stack doesn't fit in registers, so it spills into
+// scratch memory, and the registers and scratch every thread needs limit how many threads can run at once on each compute unit (the occupancy)
+// Instead of a stack, this walk uses the parent of every node (see build_bvh_parents()) to find its way back up the tree: from any node it can
+// work out where to go next from just the node it is at and which direction it came from (down from the parent, across from the sibling, or up
+// from a child), so the whole traversal state is two ints. The price is some extra steps back up the tree, plus visiting a node's children in
+// an order that only depends on the ray's direction (so that the walk back up can tell which child was visited first), instead of the order
+// the ray actually hits their boxes in
+// Compile with -DUSE_STACKLESS_TRAVERSAL to have the kernel trace with this instead of bvh_closest_hit() (the wide BVH, if also turned on, wins)
+
+// Which way the stackless walk arrived at the node it is at
+#define STACKLESS_FROM_PARENT 0
+#define STACKLESS_FROM_SIBLING 1
+#define STACKLESS_FROM_CHILD 2
+
+
+// Returns which child of the given interior node the walk visits first: the one whose box center comes first along the ray's direction
+// This always gives the same answer for the same node and ray, which the walk relies on to know, when coming back up, whether it still has to
+// visit the other child
+__device__ __host__ int stackless_near_child(bvh_node* nodes, int node_index, vec3 direction) {
+    int left = node_index + 1;
+    int right = nodes[node_index].offset;
+    real left_distance = nodes[left].bounds.center().dot(direction);
+    real right_distance = nodes[right].bounds.center().dot(direction);
+    return left_distance <= right_distance ? left : right;
+}
+
+
+// Returns the other child of the given node's parent
+__device__ __host__ int stackless_sibling(bvh_node* nodes, int* parents, int node_index) {
+    int parent = parents[node_index];
+    return node_index == parent + 1 ? nodes[parent].offset : parent + 1;
+}
+
+
+// Tests the ray against every triangle in the given leaf, keeping the closest hit so far in closest (and shrinking t_max to match)
+__device__ __host__ void stackless_test_leaf(ray* r, bvh_node* leaf, triangle_record* triangles, collision* closest, real* t_max) {
+    for (int i = leaf->offset; i < leaf->offset + leaf->num_triangles; i++) {
+        collision hit = ray_triangle_intersection_t(r, &triangles[i], i, *t_max);
+        if (hit.has_collision) {
+            *closest = hit;
+            *t_max = hit.collision_distance;
+        }
+    }
+}
+
+
+// Finds the closest triangle the given ray hits (closer than t_max), the same as bvh_closest_hit(), but without a stack (see the top of this file)
+// parents has to be the parent array of the given nodes, from build_bvh_parents()
+__device__ __host__ collision bvh_closest_hit_stackless(ray* r, bvh_node* nodes, int* parents, int num_nodes, triangle_record* triangles,
+                                                        real t_max) {
+    collision closest;
+    if (num_nodes == 0) {
+        return closest;
+    }
+
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    if (nodes[0].bounds.intersect(origin, inverse_direction, t_max) == INFINITY) {
+        return closest;
+    }
+    if (nodes[0].is_leaf()) {
+        stackless_test_leaf(r, &nodes[0], triangles, &closest, &t_max);
+        return closest;
+    }
+
+    int current = stackless_near_child(nodes, 0, r->direction);
+    int state = STACKLESS_FROM_PARENT;
+    while (true) {
+        if (state == STACKLESS_FROM_CHILD) {
+            // Back up at current after finishing one of its children: if that was the first child, the second one is next, otherwise current
+            // is done too
+            if (current == 0) {
+                break;
+            }
+            int parent = parents[current];
+            if (current == stackless_near_child(nodes, parent, r->direction)) {
+                current = stackless_sibling(nodes, parents, current);
+                state = STACKLESS_FROM_SIBLING;
+            } else {
+                current = parent;
+            }
+            continue;
+        }
+
+        // Down from the parent or across from the sibling: either way, current's box gets tested and, if hit, current gets visited
+        bvh_node* node = &nodes[current];
+        bool hit_box = node->bounds.intersect(origin, inverse_direction, t_max) != INFINITY;
+        if (hit_box && !node->is_leaf()) {
+            current = stackless_near_child(nodes, current, r->direction);
+            state = STACKLESS_FROM_PARENT;
+            continue;
+        }
+        if (hit_box) {
+            stackless_test_leaf(r, node, triangles, &closest, &t_max);
+        }
+
+        // Done with current, so next is its sibling if current was the first child, or otherwise back up to the parent
+        if (state == STACKLESS_FROM_PARENT) {
+            current = stackless_sibling(nodes, parents, current);
+            state = STACKLESS_FROM_SIBLING;
+        } else {
+            current = parents[current];
+            state = STACKLESS_FROM_CHILD;
+        }
+    }
+    return closest;
+}
+
+
+// Makes the given number of incoherent rays: each one starts at a random point in the benchmark scene's box and goes off in a random direction, so
+// neighboring rays have nothing in common (like rays that have bounced off of a rough surface)
+__host__ ray* make_incoherent_benchmark_rays(int num_rays, uint32_t* random_state) {
+    ray* rays = new ray[num_rays];
+    for (int i = 0; i < num_rays; i++) {
+        vec3 origin = vec3(benchmark_random(random_state) * 100 - 50, benchmark_random(random_state) * 100 - 50, benchmark_random(random_state) * 100 + 10);
+        vec3 direction = vec3(0, 0, 0);
+        while (direction.magnitude() < (real) 0.01) {
+            direction = vec3(benchmark_random(random_state) - 0.5, benchmark_random(random_state) - 0.5, benchmark_random(random_state) - 0.5);
+        }
+        rays[i] = ray(origin, direction.normalize());
+    }
+    return rays;
+}
+
+
+// Traces primary rays (all from the camera, toward neighboring points, see make_benchmark_rays()) and then incoherent rays through a BVH over the
+// given number of random triangles, with both the stack and the stackless traversal, and prints how long each took and how many rays the two
+// disagreed on (which should always be 0)
+// This runs on the host, where a stack costs nothing extra, so it only shows the extra work the stackless walk does -- the occupancy it gains back
+// only shows up on the GPU
+__host__ void benchmark_stackless(int num_triangles, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, &random_state);
+    bvh tree = build_bvh(triangles, num_triangles);
+    int* parents = build_bvh_parents(tree.nodes, tree.num_nodes);
+    printf("stackless traversal benchmark: %i triangles, %i rays, %i bytes of traversal stack per ray saved\n", num_triangles, num_rays,
+           (int) (sizeof(int) * BVH_MAX_DEPTH));
+
+    for (int incoherent = 0; incoherent < 2; incoherent++) {
+        ray* rays = incoherent ? make_incoherent_benchmark_rays(num_rays, &random_state) : make_benchmark_rays(num_rays, &random_state);
+
+        collision* stack_hits = new collision[num_rays];
+        auto stack_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < num_rays; i++) {
+            stack_hits[i] = bvh_closest_hit(&rays[i], tree.nodes, tree.num_nodes, triangles, INFINITY);
+        }
+        auto stack_end = std::chrono::high_resolution_clock::now();
+
+        int num_mismatches = 0;
+        auto stackless_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < num_rays; i++) {
+            collision hit = bvh_closest_hit_stackless(&rays[i], tree.nodes, parents, tree.num_nodes, triangles, INFINITY);
+            if (hit.has_collision != stack_hits[i].has_collision ||
+                (hit.has_collision && hit.collision_distance != stack_hits[i].collision_distance)) {
+                num_mismatches++;
+            }
+        }
+        auto stackless_end = std::chrono::high_resolution_clock::now();
+
+        double stack_ms = std::chrono::duration_cast<std::chrono::microseconds>(stack_end - stack_start).count() / 1000.0;
+        double stackless_ms = std::chrono::duration_cast<std::chrono::microseconds>(stackless_end - stackless_start).count() / 1000.0;
+        printf("  %s rays: stack %.3f ms, stackless %.3f ms, %i mismatch(es)\n", incoherent ? "incoherent" : "primary", stack_ms, stackless_ms,
+               num_mismatches);
+        assert(num_mismatches == 0);
+
+        delete[] stack_hits;
+        delete[] rays;
+    }
+
+    delete[] tree.nodes;
+    delete[] parents;
+    delete[] triangles;
+}
@@ -0,0 +1,366 @@
+// This file has the benchmarks for the renderer's core types from main_structs.cpp: how many heap allocations a pixel costs with vec3 compared to
+// the old pointer-per-component vector, how fast triangles can be tested out of a triangle_soa compared to a triangle** and to triangle records,
+// and how fast (and how differently) the renderer traces with floats compared to doubles. They live here instead of in main_structs.cpp because
+// they need the benchmark scenes, the scene packer, and the Whitted shader, which all come after it
+
+// Counting every heap allocation the host makes while the benchmarks are compiled in, by replacing the global "new" (device code never goes
+// through these, see device_new() for counting allocations on the device)
+#if defined(RUN_BVH_BENCHMARK) && !defined(__HIP_DEVICE_COMPILE__)
+size_t benchmark_heap_allocations = 0;
+
+void* operator new(size_t size) {
+    benchmark_heap_allocations++;
+    void* result = malloc(size > 0 ? size : 1);
+    if (result == nullptr) {
+        throw std::bad_alloc();
+    }
+    return result;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    free(pointer);
+}
+#endif
+
+
+// A copy of the vector type the renderer used before vec3: every component is its own heap allocation, methods change the vector in place, and
+// anything that makes a new vector (like cross()) returns a pointer to one made with "new". Only used to measure what a pixel used to cost
+struct legacy_vector {
+    real* x = new real[1];
+    real* y = new real[1];
+    real* z = new real[1];
+
+    legacy_vector(real _x, real _y, real _z) {
+        *x = _x;
+        *y = _y;
+        *z = _z;
+    }
+
+    ~legacy_vector() {
+        delete[] x;
+        delete[] y;
+        delete[] z;
+    }
+
+    legacy_vector* clone() {
+        return new legacy_vector(*x, *y, *z);
+    }
+
+    void add(legacy_vector* v) {
+        *x += *v->x;
+        *y += *v->y;
+        *z += *v->z;
+    }
+
+    void sub(legacy_vector* v) {
+        *x -= *v->x;
+        *y -= *v->y;
+        *z -= *v->z;
+    }
+
+    void scale(real s) {
+        *x *= s;
+        *y *= s;
+        *z *= s;
+    }
+
+    void normalize() {
+        scale(1 / sqrt((*x * *x) + (*y * *y) + (*z * *z)));
+    }
+
+    real dot(legacy_vector* v) {
+        return (*x * *v->x) + (*y * *v->y) + (*z * *v->z);
+    }
+
+    legacy_vector* cross(legacy_vector* v) {
+        return new legacy_vector((*y * *v->z) - (*z * *v->y), (*z * *v->x) - (*x * *v->z), (*x * *v->y) - (*y * *v->x));
+    }
+};
+
+
+// The Möller–Trumbore test (see ray_triangle_intersection_moller_trumbore()) written with legacy_vector, the way it would have been before vec3
+// Returns whether the ray hits, and writes the hit's t-value to t_out
+bool legacy_moller_trumbore(legacy_vector* origin, legacy_vector* direction, legacy_vector* v0, legacy_vector* e1, legacy_vector* e2, real* t_out) {
+    bool hit = false;
+    legacy_vector* p = direction->cross(e2);
+    real inverse_determinant = 1 / e1->dot(p);
+    legacy_vector* s = origin->clone();
+    s->sub(v0);
+    real u = s->dot(p) * inverse_determinant;
+    if (u >= 0 && u <= 1) {
+        legacy_vector* q = s->cross(e1);
+        real v = direction->dot(q) * inverse_determinant;
+        *t_out = e2->dot(q) * inverse_determinant;
+        if (v >= 0 && u + v <= 1 && *t_out > 0) {
+            legacy_vector* collision_point = direction->clone();                // The old tests always worked out the hit point too
+            collision_point->scale(*t_out);
+            collision_point->add(origin);
+            delete collision_point;
+            hit = true;
+        }
+        delete q;
+    }
+    delete p;
+    delete s;
+    return hit;
+}
+
+
+// Renders a width x height image of the given number of random triangles on the host twice, testing every pixel's camera ray against every
+// triangle the way the old test_kernel did: once with legacy_vector (making the ray and testing it like the old code, with its leaks fixed) and
+// once with vec3, and prints how many heap allocations each one made per pixel. The vec3 version should never allocate, and both should find the
+// same hits
+#ifdef RUN_BVH_BENCHMARK
+__host__ void benchmark_pixel_allocations(int num_triangles, int width, int height) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, &random_state);
+    legacy_vector** legacy_v0 = new legacy_vector*[num_triangles];
+    legacy_vector** legacy_e1 = new legacy_vector*[num_triangles];
+    legacy_vector** legacy_e2 = new legacy_vector*[num_triangles];
+    for (int i = 0; i < num_triangles; i++) {
+        legacy_v0[i] = new legacy_vector(triangles[i].v0.x, triangles[i].v0.y, triangles[i].v0.z);
+        legacy_e1[i] = new legacy_vector(triangles[i].e1.x, triangles[i].e1.y, triangles[i].e1.z);
+        legacy_e2[i] = new legacy_vector(triangles[i].e2.x, triangles[i].e2.y, triangles[i].e2.z);
+    }
+    camera cam = camera(vec3(0, 0, 0), vec3(0, 0, 0), (real) width);
+    dimensions dims = dimensions(width, height);
+    legacy_vector* legacy_cam_origin = new legacy_vector(cam.origin.x, cam.origin.y, cam.origin.z);
+    int num_pixels = width * height;
+
+    // Before: the ray and everything the test works out are legacy_vectors, plus the old kernel's bool and t-value outputs
+    int legacy_hits = 0;
+    size_t legacy_start_count = benchmark_heap_allocations;
+    auto legacy_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_pixels; i++) {
+        legacy_vector* origin = new legacy_vector(0, 0, 0);
+        legacy_vector* direction = new legacy_vector((-(real) width / 2) + (i % width) + (real) 0.5, (-(real) height / 2) + (i / width) + (real) 0.5,
+                                                     cam.fov_scale);
+        origin->add(legacy_cam_origin);
+        direction->normalize();
+        bool* has_an_intersection = new bool[1];
+        *has_an_intersection = false;
+        for (int j = 0; j < num_triangles; j++) {
+            bool* has_intersection = new bool[1];
+            real* t_out = new real[1];
+            *has_intersection = legacy_moller_trumbore(origin, direction, legacy_v0[j], legacy_e1[j], legacy_e2[j], t_out);
+            *has_an_intersection |= *has_intersection;
+            delete[] has_intersection;
+            delete[] t_out;
+        }
+        legacy_hits += *has_an_intersection;
+        delete[] has_an_intersection;
+        delete origin;
+        delete direction;
+    }
+    auto legacy_end = std::chrono::high_resolution_clock::now();
+    size_t legacy_allocations = benchmark_heap_allocations - legacy_start_count;
+
+    // After: the same work with vec3, which never touches the heap
+    int hits = 0;
+    size_t start_count = benchmark_heap_allocations;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_pixels; i++) {
+        ray primary_ray = generate_camera_ray(&cam, &dims, i % width, i / width);
+        bool has_an_intersection = false;
+        for (int j = 0; j < num_triangles; j++) {
+            has_an_intersection |= ray_triangle_intersection_moller_trumbore(&primary_ray, &triangles[j], j, INFINITY).has_collision;
+        }
+        hits += has_an_intersection;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    size_t allocations = benchmark_heap_allocations - start_count;
+
+    double legacy_ms = std::chrono::duration_cast<std::chrono::microseconds>(legacy_end - legacy_start).count() / 1000.0;
+    double ms = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+    printf("pixel allocation benchmark: %i triangles, %ix%i pixels\n", num_triangles, width, height);
+    printf("  pointer vector: %.1f allocations per pixel, %.3f ms, %i pixel(s) hit\n", (double) legacy_allocations / num_pixels, legacy_ms,
+           legacy_hits);
+    printf("  vec3: %.1f allocations per pixel, %.3f ms, %i pixel(s) hit\n", (double) allocations / num_pixels, ms, hits);
+    assert(allocations == 0);
+    assert(hits == legacy_hits);
+
+    for (int i = 0; i < num_triangles; i++) {
+        delete legacy_v0[i];
+        delete legacy_e1[i];
+        delete legacy_e2[i];
+    }
+    delete[] legacy_v0;
+    delete[] legacy_e1;
+    delete[] legacy_e2;
+    delete legacy_cam_origin;
+    delete[] triangles;
+}
+#endif
+
+
+// Möller–Trumbore straight from the three vertices of a triangle, for the layouts that store vertices instead of edges (the edges get worked out
+// on every test, which is part of what triangle records save)
+__device__ __host__ collision ray_triangle_intersection_vertices(ray* r, vec3 a, vec3 b, vec3 c, int index, real t_max) {
+    triangle_record tri;
+    tri.v0 = a;
+    tri.e1 = b.sub(a);
+    tri.e2 = c.sub(a);
+    return ray_triangle_intersection_moller_trumbore(r, &tri, index, t_max);
+}
+
+
+// Times how many triangles per second a closest-hit loop over every triangle gets through on the host with each of the layouts the triangles have
+// been stored in: a triangle** (every triangle its own allocation, like the old kernel read), a triangle_soa, and triangle records, for a scene of
+// the given number of random triangles. Every layout should find the same hits
+__host__ void benchmark_triangle_layouts(int num_triangles, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* records = make_benchmark_triangles(num_triangles, &random_state);
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+    material shared_material = material(color(255, 255, 255), 1, 0, 0);
+    triangle** pointer_triangles = new triangle*[num_triangles];
+    for (int i = 0; i < num_triangles; i++) {
+        pointer_triangles[i] = new triangle(&shared_material, records[i].v0, records[i].v0.add(records[i].e1), records[i].v0.add(records[i].e2));
+    }
+    triangle_soa* soa_triangles = triangle_soa_from_triangles(pointer_triangles, num_triangles);
+
+    int pointer_hits = 0;
+    auto pointer_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_rays; i++) {
+        real t_max = INFINITY;
+        for (int j = 0; j < num_triangles; j++) {
+            triangle* tri = pointer_triangles[j];
+            collision hit = ray_triangle_intersection_vertices(&rays[i], tri->a, tri->b, tri->c, j, t_max);
+            t_max = hit.has_collision ? hit.collision_distance : t_max;
+        }
+        pointer_hits += t_max != INFINITY;
+    }
+    auto pointer_end = std::chrono::high_resolution_clock::now();
+
+    int soa_hits = 0;
+    for (int i = 0; i < num_rays; i++) {
+        real t_max = INFINITY;
+        for (int j = 0; j < num_triangles; j++) {
+            collision hit = ray_triangle_intersection_vertices(&rays[i], soa_triangles->get_a(j), soa_triangles->get_b(j), soa_triangles->get_c(j), j,
+                                                               t_max);
+            t_max = hit.has_collision ? hit.collision_distance : t_max;
+        }
+        soa_hits += t_max != INFINITY;
+    }
+    auto soa_end = std::chrono::high_resolution_clock::now();
+
+    int record_hits = 0;
+    for (int i = 0; i < num_rays; i++) {
+        record_hits += brute_force_closest_hit(&rays[i], records, num_triangles, INFINITY).has_collision;
+    }
+    auto record_end = std::chrono::high_resolution_clock::now();
+
+    double num_tests = (double) num_triangles * num_rays;
+    double pointer_ms = std::chrono::duration_cast<std::chrono::microseconds>(pointer_end - pointer_start).count() / 1000.0;
+    double soa_ms = std::chrono::duration_cast<std::chrono::microseconds>(soa_end - pointer_end).count() / 1000.0;
+    double record_ms = std::chrono::duration_cast<std::chrono::microseconds>(record_end - soa_end).count() / 1000.0;
+    printf("triangle layout benchmark: %i triangles, %i rays\n", num_triangles, num_rays);
+    printf("  triangle**: %.1f M triangles/s, triangle_soa: %.1f M triangles/s, triangle records: %.1f M triangles/s, %i/%i/%i hits\n",
+           num_tests / pointer_ms / 1000.0, num_tests / soa_ms / 1000.0, num_tests / record_ms / 1000.0, pointer_hits, soa_hits, record_hits);
+    assert(pointer_hits == soa_hits && soa_hits == record_hits);
+
+    for (int i = 0; i < num_triangles; i++) {
+        delete pointer_triangles[i];
+    }
+    delete[] pointer_triangles;
+    destroy_triangle_soa(soa_triangles);
+    delete soa_triangles;
+    delete[] records;
+    delete[] rays;
+}
+
+
+// Renders a scene of the given number of random triangles with the Whitted shader on the host at the given resolution, and prints how many rays
+// per second it traced with whichever precision this was compiled with (see real). Since float and double can't both be compiled in at once, the
+// image is saved to image_path with "_float" or "_double" added, and if the other precision's image is already there (from an earlier run built
+// the other way), it prints the biggest difference between the two images in any pixel's color channel
+__host__ void benchmark_precision(int num_triangles, int width, int height, const char* image_path) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* records = make_benchmark_triangles(num_triangles, &random_state);
+    triangle_soa triangles = triangle_soa_from_records(records, num_triangles, 3);
+    triangles.materials[0] = material(color(255, 255, 255), 1, 0, 0);
+    triangles.materials[1] = material(color(255, 200, 200), 0.2, 0.8, 0);
+    triangles.materials[2] = material(color(200, 200, 255), 0.1, 0.1, 0.8);
+    for (int i = 0; i < num_triangles; i++) {
+        triangles.material_index[i] = i % 3;
+    }
+    int num_lights = 4;
+    light* lights = make_benchmark_lights(num_lights, &random_state);
+    camera cam = camera(vec3(0, 0, 0), vec3(0, 0, 0), (real) width);
+    dimensions dims = dimensions(width, height);
+    packed_scene* scene = pack_scene(&cam, &dims, lights, num_lights, &triangles, ACCELERATOR_BVH, nullptr);
+
+    // Saving the image as floats either way, so the two builds can read each other's images
+    int num_pixels = width * height;
+    float* image = new float[3 * num_pixels];
+    int rays_traced = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_pixels; i++) {
+        ray primary_ray = generate_camera_ray(&cam, &dims, i % width, i / width);
+        color c = trace_ray(scene, &primary_ray, WHITTED_MAX_BOUNCES, &rays_traced);
+        image[3 * i] = (float) c.r;
+        image[3 * i + 1] = (float) c.g;
+        image[3 * i + 2] = (float) c.b;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double ms = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+
+    const char* precision = sizeof(real) == sizeof(float) ? "float" : "double";
+    const char* other_precision = sizeof(real) == sizeof(float) ? "double" : "float";
+    printf("precision benchmark: %s, %i triangles, %ix%i pixels, %i bounce(s)\n", precision, num_triangles, width, height, WHITTED_MAX_BOUNCES);
+    printf("  %.3f ms, %.2f Mrays/s\n", ms, rays_traced / ms / 1000.0);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s_%s", image_path, precision);
+    FILE* file = fopen(path, "wb");
+    if (file != nullptr) {
+        fwrite(image, sizeof(float), 3 * num_pixels, file);
+        fclose(file);
+    }
+
+    snprintf(path, sizeof(path), "%s_%s", image_path, other_precision);
+    float* other_image = new float[3 * num_pixels];
+    file = fopen(path, "rb");
+    if (file != nullptr && fread(other_image, sizeof(float), 3 * num_pixels, file) == (size_t) (3 * num_pixels)) {
+        float max_difference = 0;
+        int num_different_pixels = 0;
+        for (int i = 0; i < num_pixels; i++) {
+            float pixel_difference = 0;
+            for (int channel = 0; channel < 3; channel++) {
+                float difference = fabsf(image[3 * i + channel] - other_image[3 * i + channel]);
+                pixel_difference = difference > pixel_difference ? difference : pixel_difference;
+            }
+            max_difference = pixel_difference > max_difference ? pixel_difference : max_difference;
+            num_different_pixels += pixel_difference > 1.0f / 255;
+        }
+        printf("  against %s: max difference %.6f, %i pixel(s) off by more than 1/255\n", other_precision, max_difference, num_different_pixels);
+    } else {
+        printf("  no %s image at %s to compare against yet (build with%s -DUSE_FLOAT_PRECISION and run again)\n", other_precision, path,
+               sizeof(real) == sizeof(float) ? "out" : "");
+    }
+    if (file != nullptr) {
+        fclose(file);
+    }
+
+    delete[] image;
+    delete[] other_image;
+    delete[] (char*) scene;
+    delete[] lights;
+    delete[] records;
+    destroy_triangle_soa(&triangles);
+}
@@ -0,0 +1,257 @@
+// This file has the frame pipeline, which lets uploading, rendering, and reading back of different frames happen at the same time on the GPU
+// Before, every frame did its upload, then its kernel, then its readback, one after the other on the default stream, with the CPU waiting for
+// each step to finish. Here each step gets its own stream instead, and each frame in flight gets its own "slot" (its own copy of the scene and
+// the image on the GPU), so while frame N is rendering, frame N + 1 can already be uploading and frame N - 1 can already be reading back
+// Each slot has its own memory arena (see memory_arena.cpp): its scene sits in the arena's scene region and is only re-uploaded where it changed
+// (see upload_scene_delta()), and its image is made fresh out of the arena's frame region, which is reset at the start of every frame the slot runs
+// Copies between the CPU and GPU can only run asynchronously (without blocking the CPU) if the CPU side is pinned memory (memory that the OS is
+// never allowed to move around), so every slot also has its own pinned staging buffers on the CPU side
+
+#define PIPELINE_DEPTH 3                // How many frames can be in flight at once (one uploading, one rendering, one reading back)
+
+// The function that actually draws a frame -- it should only launch work on the given stream and not wait for it
+typedef void (*render_function)(framebuffer img_out, packed_scene* scene, hipStream_t stream);
+
+// Everything that belongs to one frame in flight
+struct pipeline_slot {
+    memory_arena arena;                 // This slot's GPU memory: the scene in the scene region, and the image in the frame region
+    unsigned char* scene_staging;       // Pinned CPU copy of the scene this slot last uploaded
+    size_t staging_capacity;            // How big a scene scene_staging (and the arena's scene region) has room for
+    size_t staged_size;                 // The size of the scene in scene_staging (0 if nothing has been uploaded from this slot yet)
+    packed_scene* gpu_scene;
+    framebuffer gpu_image;              // Made out of the arena's frame region every frame (see pipeline_submit_frame())
+    framebuffer cpu_image;              // Same layout as gpu_image, but its data is pinned CPU memory that the image gets read back into
+    int frame_number;                   // The frame currently using this slot, or -1 if the slot is free
+
+    // Events marking the start and end of each stage, used both to make the streams wait on each other and for timing
+    hipEvent_t upload_start;
+    hipEvent_t upload_done;
+    hipEvent_t render_start;
+    hipEvent_t render_done;
+    hipEvent_t readback_start;
+    hipEvent_t readback_done;
+};
+
+struct frame_pipeline {
+    hipStream_t upload_stream;
+    hipStream_t render_stream;
+    hipStream_t readback_stream;
+    pipeline_slot slots[PIPELINE_DEPTH];
+
+    framebuffer image_layout;           // The layout of the images the slots make
+    int row_alignment;                  // What the rows of those images are lined up to (see framebuffer_layout())
+    int frames_submitted;
+    int frames_finished;
+    int uploads_skipped;                // Frames whose scene was identical to what their slot already had, so nothing needed to be uploaded
+    scene_upload_stats upload_stats;    // How much actually got sent over for those frames, full uploads and changed chunks together
+
+    // Total time spent in each stage over every finished frame, plus the wall-clock time from the first submit to the last finish -- if the
+    // stages overlap, the wall-clock time ends up smaller than the sum of the stages
+    float upload_ms;
+    float render_ms;
+    float readback_ms;
+    std::chrono::high_resolution_clock::time_point first_submit;
+    std::chrono::high_resolution_clock::time_point last_finish;
+};
+
+
+// Clears the stage totals, so that the next print_pipeline_timings() only covers frames finished after this
+__host__ void reset_pipeline_timings(frame_pipeline* pipeline) {
+    pipeline->frames_finished = 0;
+    pipeline->uploads_skipped = 0;
+    pipeline->upload_stats.bytes = 0;
+    pipeline->upload_stats.allocation_calls = 0;
+    pipeline->upload_stats.copy_calls = 0;
+    pipeline->upload_ms = 0;
+    pipeline->render_ms = 0;
+    pipeline->readback_ms = 0;
+    pipeline->first_submit = std::chrono::high_resolution_clock::now();
+    pipeline->last_finish = pipeline->first_submit;
+}
+
+
+// Makes sure the given slot has room for a scene of the given size, growing its arena and staging buffer if it doesn't (which throws away the
+// scene it had, so the next upload to it is a full one). The slot must not be in use by a frame
+__host__ void reserve_pipeline_slot(frame_pipeline* pipeline, pipeline_slot* slot, size_t scene_size) {
+    size_t image_capacity = pipeline->image_layout.size_in_bytes() + 256;                // + 256 for alignment
+    if (scene_size <= slot->staging_capacity && slot->arena.memory != nullptr) {
+        return;
+    }
+    reserve_arena(&slot->arena, MEMORY_TARGET_GPU, scene_size + 256, image_capacity);
+    if (slot->scene_staging != nullptr) {
+        hipHostFree(slot->scene_staging);
+    }
+    hipHostMalloc(&slot->scene_staging, scene_size, hipHostMallocDefault);
+    slot->staging_capacity = scene_size;
+    slot->staged_size = 0;
+    slot->gpu_scene = nullptr;
+}
+
+
+// Sets up a pipeline with room for scenes up to initial_scene_size bytes (bigger scenes make their slots grow when they get submitted) and images
+// of the given size and format
+__host__ void create_frame_pipeline(frame_pipeline* pipeline, size_t initial_scene_size, int width, int height, framebuffer_format format,
+                                    int row_alignment) {
+    pipeline->image_layout = framebuffer_layout(width, height, format, row_alignment);
+    pipeline->row_alignment = row_alignment;
+    hipStreamCreate(&pipeline->upload_stream);
+    hipStreamCreate(&pipeline->render_stream);
+    hipStreamCreate(&pipeline->readback_stream);
+
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        pipeline_slot* slot = &pipeline->slots[i];
+        slot->arena.memory = nullptr;
+        slot->scene_staging = nullptr;
+        slot->staging_capacity = 0;
+        reserve_pipeline_slot(pipeline, slot, initial_scene_size);
+
+        slot->cpu_image = pipeline->image_layout;
+        hipHostMalloc(&slot->cpu_image.data, pipeline->image_layout.size_in_bytes(), hipHostMallocDefault);
+        slot->frame_number = -1;
+
+        hipEventCreate(&slot->upload_start);
+        hipEventCreate(&slot->upload_done);
+        hipEventCreate(&slot->render_start);
+        hipEventCreate(&slot->render_done);
+        hipEventCreate(&slot->readback_start);
+        hipEventCreate(&slot->readback_done);
+    }
+
+    pipeline->frames_submitted = 0;
+    reset_pipeline_timings(pipeline);
+}
+
+
+__host__ void destroy_frame_pipeline(frame_pipeline* pipeline) {
+    hipDeviceSynchronize();
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        pipeline_slot* slot = &pipeline->slots[i];
+        hipHostFree(slot->scene_staging);
+        hipHostFree(slot->cpu_image.data);
+        hipEventDestroy(slot->upload_start);
+        hipEventDestroy(slot->upload_done);
+        hipEventDestroy(slot->render_start);
+        hipEventDestroy(slot->render_done);
+        hipEventDestroy(slot->readback_start);
+        hipEventDestroy(slot->readback_done);
+        destroy_arena(&slot->arena);
+    }
+    hipStreamDestroy(pipeline->upload_stream);
+    hipStreamDestroy(pipeline->render_stream);
+    hipStreamDestroy(pipeline->readback_stream);
+}
+
+
+// Returns true if the pipeline makes images with the given layout (scenes of any size fit, since slots grow to fit them)
+__host__ bool pipeline_fits(frame_pipeline* pipeline, framebuffer image_layout) {
+    return image_layout.format == pipeline->image_layout.format &&
+           image_layout.width == pipeline->image_layout.width && image_layout.height == pipeline->image_layout.height &&
+           image_layout.pitch == pipeline->image_layout.pitch;
+}
+
+
+// Waits for the given frame to finish reading back, then adds its stage times to the pipeline's totals and returns its image
+// The returned image lives in the slot's pinned memory, so it is only valid until PIPELINE_DEPTH more frames have been submitted
+__host__ framebuffer* pipeline_finish_frame(frame_pipeline* pipeline, int frame_number) {
+    pipeline_slot* slot = &pipeline->slots[frame_number % PIPELINE_DEPTH];
+    if (slot->frame_number != frame_number) {
+        return nullptr;                                                                 // Either already finished or never submitted
+    }
+
+    hipEventSynchronize(slot->readback_done);
+    pipeline->last_finish = std::chrono::high_resolution_clock::now();
+
+    float upload = 0;
+    float render = 0;
+    float readback = 0;
+    hipEventElapsedTime(&upload, slot->upload_start, slot->upload_done);
+    hipEventElapsedTime(&render, slot->render_start, slot->render_done);
+    hipEventElapsedTime(&readback, slot->readback_start, slot->readback_done);
+    pipeline->upload_ms += upload;
+    pipeline->render_ms += render;
+    pipeline->readback_ms += readback;
+
+    slot->frame_number = -1;
+    pipeline->frames_finished++;
+    return &slot->cpu_image;
+}
+
+
+// Queues up a frame: uploads the scene (only the parts that are different from what this slot already has), renders it, and reads the image back,
+// each on its own stream, without waiting for any of it to finish. Returns the frame's number, to pass to pipeline_finish_frame() later
+// If the slot this frame needs is still busy with an older frame, that older frame is finished first (so its image is lost if nobody took it)
+__host__ int pipeline_submit_frame(frame_pipeline* pipeline, packed_scene* cpu_scene, render_function render) {
+    int frame_number = pipeline->frames_submitted;
+    pipeline_slot* slot = &pipeline->slots[frame_number % PIPELINE_DEPTH];
+    if (slot->frame_number != -1) {
+        pipeline_finish_frame(pipeline, slot->frame_number);
+    }
+    slot->frame_number = frame_number;
+
+    // Upload stage -- the staging buffer and arena are only touched after the slot's last readback finished (above), which also means its last
+    // upload and render did. A scene of a new size goes over whole (into a fresh spot in the scene region), and otherwise only its changes do.
+    // Either way the copies go from the pinned staging buffer on the upload stream, so they run between this stage's two events
+    size_t size = cpu_scene->total_size;
+    reserve_pipeline_slot(pipeline, slot, size);
+    hipEventRecord(slot->upload_start, pipeline->upload_stream);
+    if (size != slot->staged_size) {
+        reset_region(&slot->arena.scene);
+        slot->gpu_scene = upload_scene_async(cpu_scene, slot->scene_staging, &slot->arena, pipeline->upload_stream, &pipeline->upload_stats);
+        slot->staged_size = size;
+    } else if (upload_scene_delta(cpu_scene, slot->scene_staging, slot->gpu_scene, &slot->arena, pipeline->upload_stream,
+                                  &pipeline->upload_stats) == 0) {
+        pipeline->uploads_skipped++;
+    }
+    hipEventRecord(slot->upload_done, pipeline->upload_stream);
+
+    // Render stage, which can't start until this frame's upload is done. The image is made fresh out of the frame region, which only ever holds
+    // this frame's memory
+    reset_region(&slot->arena.frame);
+    slot->gpu_image = create_framebuffer(pipeline->image_layout.width, pipeline->image_layout.height, pipeline->image_layout.format,
+                                         pipeline->row_alignment, &slot->arena);
+    hipStreamWaitEvent(pipeline->render_stream, slot->upload_done, 0);
+    hipEventRecord(slot->render_start, pipeline->render_stream);
+    clear_framebuffer(&slot->gpu_image, &slot->arena, pipeline->render_stream);
+    render(slot->gpu_image, slot->gpu_scene, pipeline->render_stream);
+    hipEventRecord(slot->render_done, pipeline->render_stream);
+
+    // Readback stage, which can't start until this frame's render is done
+    hipStreamWaitEvent(pipeline->readback_stream, slot->render_done, 0);
+    hipEventRecord(slot->readback_start, pipeline->readback_stream);
+    framebuffer_to_cpu(&slot->gpu_image, &slot->cpu_image, &slot->arena, pipeline->readback_stream);
+    hipEventRecord(slot->readback_done, pipeline->readback_stream);
+
+    pipeline->frames_submitted++;
+    return frame_number;
+}
+
+
+// Prints the average time of each stage per frame, and how much of that time was hidden by the stages overlapping each other
+__host__ void print_pipeline_timings(frame_pipeline* pipeline) {
+    int frames = pipeline->frames_finished;
+    if (frames == 0) {
+        return;
+    }
+    float wall_ms = std::chrono::duration_cast<std::chrono::microseconds>(pipeline->last_finish - pipeline->first_submit).count() / 1000.0f;
+    float stage_ms = pipeline->upload_ms + pipeline->render_ms + pipeline->readback_ms;
+    float overlap = stage_ms > 0 ? 100.0f * (1 - wall_ms / stage_ms) : 0;
+    if (overlap < 0) {
+        overlap = 0;                                                                    // The CPU side (packing, launching) can make the wall-clock
+                                                                                        // time longer than the stages themselves
+    }
+
+    printf("frame pipeline: %i frame(s), %i upload(s) skipped\n", frames, pipeline->uploads_skipped);
+    printf("  per frame: upload %.3f ms, render %.3f ms, readback %.3f ms\n",
+           pipeline->upload_ms / frames, pipeline->render_ms / frames, pipeline->readback_ms / frames);
+    printf("  total: %.3f ms of stages in %.3f ms of wall-clock time (%.1f%% overlapped)\n", stage_ms, wall_ms, overlap);
+    print_upload_stats(&pipeline->upload_stats);
+}
+
+
+// Prints the memory use of every slot's arena
+__host__ void print_pipeline_arena_stats(frame_pipeline* pipeline) {
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        printf("slot %i ", i);
+        print_arena_stats(&pipeline->slots[i].arena);
+    }
+}
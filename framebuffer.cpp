@@ -0,0 +1,102 @@
+// This file has the framebuffer, which is the output image that the kernels draw into
+// The whole image is one flat block of memory (row after row of pixels), so it can be cleared with a single memset and copied back to the CPU with
+// a single copy -- instead of one GPU allocation per pixel like with an array of color pointers, which took four copies per pixel to read back
+
+// The ways a framebuffer can store its pixels
+enum framebuffer_format {
+    FRAMEBUFFER_RGB_FLOAT,              // Three floats per pixel (r, g, b), linear and unclamped
+    FRAMEBUFFER_RGBA8                   // Four bytes per pixel (r, g, b, a), clamped to 0-1 and scaled to 0-255
+};
+
+struct framebuffer {
+    framebuffer_format format;
+    int width;
+    int height;
+    size_t pitch;                       // The number of bytes from the start of one row to the start of the next -- at least width times the size of
+                                        // a pixel, but can be more if rows are padded out to line up with a certain alignment
+    unsigned char* data;                // The pixels themselves, either in GPU memory or CPU memory depending on where this framebuffer came from
+
+    __device__ __host__ framebuffer() : format(FRAMEBUFFER_RGB_FLOAT), width(0), height(0), pitch(0), data(nullptr) {}
+
+    __device__ __host__ int bytes_per_pixel() {
+        if (format == FRAMEBUFFER_RGB_FLOAT) {
+            return 3 * sizeof(float);
+        }
+        return 4;
+    }
+
+    // The total number of bytes the pixels take up, padding included
+    __device__ __host__ size_t size_in_bytes() {
+        return pitch * height;
+    }
+
+    // Returns the address of the first byte of the pixel at (x, y)
+    __device__ __host__ unsigned char* pixel_address(int x, int y) {
+        return data + (size_t) y * pitch + (size_t) x * bytes_per_pixel();
+    }
+
+    __device__ __host__ void set_pixel(int x, int y, color c) {
+        unsigned char* pixel = pixel_address(x, y);
+        if (format == FRAMEBUFFER_RGB_FLOAT) {
+            float* channels = (float*) pixel;
+            channels[0] = (float) c.r;
+            channels[1] = (float) c.g;
+            channels[2] = (float) c.b;
+        } else {
+            pixel[0] = to_byte(c.r);
+            pixel[1] = to_byte(c.g);
+            pixel[2] = to_byte(c.b);
+            pixel[3] = 255;
+        }
+    }
+
+    __device__ __host__ color get_pixel(int x, int y) {
+        unsigned char* pixel = pixel_address(x, y);
+        if (format == FRAMEBUFFER_RGB_FLOAT) {
+            float* channels = (float*) pixel;
+            return color(channels[0], channels[1], channels[2]);
+        }
+        return color(pixel[0] / (real) 255, pixel[1] / (real) 255, pixel[2] / (real) 255);
+    }
+
+    // Clamps a color value to 0-1 and converts it to 0-255, adding 0.5 to round to the nearest integer
+    __device__ __host__ static unsigned char to_byte(real value) {
+        real clamped = fmin(fmax(value, (real) 0), (real) 1);
+        return (unsigned char) (clamped * 255 + 0.5);
+    }
+};
+
+
+// Works out the layout (format, size, and pitch) of a framebuffer without giving it any memory yet, so that we know how much memory it will need
+// row_alignment is the number of bytes that the start of every row should be lined up to (pass 1 for no padding at all)
+__host__ framebuffer framebuffer_layout(int width, int height, framebuffer_format format, int row_alignment) {
+    framebuffer result;
+    result.format = format;
+    result.width = width;
+    result.height = height;
+
+    size_t row_size = (size_t) width * result.bytes_per_pixel();
+    result.pitch = ((row_size + row_alignment - 1) / row_alignment) * row_alignment;
+    return result;
+}
+
+
+// Makes a new framebuffer out of the given arena's frame region, so it is thrown away automatically when the next frame starts
+__host__ framebuffer create_framebuffer(int width, int height, framebuffer_format format, int row_alignment, memory_arena* arena) {
+    framebuffer result = framebuffer_layout(width, height, format, row_alignment);
+    result.data = (unsigned char*) arena_allocate(&arena->frame, result.size_in_bytes(), 256);
+    return result;
+}
+
+
+// Sets every pixel (and all of the padding) to 0, which is black for both formats, with one memset queued on the given stream
+__host__ void clear_framebuffer(framebuffer* arena_framebuffer, memory_arena* arena, hipStream_t stream) {
+    arena_memset_async(arena, arena_framebuffer->data, 0, arena_framebuffer->size_in_bytes(), stream);
+}
+
+
+// Copies a framebuffer out of arena memory into cpu_framebuffer (which must have the same layout) in a single copy queued on the given stream
+// cpu_framebuffer's data should be pinned memory for the copy to actually run asynchronously
+__host__ void framebuffer_to_cpu(framebuffer* arena_framebuffer, framebuffer* cpu_framebuffer, memory_arena* arena, hipStream_t stream) {
+    arena_copy_to_cpu_async(arena, cpu_framebuffer->data, arena_framebuffer->data, arena_framebuffer->size_in_bytes(), stream);
+}
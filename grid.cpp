@@ -0,0 +1,504 @@
+// This file has the grid accelerator, another way (besides the BVH) of only testing rays against the triangles they could actually hit
+// The scene's box is cut into a regular 3D grid of equally sized cells, and every cell keeps a list of the triangles that overlap it. A ray then
+// steps through the cells it passes through, in order, with 3D-DDA (a 3D version of the line-drawing algorithm: each step moves into whichever
+// neighboring cell the ray reaches first), only testing the triangles in those cells, and stops as soon as it has a hit inside the cell it is in
+// Building a grid is just two passes over the triangles (count how many go in each cell, then fill the cells in), which is much faster than
+// building a BVH, and in a scene where the triangles are spread out about evenly it traces about as fast as one. But in a scene where the triangles
+// are bunched up, most of the grid is empty cells (that still cost a step each) while a few cells hold huge lists
+// The optional second level helps with that: any cell holding more than GRID_DENSE_CELL_SIZE triangles gets its own smaller grid inside of it
+// (as long as its triangles are small enough compared to the cell to actually get split up by one), and rays walk that inner grid when they step
+// into the cell
+
+#define GRID_CELLS_PER_TRIANGLE 2       // How many cells a grid aims to have per triangle it holds (more cells means shorter lists but more steps)
+#define GRID_MAX_RESOLUTION 256         // The most cells along any one axis of the top level of a grid
+#define GRID_MAX_SUBGRID_RESOLUTION 16  // The most cells along any one axis of a second-level grid
+#define GRID_DENSE_CELL_SIZE 16         // Cells holding more triangles than this get a second-level grid (if the grid has two levels)
+
+// Which structure a scene is traced with, picked when the scene is packed (see pack_scene()) and checked by the kernel every frame
+enum accelerator_type {
+    ACCELERATOR_BRUTE_FORCE,            // Tests every ray against every triangle (only worth it for a handful of triangles)
+    ACCELERATOR_BVH,                    // The binned SAH BVH (or the wide BVH, if compiled with -DUSE_WIDE_BVH)
+    ACCELERATOR_GRID,
+    ACCELERATOR_TWO_LEVEL_GRID,
+    ACCELERATOR_SBVH                    // The spatial split BVH (see sbvh.cpp), traced exactly like ACCELERATOR_BVH
+};
+
+// One uniform grid: either the top level of a grid accelerator, or a second-level grid inside one dense cell of the top level
+struct grid_level {
+    bounding_box bounds;
+    int resolution[3];                  // How many cells the grid has along x, y, and z
+    vec3 cell_size;
+    int first_cell;                     // Where this grid's cells start in the accelerator's cell array (stored x first, then y, then z)
+};
+
+struct grid_cell {
+    int first_reference;                // Where this cell's triangle indices start in the accelerator's reference array
+    int num_references;
+    int child_level;                    // The index of the second-level grid this cell was split into (in which case it has no references of its
+                                        // own), or -1
+};
+
+// A whole grid accelerator, with every level's cells in one array and every cell's triangle indices in another
+// A triangle that overlaps several cells is listed in all of them, so there are usually more references than triangles
+struct grid_accelerator {
+    grid_level* levels;                 // levels[0] is the top level
+    int num_levels;
+    grid_cell* cells;
+    int num_cells;
+    int* references;
+    int num_references;
+};
+
+// The state of a ray stepping through the cells of one grid level with 3D-DDA
+struct grid_dda {
+    int cell[3];                        // The cell the ray is in
+    int step[3];                        // Which way the ray moves through the cells along each axis (1, -1, or 0)
+    int resolution[3];
+    real t_next[3];                     // The t-value where the ray crosses into the next cell along each axis
+    real t_delta[3];                    // How much t goes up by to cross one whole cell along each axis
+
+    // Starts the walk at the cell holding the point the ray is at when t is t_start (which should be inside the grid, or right on its edge)
+    __device__ __host__ void start(grid_level* level, vec3 origin, vec3 direction, real t_start) {
+        for (int axis = 0; axis < 3; axis++) {
+            real o = origin.component(axis);
+            real d = direction.component(axis);
+            real low = level->bounds.min.component(axis);
+            real size = level->cell_size.component(axis);
+            resolution[axis] = level->resolution[axis];
+
+            int c = (int) floor((o + d * t_start - low) / size);
+            c = c < 0 ? 0 : (c >= resolution[axis] ? resolution[axis] - 1 : c);    // Rounding can put a point on the edge just outside
+            cell[axis] = c;
+
+            if (d > 0) {
+                step[axis] = 1;
+                t_next[axis] = (low + (c + 1) * size - o) / d;
+                t_delta[axis] = size / d;
+            } else if (d < 0) {
+                step[axis] = -1;
+                t_next[axis] = (low + c * size - o) / d;
+                t_delta[axis] = -size / d;
+            } else {
+                step[axis] = 0;
+                t_next[axis] = INFINITY;
+                t_delta[axis] = INFINITY;
+            }
+        }
+    }
+
+    // The t-value where the ray leaves the cell it is in
+    __device__ __host__ real t_exit() const {
+        return fmin(t_next[0], fmin(t_next[1], t_next[2]));
+    }
+
+    // Moves into the next cell along the ray, returning false if that would leave the grid
+    __device__ __host__ bool advance() {
+        int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= resolution[axis]) {
+            return false;
+        }
+        t_next[axis] += t_delta[axis];
+        return true;
+    }
+
+    __device__ __host__ int cell_index() const {
+        return cell[0] + resolution[0] * (cell[1] + resolution[1] * cell[2]);
+    }
+};
+
+
+// Picks how many cells a grid over the given box should have along each axis to hold the given number of triangles, aiming for
+// GRID_CELLS_PER_TRIANGLE cells per triangle with cells as close to cubes as possible
+__host__ void grid_resolution(bounding_box bounds, int num_triangles, int max_resolution, int* resolution) {
+    vec3 extent = bounds.extent();
+    real volume = extent.x * extent.y * extent.z;
+    real cells_per_unit = volume > 0 ? cbrt(GRID_CELLS_PER_TRIANGLE * num_triangles / volume) : 0;
+    for (int axis = 0; axis < 3; axis++) {
+        int r = (int) (extent.component(axis) * cells_per_unit);
+        resolution[axis] = r < 1 ? 1 : (r > max_resolution ? max_resolution : r);
+    }
+}
+
+
+// Returns a grid level with the given resolution over the given box (with first_cell left for the caller to fill in)
+__host__ grid_level make_grid_level(bounding_box bounds, int* resolution) {
+    grid_level level;
+    level.bounds = bounds;
+    vec3 extent = bounds.extent();
+    for (int axis = 0; axis < 3; axis++) {
+        level.resolution[axis] = resolution[axis];
+    }
+    level.cell_size = vec3(extent.x / resolution[0], extent.y / resolution[1], extent.z / resolution[2]);
+    level.first_cell = 0;
+    return level;
+}
+
+
+// Finds the range of cells (first and last along each axis, both included) that the given box overlaps in the given grid level
+// Triangles are placed by their boxes rather than their exact shapes, which can put a long diagonal triangle in a few cells it doesn't actually
+// touch -- that only costs some extra tests, never a missed hit
+__host__ void grid_cell_range(grid_level* level, bounding_box box, int* first, int* last) {
+    for (int axis = 0; axis < 3; axis++) {
+        real low = level->bounds.min.component(axis);
+        real size = level->cell_size.component(axis);
+        int max_cell = level->resolution[axis] - 1;
+        int a = (int) floor((box.min.component(axis) - low) / size);
+        int b = (int) floor((box.max.component(axis) - low) / size);
+        first[axis] = a < 0 ? 0 : (a > max_cell ? max_cell : a);
+        last[axis] = b < 0 ? 0 : (b > max_cell ? max_cell : b);
+    }
+}
+
+
+// Sorts the given triangles into the cells of the given grid level, with one pass to count how many triangles land in each cell and a second to
+// write them in. Fills in counts and starts (one per cell) and returns a new array with every cell's triangle indices one after another
+__host__ int* fill_grid_level(grid_level* level, bounding_box* triangle_boxes, int* triangle_indices, int num_triangles, int* counts, int* starts,
+                              int* num_references) {
+    int num_cells = level->resolution[0] * level->resolution[1] * level->resolution[2];
+    memset(counts, 0, sizeof(int) * num_cells);
+    int first[3];
+    int last[3];
+    for (int i = 0; i < num_triangles; i++) {
+        grid_cell_range(level, triangle_boxes[triangle_indices[i]], first, last);
+        for (int z = first[2]; z <= last[2]; z++) {
+            for (int y = first[1]; y <= last[1]; y++) {
+                for (int x = first[0]; x <= last[0]; x++) {
+                    counts[x + level->resolution[0] * (y + level->resolution[1] * z)]++;
+                }
+            }
+        }
+    }
+
+    int total = 0;
+    for (int i = 0; i < num_cells; i++) {
+        starts[i] = total;
+        total += counts[i];
+    }
+
+    int* references = new int[total];
+    int* next = new int[num_cells];
+    memcpy(next, starts, sizeof(int) * num_cells);
+    for (int i = 0; i < num_triangles; i++) {
+        grid_cell_range(level, triangle_boxes[triangle_indices[i]], first, last);
+        for (int z = first[2]; z <= last[2]; z++) {
+            for (int y = first[1]; y <= last[1]; y++) {
+                for (int x = first[0]; x <= last[0]; x++) {
+                    references[next[x + level->resolution[0] * (y + level->resolution[1] * z)]++] = triangle_indices[i];
+                }
+            }
+        }
+    }
+    delete[] next;
+    *num_references = total;
+    return references;
+}
+
+
+// Builds a grid accelerator over the given triangles, with a second level inside every dense cell if two_level is true
+// Unlike the BVH builders, this doesn't rearrange the triangles, so triangle indices in hits are indices into the given array
+__host__ grid_accelerator build_grid(triangle_record* triangles, int num_triangles, bool two_level) {
+    grid_accelerator result;
+    result.levels = nullptr;
+    result.num_levels = 0;
+    result.cells = nullptr;
+    result.num_cells = 0;
+    result.references = nullptr;
+    result.num_references = 0;
+    if (num_triangles == 0) {
+        return result;
+    }
+
+    bounding_box* boxes = new bounding_box[num_triangles];
+    int* all_triangles = new int[num_triangles];
+    bounding_box bounds;
+    for (int i = 0; i < num_triangles; i++) {
+        boxes[i] = triangle_bounds(&triangles[i]);
+        bounds.grow(boxes[i]);
+        all_triangles[i] = i;
+    }
+
+    // Padding the box a little on every side, so that a flat scene still gives cells some thickness and nothing sits exactly on the far edge
+    vec3 extent = bounds.extent();
+    real padding = fmax(extent.x, fmax(extent.y, extent.z)) * (real) 1e-4 + (real) 1e-6;
+    bounds = bounding_box(bounds.min.sub(vec3(padding, padding, padding)), bounds.max.add(vec3(padding, padding, padding)));
+
+    int resolution[3];
+    grid_resolution(bounds, num_triangles, GRID_MAX_RESOLUTION, resolution);
+    grid_level top = make_grid_level(bounds, resolution);
+    int num_top_cells = resolution[0] * resolution[1] * resolution[2];
+    int* top_counts = new int[num_top_cells];
+    int* top_starts = new int[num_top_cells];
+    int num_top_references;
+    int* top_references = fill_grid_level(&top, boxes, all_triangles, num_triangles, top_counts, top_starts, &num_top_references);
+
+    // Working out which dense cells are worth a second-level grid, and how fine it should be
+    // A triangle that covers most of the cell would end up in nearly every inner cell, so each axis gets no more inner cells than fit across
+    // the average size of the cell's triangles (clipped to the cell) -- and a cell whose triangles all cover it doesn't get split at all
+    int* cell_subgrid = new int[num_top_cells];
+    int* sub_resolutions = new int[3 * num_top_cells];
+    int num_subgrids = 0;
+    for (int i = 0; i < num_top_cells; i++) {
+        cell_subgrid[i] = -1;
+        if (!two_level || top_counts[i] <= GRID_DENSE_CELL_SIZE) {
+            continue;
+        }
+
+        int x = i % resolution[0];
+        int y = (i / resolution[0]) % resolution[1];
+        int z = i / (resolution[0] * resolution[1]);
+        vec3 cell_min = bounds.min.add(vec3(x * top.cell_size.x, y * top.cell_size.y, z * top.cell_size.z));
+        bounding_box cell_bounds = bounding_box(cell_min, cell_min.add(top.cell_size));
+        vec3 clipped_extent_sum = vec3(0, 0, 0);
+        for (int j = top_starts[i]; j < top_starts[i] + top_counts[i]; j++) {
+            bounding_box box = boxes[top_references[j]];
+            vec3 low = vec3(fmax(box.min.x, cell_bounds.min.x), fmax(box.min.y, cell_bounds.min.y), fmax(box.min.z, cell_bounds.min.z));
+            vec3 high = vec3(fmin(box.max.x, cell_bounds.max.x), fmin(box.max.y, cell_bounds.max.y), fmin(box.max.z, cell_bounds.max.z));
+            clipped_extent_sum = clipped_extent_sum.add(high.sub(low));
+        }
+
+        int* sub_resolution = &sub_resolutions[3 * i];
+        grid_resolution(cell_bounds, top_counts[i], GRID_MAX_SUBGRID_RESOLUTION, sub_resolution);
+        for (int axis = 0; axis < 3; axis++) {
+            real average_extent = clipped_extent_sum.component(axis) / top_counts[i];
+            if (average_extent > 0) {
+                int fit = (int) (top.cell_size.component(axis) / average_extent);
+                sub_resolution[axis] = fit < 1 ? 1 : (fit < sub_resolution[axis] ? fit : sub_resolution[axis]);
+            }
+        }
+        if (sub_resolution[0] * sub_resolution[1] * sub_resolution[2] > 1) {
+            cell_subgrid[i] = num_subgrids++;
+        }
+    }
+
+    // Building the second-level grids, each with its own arrays for now
+    grid_level* subgrids = new grid_level[num_subgrids];
+    int** subgrid_counts = new int*[num_subgrids];
+    int** subgrid_starts = new int*[num_subgrids];
+    int** subgrid_references = new int*[num_subgrids];
+    int* subgrid_num_references = new int[num_subgrids];
+    int num_cells = num_top_cells;
+    int num_references = 0;
+    for (int i = 0; i < num_top_cells; i++) {
+        int s = cell_subgrid[i];
+        if (s == -1) {
+            num_references += top_counts[i];
+            continue;
+        }
+
+        int x = i % resolution[0];
+        int y = (i / resolution[0]) % resolution[1];
+        int z = i / (resolution[0] * resolution[1]);
+        vec3 cell_min = bounds.min.add(vec3(x * top.cell_size.x, y * top.cell_size.y, z * top.cell_size.z));
+        int* sub_resolution = &sub_resolutions[3 * i];
+        subgrids[s] = make_grid_level(bounding_box(cell_min, cell_min.add(top.cell_size)), sub_resolution);
+        subgrids[s].first_cell = num_cells;
+        int num_sub_cells = sub_resolution[0] * sub_resolution[1] * sub_resolution[2];
+        subgrid_counts[s] = new int[num_sub_cells];
+        subgrid_starts[s] = new int[num_sub_cells];
+        subgrid_references[s] = fill_grid_level(&subgrids[s], boxes, top_references + top_starts[i], top_counts[i], subgrid_counts[s],
+                                                subgrid_starts[s], &subgrid_num_references[s]);
+        num_cells += num_sub_cells;
+        num_references += subgrid_num_references[s];
+    }
+
+    // Putting everything into the final arrays: the top level's cells first, then each second-level grid's cells in order
+    result.num_levels = 1 + num_subgrids;
+    result.levels = new grid_level[result.num_levels];
+    result.levels[0] = top;
+    result.num_cells = num_cells;
+    result.cells = new grid_cell[num_cells];
+    result.num_references = num_references;
+    result.references = new int[num_references];
+    int next_reference = 0;
+    for (int i = 0; i < num_top_cells; i++) {
+        grid_cell* cell = &result.cells[i];
+        cell->first_reference = next_reference;
+        cell->child_level = cell_subgrid[i] == -1 ? -1 : 1 + cell_subgrid[i];
+        cell->num_references = cell_subgrid[i] == -1 ? top_counts[i] : 0;
+        memcpy(result.references + next_reference, top_references + top_starts[i], sizeof(int) * cell->num_references);
+        next_reference += cell->num_references;
+    }
+    for (int s = 0; s < num_subgrids; s++) {
+        result.levels[1 + s] = subgrids[s];
+        int num_sub_cells = subgrids[s].resolution[0] * subgrids[s].resolution[1] * subgrids[s].resolution[2];
+        for (int i = 0; i < num_sub_cells; i++) {
+            grid_cell* cell = &result.cells[subgrids[s].first_cell + i];
+            cell->first_reference = next_reference;
+            cell->num_references = subgrid_counts[s][i];
+            cell->child_level = -1;
+            memcpy(result.references + next_reference, subgrid_references[s] + subgrid_starts[s][i], sizeof(int) * cell->num_references);
+            next_reference += cell->num_references;
+        }
+        delete[] subgrid_counts[s];
+        delete[] subgrid_starts[s];
+        delete[] subgrid_references[s];
+    }
+
+    delete[] boxes;
+    delete[] all_triangles;
+    delete[] top_counts;
+    delete[] top_starts;
+    delete[] top_references;
+    delete[] subgrids;
+    delete[] subgrid_counts;
+    delete[] subgrid_starts;
+    delete[] subgrid_references;
+    delete[] subgrid_num_references;
+    delete[] cell_subgrid;
+    delete[] sub_resolutions;
+    return result;
+}
+
+
+__host__ void destroy_grid(grid_accelerator* grid) {
+    delete[] grid->levels;
+    delete[] grid->cells;
+    delete[] grid->references;
+    grid->levels = nullptr;
+    grid->cells = nullptr;
+    grid->references = nullptr;
+}
+
+
+// Tests the ray against every triangle listed in the given cell, keeping the closest hit so far in closest (and shrinking t_max to match)
+__device__ __host__ void grid_test_cell(ray* r, grid_cell* cell, int* references, triangle_record* triangles, collision* closest, real* t_max) {
+    for (int i = cell->first_reference; i < cell->first_reference + cell->num_references; i++) {
+        int triangle = references[i];
+        collision hit = ray_triangle_intersection_t(r, &triangles[triangle], triangle, *t_max);
+        if (hit.has_collision) {
+            *closest = hit;
+            *t_max = hit.collision_distance;
+        }
+    }
+}
+
+
+// Finds the closest triangle the given ray hits (closer than t_max) by stepping through the cells of the given grid
+// A triangle found in one cell can actually be hit further along the ray than that cell (it only has to overlap the cell somewhere), so the walk
+// only stops once the closest hit so far is inside the cell the ray is in -- anything in the cells after that can only be further away
+__device__ __host__ collision grid_closest_hit(ray* r, grid_accelerator* grid, triangle_record* triangles, real t_max) {
+    collision closest;
+    if (grid->num_levels == 0) {
+        return closest;
+    }
+
+    grid_level* top = &grid->levels[0];
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    real t_enter = top->bounds.intersect(r->origin, inverse_direction, t_max);
+    if (t_enter == INFINITY) {
+        return closest;
+    }
+    t_enter = fmax(t_enter, (real) 0);
+
+    grid_dda walk;
+    walk.start(top, r->origin, r->direction, t_enter);
+    while (true) {
+        grid_cell* cell = &grid->cells[top->first_cell + walk.cell_index()];
+        real t_exit = walk.t_exit();
+        if (cell->child_level == -1) {
+            grid_test_cell(r, cell, grid->references, triangles, &closest, &t_max);
+        } else {
+            // Walking the cell's second-level grid the same way, from where the ray came into the cell
+            grid_level* inner = &grid->levels[cell->child_level];
+            grid_dda inner_walk;
+            inner_walk.start(inner, r->origin, r->direction, t_enter);
+            while (true) {
+                grid_test_cell(r, &grid->cells[inner->first_cell + inner_walk.cell_index()], grid->references, triangles, &closest, &t_max);
+                if (t_max <= inner_walk.t_exit() || !inner_walk.advance()) {
+                    break;
+                }
+            }
+        }
+
+        if (t_max <= t_exit || !walk.advance()) {
+            break;
+        }
+        t_enter = t_exit;
+    }
+    return closest;
+}
+
+
+// Makes a benchmark scene with the same number and size of triangles as make_benchmark_triangles(), but with nine out of every ten of them
+// bunched up into a few small clumps, which is the kind of scene a single-level grid handles worst
+__host__ triangle_record* make_clustered_benchmark_triangles(int num_triangles, uint32_t* random_state) {
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, random_state);
+    int num_clusters = 8;
+    vec3 cluster_centers[8];
+    for (int i = 0; i < num_clusters; i++) {
+        cluster_centers[i] = vec3(benchmark_random(random_state) * 80 - 40, benchmark_random(random_state) * 80 - 40,
+                                  benchmark_random(random_state) * 80 + 20);
+    }
+    for (int i = 0; i < num_triangles; i++) {
+        if (i % 10 == 0) {
+            continue;                                                                   // Left spread out through the whole box
+        }
+        vec3 offset = vec3(benchmark_random(random_state) - 0.5, benchmark_random(random_state) - 0.5, benchmark_random(random_state) - 0.5);
+        vec3 a = cluster_centers[i % num_clusters].add(offset.scale(6));
+        triangles[i].v0 = a;                                                            // Moving the whole triangle, edges and normal stay the same
+    }
+    return triangles;
+}
+
+
+// Builds a BVH, a single-level grid, and a two-level grid over a scene of the given number of triangles, once with them spread out evenly and once
+// with them bunched up, and prints how long each took to build and to trace the given number of rays, plus how many rays each grid disagreed with
+// the BVH on (which should always be 0)
+__host__ void benchmark_grid(int num_triangles, int num_rays) {
+    for (int clustered = 0; clustered < 2; clustered++) {
+        uint32_t random_state = 2463534242u;
+        triangle_record* triangles = clustered ? make_clustered_benchmark_triangles(num_triangles, &random_state)
+                                               : make_benchmark_triangles(num_triangles, &random_state);
+        ray* rays = make_benchmark_rays(num_rays, &random_state);
+
+        // The grids don't rearrange the triangles, but the BVH does, so it gets its own copy
+        triangle_record* bvh_triangles = new triangle_record[num_triangles];
+        memcpy(bvh_triangles, triangles, sizeof(triangle_record) * num_triangles);
+        auto bvh_build_start = std::chrono::high_resolution_clock::now();
+        bvh tree = build_bvh(bvh_triangles, num_triangles);
+        auto bvh_build_end = std::chrono::high_resolution_clock::now();
+
+        collision* bvh_hits = new collision[num_rays];
+        auto bvh_trace_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < num_rays; i++) {
+            bvh_hits[i] = bvh_closest_hit(&rays[i], tree.nodes, tree.num_nodes, bvh_triangles, INFINITY);
+        }
+        auto bvh_trace_end = std::chrono::high_resolution_clock::now();
+
+        double bvh_build_ms = std::chrono::duration_cast<std::chrono::microseconds>(bvh_build_end - bvh_build_start).count() / 1000.0;
+        double bvh_trace_ms = std::chrono::duration_cast<std::chrono::microseconds>(bvh_trace_end - bvh_trace_start).count() / 1000.0;
+        printf("grid benchmark: %i %s triangles, %i rays\n", num_triangles, clustered ? "clustered" : "uniform", num_rays);
+        printf("  bvh: build %.3f ms, trace %.3f ms\n", bvh_build_ms, bvh_trace_ms);
+
+        for (int two_level = 0; two_level < 2; two_level++) {
+            auto build_start = std::chrono::high_resolution_clock::now();
+            grid_accelerator grid = build_grid(triangles, num_triangles, two_level);
+            auto build_end = std::chrono::high_resolution_clock::now();
+
+            int num_mismatches = 0;
+            auto trace_start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < num_rays; i++) {
+                collision hit = grid_closest_hit(&rays[i], &grid, triangles, INFINITY);
+                if (hit.has_collision != bvh_hits[i].has_collision ||
+                    (hit.has_collision && hit.collision_distance != bvh_hits[i].collision_distance)) {
+                    num_mismatches++;
+                }
+            }
+            auto trace_end = std::chrono::high_resolution_clock::now();
+
+            double build_ms = std::chrono::duration_cast<std::chrono::microseconds>(build_end - build_start).count() / 1000.0;
+            double trace_ms = std::chrono::duration_cast<std::chrono::microseconds>(trace_end - trace_start).count() / 1000.0;
+            printf("  %s: build %.3f ms, trace %.3f ms, %i cells, %i references, %i mismatch(es)\n", two_level ? "two-level grid" : "grid",
+                   build_ms, trace_ms, grid.num_cells, grid.num_references, num_mismatches);
+            assert(num_mismatches == 0);
+            destroy_grid(&grid);
+        }
+
+        delete[] tree.nodes;
+        delete[] bvh_triangles;
+        delete[] bvh_hits;
+        delete[] triangles;
+        delete[] rays;
+    }
+}
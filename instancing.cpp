@@ -0,0 +1,490 @@
+// This file has instancing, which lets the same mesh show up many times in a scene without storing its triangles more than once
+// Every unique mesh gets its own BVH over just its own triangles (a "bottom-level" BVH, or BLAS), built once in the mesh's own coordinates
+// ("object space"). Each copy of a mesh in the scene is an instance, which is just the index of the mesh plus a transform that places it in the
+// world. A second BVH (the "top-level" BVH, or TLAS) is built over the world-space boxes of the instances
+// Tracing a ray walks the TLAS like any other BVH, but at a TLAS leaf, instead of testing triangles, the ray is moved into each instance's object
+// space (by the instance's inverse transform) and traced through that instance's mesh BVH. So memory grows with the number of unique triangles plus
+// a small amount per instance, and moving an instance only means rebuilding the TLAS -- the mesh BVHs never change
+// The ray's direction is transformed without normalizing it afterward, so a t-value along the object-space ray is the exact same t-value along the
+// world-space ray, and hit distances from different instances can be compared directly
+
+// A 3x4 transform (a 3x3 matrix for rotation and scale, plus a translation in the last column), stored row by row like the matrices that
+// vec3::transform() takes: matrix[0] through matrix[3] are the first row
+struct instance_transform {
+    real matrix[12];
+
+    __device__ __host__ vec3 apply_to_point(vec3 p) const {
+        return vec3((matrix[0] * p.x) + (matrix[1] * p.y) + (matrix[2] * p.z) + matrix[3],
+                    (matrix[4] * p.x) + (matrix[5] * p.y) + (matrix[6] * p.z) + matrix[7],
+                    (matrix[8] * p.x) + (matrix[9] * p.y) + (matrix[10] * p.z) + matrix[11]);
+    }
+
+    // Same as apply_to_point(), but without the translation, for directions
+    __device__ __host__ vec3 apply_to_vector(vec3 v) const {
+        return vec3((matrix[0] * v.x) + (matrix[1] * v.y) + (matrix[2] * v.z),
+                    (matrix[4] * v.x) + (matrix[5] * v.y) + (matrix[6] * v.z),
+                    (matrix[8] * v.x) + (matrix[9] * v.y) + (matrix[10] * v.z));
+    }
+};
+
+// Where one unique mesh's BVH and triangles live in the shared arrays all of the meshes are stored in
+// The mesh's node offsets and triangle offsets are relative to its own first node and first triangle, so its BVH can be walked with plain
+// bvh_closest_hit() by just starting the node and triangle pointers at first_node and first_triangle
+struct mesh_blas {
+    int first_node;
+    int num_nodes;
+    int first_triangle;
+    int num_triangles;
+    bounding_box bounds;                // The box around the whole mesh in object space (the same as its root node's box)
+};
+
+// One placed copy of a mesh
+struct mesh_instance {
+    instance_transform object_to_world;
+    instance_transform world_to_object;
+    int mesh_index;
+};
+
+// Everything a traversal needs to trace rays through an instanced scene, as plain pointers (which are host pointers when this comes from an
+// instanced_scene, or pointers into the block when it comes from a packed scene, see packed_scene::get_instanced_view())
+struct instanced_view {
+    bvh_node* tlas_nodes;
+    int num_tlas_nodes;
+    int* tlas_instances;                // The instance indices in the order the TLAS leaves expect (a TLAS leaf's offset and num_triangles refer to
+                                        // a range of this array, not of instances)
+    mesh_instance* instances;
+    mesh_blas* meshes;
+    bvh_node* blas_nodes;
+    triangle_record* triangles;
+};
+
+// An instanced scene on the host, which meshes and instances get added to
+// The instances keep the order they were added in (so an instance's index never changes), and only tlas_instances gets rearranged by the TLAS
+struct instanced_scene {
+    mesh_blas* meshes;
+    int num_meshes;
+    bvh_node* blas_nodes;
+    int num_blas_nodes;
+    triangle_record* triangles;
+    int num_triangles;
+    mesh_instance* instances;
+    int num_instances;
+
+    bvh tlas;
+    int* tlas_instances;
+    bool tlas_out_of_date;              // Set whenever an instance is added or moved, until build_tlas() is called
+};
+
+
+// Makes a transform that scales by scale, then rotates by rotation_y radians around the y-axis, then moves by translation
+__host__ instance_transform make_instance_transform(vec3 translation, real rotation_y, real scale) {
+    real sine = sin(rotation_y);
+    real cosine = cos(rotation_y);
+    instance_transform result = {{
+        cosine * scale, 0, sine * scale, translation.x,
+        0, scale, 0, translation.y,
+        -sine * scale, 0, cosine * scale, translation.z
+    }};
+    return result;
+}
+
+
+// Returns the transform that undoes the given one (the matrix part must be invertible, meaning no scale of 0)
+__host__ instance_transform invert_transform(instance_transform t) {
+    real* m = t.matrix;
+
+    // The inverse of the 3x3 part is its matrix of cofactors, transposed, over its determinant
+    real c00 = m[5] * m[10] - m[6] * m[9];
+    real c01 = m[6] * m[8] - m[4] * m[10];
+    real c02 = m[4] * m[9] - m[5] * m[8];
+    real determinant = m[0] * c00 + m[1] * c01 + m[2] * c02;
+    assert(determinant != 0);
+    real s = 1 / determinant;
+
+    instance_transform result;
+    real* r = result.matrix;
+    r[0] = c00 * s;
+    r[1] = (m[2] * m[9] - m[1] * m[10]) * s;
+    r[2] = (m[1] * m[6] - m[2] * m[5]) * s;
+    r[4] = c01 * s;
+    r[5] = (m[0] * m[10] - m[2] * m[8]) * s;
+    r[6] = (m[2] * m[4] - m[0] * m[6]) * s;
+    r[8] = c02 * s;
+    r[9] = (m[1] * m[8] - m[0] * m[9]) * s;
+    r[10] = (m[0] * m[5] - m[1] * m[4]) * s;
+
+    // The inverse translation is the original translation, moved backward through the inverse matrix
+    r[3] = -(r[0] * m[3] + r[1] * m[7] + r[2] * m[11]);
+    r[7] = -(r[4] * m[3] + r[5] * m[7] + r[6] * m[11]);
+    r[11] = -(r[8] * m[3] + r[9] * m[7] + r[10] * m[11]);
+    return result;
+}
+
+
+// Turns a normal of one of an instance's triangles (which is in object space) into a world-space normal
+// Normals can't just go through object_to_world like directions do, since a stretched shape's surfaces tilt the opposite way from how its edges do,
+// so they go through the transpose of world_to_object instead
+__device__ __host__ vec3 instance_normal_to_world(mesh_instance* instance, vec3 normal) {
+    real* m = instance->world_to_object.matrix;
+    return vec3((m[0] * normal.x) + (m[4] * normal.y) + (m[8] * normal.z),
+                (m[1] * normal.x) + (m[5] * normal.y) + (m[9] * normal.z),
+                (m[2] * normal.x) + (m[6] * normal.y) + (m[10] * normal.z)).normalize();
+}
+
+
+// Returns the world-space box around the given mesh when placed with the given transform, by transforming all 8 corners of its object-space box
+__host__ bounding_box instance_bounds(mesh_blas* mesh, instance_transform* object_to_world) {
+    bounding_box result;
+    for (int corner = 0; corner < 8; corner++) {
+        vec3 point = vec3((corner & 1) ? mesh->bounds.max.x : mesh->bounds.min.x,
+                          (corner & 2) ? mesh->bounds.max.y : mesh->bounds.min.y,
+                          (corner & 4) ? mesh->bounds.max.z : mesh->bounds.min.z);
+        result.grow(object_to_world->apply_to_point(point));
+    }
+    return result;
+}
+
+
+// Finds the closest triangle the given world-space ray hits (closer than t_max) in any instance of an instanced scene
+// Walks the TLAS the same way bvh_closest_hit() walks a BVH, and at each TLAS leaf traces an object-space copy of the ray through each of the
+// leaf's instances. The hit's triangle_index is an index into the view's shared triangle array, its instance_index is the instance it was in, and
+// its collision_point is in world space
+__device__ __host__ collision instanced_closest_hit(ray* r, instanced_view* scene, real t_max) {
+    collision closest;
+    if (scene->num_tlas_nodes == 0) {
+        return closest;
+    }
+
+    bvh_node* nodes = scene->tlas_nodes;
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    if (nodes[0].bounds.intersect(origin, inverse_direction, t_max) == INFINITY) {
+        return closest;
+    }
+
+    int stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        bvh_node* node = &nodes[node_index];
+        if (node->is_leaf()) {
+            for (int i = node->offset; i < node->offset + node->num_triangles; i++) {
+                int instance_index = scene->tlas_instances[i];
+                mesh_instance* instance = &scene->instances[instance_index];
+                mesh_blas* mesh = &scene->meshes[instance->mesh_index];
+
+                ray object_ray = ray(instance->world_to_object.apply_to_point(r->origin), instance->world_to_object.apply_to_vector(r->direction));
+                collision hit = bvh_closest_hit(&object_ray, scene->blas_nodes + mesh->first_node, mesh->num_nodes,
+                                                scene->triangles + mesh->first_triangle, t_max);
+                if (hit.has_collision) {                                                // Only ever closer than t_max
+                    closest = hit;
+                    closest.collision_point = get_point_from_t(r, hit.collision_distance);
+                    closest.triangle_index = mesh->first_triangle + hit.triangle_index;
+                    closest.instance_index = instance_index;
+                    t_max = hit.collision_distance;
+                }
+            }
+        } else {
+            int near_index = node_index + 1;
+            int far_index = node->offset;
+            real t_near = nodes[near_index].bounds.intersect(origin, inverse_direction, t_max);
+            real t_far = nodes[far_index].bounds.intersect(origin, inverse_direction, t_max);
+            if (t_far < t_near) {
+                int temp_index = near_index;
+                near_index = far_index;
+                far_index = temp_index;
+                real temp_t = t_near;
+                t_near = t_far;
+                t_far = temp_t;
+            }
+
+            if (t_near != INFINITY) {
+                if (t_far != INFINITY) {
+                    stack[stack_size++] = far_index;
+                }
+                node_index = near_index;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        node_index = stack[--stack_size];
+    }
+    return closest;
+}
+
+
+// Makes a copy of the given array with room for extra more items at the end, deleting the old one
+// Meshes and instances only get added while setting up a scene, so the arrays are just grown to the exact size each time
+template <typename T>
+__host__ T* grow_array(T* array, int count, int extra) {
+    T* result = new T[count + extra];
+    if (count > 0) {
+        memcpy(result, array, sizeof(T) * count);
+    }
+    delete[] array;
+    return result;
+}
+
+
+__host__ instanced_scene create_instanced_scene() {
+    instanced_scene result;
+    result.meshes = nullptr;
+    result.num_meshes = 0;
+    result.blas_nodes = nullptr;
+    result.num_blas_nodes = 0;
+    result.triangles = nullptr;
+    result.num_triangles = 0;
+    result.instances = nullptr;
+    result.num_instances = 0;
+    result.tlas.nodes = nullptr;
+    result.tlas.num_nodes = 0;
+    result.tlas_instances = nullptr;
+    result.tlas_out_of_date = false;
+    return result;
+}
+
+
+__host__ void destroy_instanced_scene(instanced_scene* scene) {
+    delete[] scene->meshes;
+    delete[] scene->blas_nodes;
+    delete[] scene->triangles;
+    delete[] scene->instances;
+    delete[] scene->tlas.nodes;
+    delete[] scene->tlas_instances;
+    *scene = create_instanced_scene();
+}
+
+
+// Adds a unique mesh made of a copy of the given triangle records (in object space), building its BVH right away, and returns its mesh index
+// The mesh's records get rearranged into BVH order inside the scene, but each one's source_index still says where it was in the given array
+__host__ int add_mesh(instanced_scene* scene, triangle_record* triangles, int num_triangles) {
+    assert(num_triangles > 0);
+    triangle_record* mesh_triangles = new triangle_record[num_triangles];
+    memcpy(mesh_triangles, triangles, sizeof(triangle_record) * num_triangles);
+    bvh tree = build_bvh(mesh_triangles, num_triangles);
+
+    mesh_blas mesh;
+    mesh.first_node = scene->num_blas_nodes;
+    mesh.num_nodes = tree.num_nodes;
+    mesh.first_triangle = scene->num_triangles;
+    mesh.num_triangles = num_triangles;
+    mesh.bounds = tree.nodes[0].bounds;
+
+    scene->blas_nodes = grow_array(scene->blas_nodes, scene->num_blas_nodes, tree.num_nodes);
+    memcpy(scene->blas_nodes + scene->num_blas_nodes, tree.nodes, sizeof(bvh_node) * tree.num_nodes);
+    scene->num_blas_nodes += tree.num_nodes;
+    scene->triangles = grow_array(scene->triangles, scene->num_triangles, num_triangles);
+    memcpy(scene->triangles + scene->num_triangles, mesh_triangles, sizeof(triangle_record) * num_triangles);
+    scene->num_triangles += num_triangles;
+    scene->meshes = grow_array(scene->meshes, scene->num_meshes, 1);
+    scene->meshes[scene->num_meshes] = mesh;
+
+    delete[] tree.nodes;
+    delete[] mesh_triangles;
+    return scene->num_meshes++;
+}
+
+
+// Same as above, but for a mesh stored as a triangle_soa (whose material indices should point into the materials the scene gets packed with)
+__host__ int add_mesh(instanced_scene* scene, triangle_soa* triangles) {
+    triangle_record* records = build_triangle_records(triangles);
+    int result = add_mesh(scene, records, triangles->num_triangles);
+    delete[] records;
+    return result;
+}
+
+
+// Places a copy of the given mesh in the world with the given transform, and returns its instance index
+__host__ int add_instance(instanced_scene* scene, int mesh_index, instance_transform object_to_world) {
+    assert(mesh_index >= 0 && mesh_index < scene->num_meshes);
+    scene->instances = grow_array(scene->instances, scene->num_instances, 1);
+    mesh_instance* instance = &scene->instances[scene->num_instances];
+    instance->mesh_index = mesh_index;
+    instance->object_to_world = object_to_world;
+    instance->world_to_object = invert_transform(object_to_world);
+    scene->tlas_out_of_date = true;
+    return scene->num_instances++;
+}
+
+
+// Moves the given instance (the TLAS then needs to be rebuilt with build_tlas() before tracing, but no mesh BVH does)
+__host__ void set_instance_transform(instanced_scene* scene, int instance_index, instance_transform object_to_world) {
+    mesh_instance* instance = &scene->instances[instance_index];
+    instance->object_to_world = object_to_world;
+    instance->world_to_object = invert_transform(object_to_world);
+    scene->tlas_out_of_date = true;
+}
+
+
+// Rebuilds the TLAS over the current world-space boxes of every instance, with the same binned SAH builder the mesh BVHs use
+// This only looks at one box per instance, so it stays cheap no matter how many triangles the meshes have
+__host__ void build_tlas(instanced_scene* scene) {
+    delete[] scene->tlas.nodes;
+    delete[] scene->tlas_instances;
+
+    bounding_box* bounds = new bounding_box[scene->num_instances];
+    for (int i = 0; i < scene->num_instances; i++) {
+        mesh_instance* instance = &scene->instances[i];
+        bounds[i] = instance_bounds(&scene->meshes[instance->mesh_index], &instance->object_to_world);
+    }
+    scene->tlas_instances = new int[scene->num_instances];
+    scene->tlas = build_bvh_over_bounds(bounds, scene->num_instances, scene->tlas_instances);
+    scene->tlas_out_of_date = false;
+    delete[] bounds;
+}
+
+
+__host__ instanced_view get_instanced_view(instanced_scene* scene) {
+    assert(!scene->tlas_out_of_date);
+    instanced_view result;
+    result.tlas_nodes = scene->tlas.nodes;
+    result.num_tlas_nodes = scene->tlas.num_nodes;
+    result.tlas_instances = scene->tlas_instances;
+    result.instances = scene->instances;
+    result.meshes = scene->meshes;
+    result.blas_nodes = scene->blas_nodes;
+    result.triangles = scene->triangles;
+    return result;
+}
+
+
+// How many bytes of geometry (triangles and every BVH node) the given scene needs, for comparing against a flattened copy
+__host__ size_t instanced_scene_size(instanced_scene* scene) {
+    return sizeof(triangle_record) * scene->num_triangles + sizeof(bvh_node) * (scene->num_blas_nodes + scene->tlas.num_nodes) +
+           sizeof(mesh_blas) * scene->num_meshes + (sizeof(mesh_instance) + sizeof(int)) * scene->num_instances;
+}
+
+
+// Makes one big list of world-space triangle records out of every instance, the way the scene would have to be stored without instancing
+__host__ triangle_record* flatten_instances(instanced_scene* scene, int* num_triangles) {
+    int count = 0;
+    for (int i = 0; i < scene->num_instances; i++) {
+        count += scene->meshes[scene->instances[i].mesh_index].num_triangles;
+    }
+    triangle_record* result = new triangle_record[count];
+    int next = 0;
+    for (int i = 0; i < scene->num_instances; i++) {
+        mesh_instance* instance = &scene->instances[i];
+        mesh_blas* mesh = &scene->meshes[instance->mesh_index];
+        for (int j = mesh->first_triangle; j < mesh->first_triangle + mesh->num_triangles; j++) {
+            triangle_record* tri = &scene->triangles[j];
+            vec3 a = instance->object_to_world.apply_to_point(tri->v0);
+            vec3 b = instance->object_to_world.apply_to_point(tri->v0.add(tri->e1));
+            vec3 c = instance->object_to_world.apply_to_point(tri->v0.add(tri->e2));
+            result[next] = make_triangle_record(a, b, c, tri->material_index, next);
+            next++;
+        }
+    }
+    *num_triangles = count;
+    return result;
+}
+
+
+// Fills a scene with num_instances copies of one random mesh of the given number of triangles, shrunk down and spread out on a grid through the
+// benchmark scene's box with random rotations, then compares it against the same scene flattened into one big BVH: how much memory each needs, how
+// long it takes to update each after moving one instance, how long tracing takes, and how many rays the two disagree on (which should be 0, apart
+// from the odd ray grazing a triangle's edge, since the instanced rays get rounded differently on their way into object space, so those are
+// counted on their own)
+__host__ void benchmark_instancing(int mesh_triangles, int num_instances, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* mesh = make_benchmark_triangles(mesh_triangles, &random_state);
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+
+    instanced_scene scene = create_instanced_scene();
+    int mesh_index = add_mesh(&scene, mesh, mesh_triangles);
+    vec3 mesh_center = scene.meshes[mesh_index].bounds.center();
+    int grid_size = (int) ceil(cbrt((real) num_instances));
+    real cell_size = 100 / (real) grid_size;
+    for (int i = 0; i < num_instances; i++) {
+        vec3 cell_center = vec3(((i % grid_size) + (real) 0.5) * cell_size - 50, (((i / grid_size) % grid_size) + (real) 0.5) * cell_size - 50,
+                                ((i / (grid_size * grid_size)) + (real) 0.5) * cell_size + 10);
+        real rotation = benchmark_random(&random_state) * (real) 6.283185307179586;                    // Anywhere from 0 to 2 pi
+        real scale = (real) 0.6 / grid_size;
+        instance_transform placement = make_instance_transform(vec3(0, 0, 0), rotation, scale);
+        placement = make_instance_transform(cell_center.sub(placement.apply_to_point(mesh_center)), rotation, scale);
+        add_instance(&scene, mesh_index, placement);
+    }
+    build_tlas(&scene);
+
+    int num_flat_triangles;
+    triangle_record* flat_triangles = flatten_instances(&scene, &num_flat_triangles);
+    bvh flat_tree = build_bvh(flat_triangles, num_flat_triangles);
+    size_t flat_size = sizeof(triangle_record) * num_flat_triangles + sizeof(bvh_node) * flat_tree.num_nodes;
+
+    // Moving one instance, then timing what it takes to get each version up to date again
+    instance_transform moved = scene.instances[0].object_to_world;
+    moved.matrix[3] += cell_size / 4;
+    set_instance_transform(&scene, 0, moved);
+    auto tlas_start = std::chrono::high_resolution_clock::now();
+    build_tlas(&scene);
+    auto tlas_end = std::chrono::high_resolution_clock::now();
+
+    delete[] flat_tree.nodes;
+    delete[] flat_triangles;
+    auto flat_start = std::chrono::high_resolution_clock::now();
+    flat_triangles = flatten_instances(&scene, &num_flat_triangles);
+    flat_tree = build_bvh(flat_triangles, num_flat_triangles);
+    auto flat_end = std::chrono::high_resolution_clock::now();
+
+    collision* flat_hits = new collision[num_rays];
+    auto flat_trace_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_rays; i++) {
+        flat_hits[i] = bvh_closest_hit(&rays[i], flat_tree.nodes, flat_tree.num_nodes, flat_triangles, INFINITY);
+    }
+    auto flat_trace_end = std::chrono::high_resolution_clock::now();
+
+    instanced_view view = get_instanced_view(&scene);
+    collision* instanced_hits = new collision[num_rays];
+    auto instanced_trace_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_rays; i++) {
+        instanced_hits[i] = instanced_closest_hit(&rays[i], &view, INFINITY);
+    }
+    auto instanced_trace_end = std::chrono::high_resolution_clock::now();
+
+    // A ray the two disagree on only counts as a graze (and not a mismatch) if the closer of its two hits is right on an edge of its triangle,
+    // where the other version's rounding could just as well have missed it
+    int num_hits = 0;
+    int num_grazes = 0;
+    int num_mismatches = 0;
+    real tolerance = sizeof(real) == sizeof(float) ? (real) 1e-4 : (real) 1e-9;
+    for (int i = 0; i < num_rays; i++) {
+        num_hits += flat_hits[i].has_collision;
+        if (flat_hits[i].has_collision != instanced_hits[i].has_collision ||
+            (flat_hits[i].has_collision &&
+             fabs(flat_hits[i].collision_distance - instanced_hits[i].collision_distance) > tolerance * flat_hits[i].collision_distance)) {
+            collision* closer = &flat_hits[i];
+            if (!closer->has_collision || (instanced_hits[i].has_collision && instanced_hits[i].collision_distance < closer->collision_distance)) {
+                closer = &instanced_hits[i];
+            }
+            real edge_weight = fmin(fmin(closer->barycentric_u, closer->barycentric_v), 1 - closer->barycentric_u - closer->barycentric_v);
+            if (edge_weight < tolerance) {
+                num_grazes++;
+            } else {
+                num_mismatches++;
+            }
+        }
+    }
+
+    double tlas_ms = std::chrono::duration_cast<std::chrono::microseconds>(tlas_end - tlas_start).count() / 1000.0;
+    double flat_ms = std::chrono::duration_cast<std::chrono::microseconds>(flat_end - flat_start).count() / 1000.0;
+    double flat_trace_ms = std::chrono::duration_cast<std::chrono::microseconds>(flat_trace_end - flat_trace_start).count() / 1000.0;
+    double instanced_trace_ms =
+        std::chrono::duration_cast<std::chrono::microseconds>(instanced_trace_end - instanced_trace_start).count() / 1000.0;
+    printf("instancing benchmark: %i instances of a %i triangle mesh, %i rays\n", num_instances, mesh_triangles, num_rays);
+    printf("  memory: %.2f MB instanced, %.2f MB flattened\n", instanced_scene_size(&scene) / 1048576.0, flat_size / 1048576.0);
+    printf("  after moving one instance: tlas rebuild %.3f ms, full rebuild %.3f ms\n", tlas_ms, flat_ms);
+    printf("  trace: %.3f ms instanced, %.3f ms flattened\n", instanced_trace_ms, flat_trace_ms);
+    printf("  %i hit(s), %i edge graze(s), %i mismatch(es)\n", num_hits, num_grazes, num_mismatches);
+    assert(num_mismatches == 0);
+
+    destroy_instanced_scene(&scene);
+    delete[] flat_tree.nodes;
+    delete[] flat_triangles;
+    delete[] flat_hits;
+    delete[] instanced_hits;
+    delete[] mesh;
+    delete[] rays;
+}
@@ -0,0 +1,813 @@
+// This file has the linear BVH (LBVH) builder, which builds the same kind of flattened BVH as bvh.cpp, but fast enough to redo every frame for
+// scenes where things move
+// The SAH builder in bvh.cpp makes good trees, but it works top-down, one node at a time, so it is slow and hard to split up between threads. The
+// LBVH builder instead works like this:
+//     1. Every triangle gets a Morton code: its centroid's x, y, and z (scaled to 10 bits each) with their bits interleaved into one 30-bit number.
+//        Sorting by Morton code puts triangles that are close together in space close together in the list (it follows a "Z-order" curve)
+//     2. The triangles get sorted by their Morton codes with a radix sort
+//     3. Every interior node of the tree is worked out on its own straight from the sorted codes ("Karras-style" emission): the tree is exactly the
+//        one you get by splitting every range of codes at the highest bit that differs inside it, and each interior node can find its own range
+//        and split by looking at the codes around it, without knowing anything about any other node
+//     4. Bounding boxes are filled in from the leaves up to the root: every leaf walks up the tree, and the first of two children to reach a node
+//        stops there while the second one (which knows both children are done) works out the node's box and keeps going
+//     5. The nodes are written out in the same depth-first layout that bvh_closest_hit() walks, so both builders' trees are traced the same way
+// Every step is just the same small piece of work done once per triangle or per node, so each of them runs split across threads on the host, or as
+// one kernel on the device, with the exact same per-element functions
+// The trees have one triangle per leaf and split at the middle of space instead of at the cheapest spot, so they trace a bit slower than the SAH
+// builder's trees (see benchmark_lbvh(), which compares the two)
+
+#define LBVH_BLOCK_SIZE 256             // Threads per block for every LBVH kernel (the scan and reduction kernels depend on it being a power of 2)
+#define LBVH_RADIX_BITS 8               // Bits sorted per pass of the host radix sort
+#define LBVH_MORTON_BITS 30             // Bits in a Morton code (10 per axis)
+
+// Everything the per-element steps of the LBVH builder share, all as plain arrays so the same struct works with host memory or device memory
+// The tree has num_triangles leaves (leaf i is sorted triangle i) and num_triangles - 1 interior nodes (interior node 0 is always the root). Each
+// interior node covers the range of leaves first to last, and its left child covers first to split and its right child covers split + 1 to last --
+// a child covering just one leaf is that leaf, and otherwise it is the interior node with the same index as the end of its range that touches the
+// split (interior node split for the left child, interior node split + 1 for the right child)
+struct lbvh_hierarchy {
+    int num_triangles;
+    uint32_t* codes;                    // The sorted Morton codes
+    triangle_record* triangles;         // The triangles, in sorted order
+
+    // Per interior node
+    int* first;
+    int* last;
+    int* split;
+    int* internal_parents;              // The interior node above each interior node, or -1 for the root
+    int* arrival_counts;                // How many children have finished their bounds so far (see lbvh_propagate_bounds())
+    bounding_box* internal_bounds;
+
+    int* leaf_parents;                  // Per leaf, the interior node above it
+
+    bvh_node* nodes;                    // Where the finished, flattened tree goes (2 * num_triangles - 1 nodes)
+};
+
+
+// Spreads the lowest 10 bits of the given number out so that there are two 0 bits between each of them (so that three of these can be interleaved)
+__device__ __host__ uint32_t expand_bits(uint32_t value) {
+    value = (value * 0x00010001u) & 0xFF0000FFu;
+    value = (value * 0x00000101u) & 0x0F00F00Fu;
+    value = (value * 0x00000011u) & 0xC30C30C3u;
+    value = (value * 0x00000005u) & 0x49249249u;
+    return value;
+}
+
+
+// Returns the 30-bit Morton code of the given point, where bounds is the box that every point being coded fits inside of
+__device__ __host__ uint32_t morton_code(vec3 point, bounding_box bounds) {
+    vec3 extent = bounds.extent();
+    real x = extent.x > 0 ? (point.x - bounds.min.x) / extent.x : 0;
+    real y = extent.y > 0 ? (point.y - bounds.min.y) / extent.y : 0;
+    real z = extent.z > 0 ? (point.z - bounds.min.z) / extent.z : 0;
+    uint32_t xi = (uint32_t) fmin(fmax(x * 1024, (real) 0), (real) 1023);
+    uint32_t yi = (uint32_t) fmin(fmax(y * 1024, (real) 0), (real) 1023);
+    uint32_t zi = (uint32_t) fmin(fmax(z * 1024, (real) 0), (real) 1023);
+    return (expand_bits(xi) << 2) | (expand_bits(yi) << 1) | expand_bits(zi);
+}
+
+
+// Returns how many leading bits the sorted codes at indices i and j have in common, or -1 if j is out of range
+// Equal codes are told apart by their indices (as if the index were extra bits tacked onto the end of the code), so that every code is unique and
+// the tree still splits up triangles that landed on the exact same code
+__device__ __host__ int lbvh_common_prefix(lbvh_hierarchy* h, int i, int j) {
+    if (j < 0 || j >= h->num_triangles) {
+        return -1;
+    }
+    uint32_t code_i = h->codes[i];
+    uint32_t code_j = h->codes[j];
+    if (code_i == code_j) {
+        return 32 + __builtin_clz((uint32_t) i ^ (uint32_t) j);
+    }
+    return __builtin_clz(code_i ^ code_j);
+}
+
+
+// Works out the range, split, and children of interior node i (step 3 above)
+// From Tero Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees" (2012): node i's range always starts or ends at
+// leaf i, and it goes in whichever direction shares the longer prefix with i. From there, the other end of the range is found with a binary search
+// for the farthest code that still shares more of a prefix with i than the neighbor on the other side does, and the split with another binary
+// search for the last code that shares more of a prefix with i than the other end does
+__device__ __host__ void lbvh_emit_internal_node(lbvh_hierarchy* h, int i) {
+    int direction = lbvh_common_prefix(h, i, i + 1) - lbvh_common_prefix(h, i, i - 1) >= 0 ? 1 : -1;
+    int min_prefix = lbvh_common_prefix(h, i, i - direction);
+
+    // Finding an upper bound on the length of the range by doubling, and then the exact length by binary searching below it
+    int max_length = 2;
+    while (lbvh_common_prefix(h, i, i + max_length * direction) > min_prefix) {
+        max_length *= 2;
+    }
+    int length = 0;
+    for (int step = max_length / 2; step >= 1; step /= 2) {
+        if (lbvh_common_prefix(h, i, i + (length + step) * direction) > min_prefix) {
+            length += step;
+        }
+    }
+    int j = i + length * direction;
+
+    // Binary searching for where the node's range splits
+    int node_prefix = lbvh_common_prefix(h, i, j);
+    int split_offset = 0;
+    int step = length;
+    do {
+        step = (step + 1) / 2;
+        if (lbvh_common_prefix(h, i, i + (split_offset + step) * direction) > node_prefix) {
+            split_offset += step;
+        }
+    } while (step > 1);
+    int split = i + split_offset * direction + (direction < 0 ? -1 : 0);
+
+    int first = i < j ? i : j;
+    int last = i < j ? j : i;
+    h->first[i] = first;
+    h->last[i] = last;
+    h->split[i] = split;
+
+    // Telling the children who their parent is
+    if (split == first) {
+        h->leaf_parents[split] = i;
+    } else {
+        h->internal_parents[split] = i;
+    }
+    if (split + 1 == last) {
+        h->leaf_parents[split + 1] = i;
+    } else {
+        h->internal_parents[split + 1] = i;
+    }
+    if (i == 0) {
+        h->internal_parents[0] = -1;
+    }
+}
+
+
+// Counts a child as finished with the given node, returning how many children had already finished it before this one
+// On the device, the fence makes sure the box this thread just wrote is visible everywhere before the other child can see that it has arrived
+__device__ __host__ int lbvh_arrive(int* arrival_count) {
+#ifdef __HIP_DEVICE_COMPILE__
+    __threadfence();
+    return atomicAdd(arrival_count, 1);
+#else
+    return __atomic_fetch_add(arrival_count, 1, __ATOMIC_ACQ_REL);
+#endif
+}
+
+
+// Reads a box that another thread may have just written -- on the device, the loads are volatile so they go past this compute unit's cache (which
+// could still be holding an old copy) instead of being served from it
+__device__ __host__ bounding_box lbvh_load_bounds(bounding_box* bounds) {
+#ifdef __HIP_DEVICE_COMPILE__
+    volatile real* values = (volatile real*) bounds;
+    return bounding_box(vec3(values[0], values[1], values[2]), vec3(values[3], values[4], values[5]));
+#else
+    return *bounds;
+#endif
+}
+
+
+// Returns the box of the left (or right) child of the given interior node
+__device__ __host__ bounding_box lbvh_child_bounds(lbvh_hierarchy* h, int node, bool right) {
+    int child = right ? h->split[node] + 1 : h->split[node];
+    bool child_is_leaf = right ? child == h->last[node] : child == h->first[node];
+    if (child_is_leaf) {
+        return triangle_bounds(&h->triangles[child]);
+    }
+    return lbvh_load_bounds(&h->internal_bounds[child]);
+}
+
+
+// Walks up the tree from the given leaf, filling in boxes until it reaches a node whose other child isn't finished yet (step 4 above)
+__device__ __host__ void lbvh_propagate_bounds(lbvh_hierarchy* h, int leaf) {
+    int node = h->leaf_parents[leaf];
+    while (node != -1) {
+        if (lbvh_arrive(&h->arrival_counts[node]) == 0) {
+            return;                                                                     // The other child will finish this node when it gets here
+        }
+#ifdef __HIP_DEVICE_COMPILE__
+        __threadfence();
+#endif
+        bounding_box bounds = lbvh_child_bounds(h, node, false);
+        bounds.grow(lbvh_child_bounds(h, node, true));
+        h->internal_bounds[node] = bounds;
+        node = h->internal_parents[node];
+    }
+}
+
+
+// Writes node index (an interior node if it is below num_triangles - 1, otherwise leaf index - (num_triangles - 1)) into its spot in the flattened,
+// depth-first node array (step 5 above)
+// In depth-first order, everything before a node is either one of its ancestors or in a subtree that is entirely to its left. The subtrees to its
+// left hold exactly the leaves before first, which is 2 * first nodes minus one for each of those subtrees -- and there is one of those subtrees for
+// every ancestor the node is to the right of. Adding the ancestors back in, the node's spot comes out to 2 * first plus the number of ancestors
+// that the node is to the left of, which it finds by walking up to the root
+__device__ __host__ void lbvh_write_node(lbvh_hierarchy* h, int index) {
+    int num_internal = h->num_triangles - 1;
+    bool is_leaf = index >= num_internal;
+    int first = is_leaf ? index - num_internal : h->first[index];
+    int last = is_leaf ? first : h->last[index];
+    int parent = is_leaf ? h->leaf_parents[first] : h->internal_parents[index];
+
+    int left_of = 0;
+    int subtree_last = last;
+    while (parent != -1) {
+        if (subtree_last <= h->split[parent]) {
+            left_of++;
+        }
+        subtree_last = h->last[parent];
+        parent = h->internal_parents[parent];
+    }
+    int position = 2 * first + left_of;
+
+    bvh_node* node = &h->nodes[position];
+    if (is_leaf) {
+        node->bounds = triangle_bounds(&h->triangles[first]);
+        node->offset = first;
+        node->num_triangles = 1;
+    } else {
+        node->bounds = h->internal_bounds[index];
+        node->offset = position + 2 * (h->split[index] - first + 1);                    // Right after the left child's subtree, which has
+                                                                                        // split - first + 1 leaves and so twice that minus 1 nodes
+        node->num_triangles = 0;
+    }
+}
+
+
+// Splits the range 0 to count up into one chunk per thread and runs function(chunk_start, chunk_end) for every chunk on its own thread
+template <typename F>
+__host__ void parallel_for(int count, int num_threads, F function) {
+    if (num_threads <= 1) {
+        function(0, count);
+        return;
+    }
+
+    std::thread* threads = new std::thread[num_threads];
+    int chunk_size = (count + num_threads - 1) / num_threads;
+    for (int t = 0; t < num_threads; t++) {
+        int start = t * chunk_size < count ? t * chunk_size : count;
+        int end = start + chunk_size < count ? start + chunk_size : count;
+        threads[t] = std::thread(function, start, end);
+    }
+    for (int t = 0; t < num_threads; t++) {
+        threads[t].join();
+    }
+    delete[] threads;
+}
+
+
+// Sorts the given codes (and the indices alongside them) with a parallel least-significant-digit radix sort, LBVH_RADIX_BITS bits per pass
+// Every pass, each thread counts how many of its chunk's codes have each digit, those counts are added up into where each thread's codes with each
+// digit should start, and then each thread moves its codes there -- in the same order they came in, which is what makes sorting one digit at a
+// time work. Uses codes_temp and indices_temp as the other half of each pass, and always leaves the result back in codes and indices
+__host__ void radix_sort(uint32_t* codes, int* indices, uint32_t* codes_temp, int* indices_temp, int count, int num_threads) {
+    const int num_digits = 1 << LBVH_RADIX_BITS;
+    int chunk_size = (count + num_threads - 1) / num_threads;
+    int* digit_starts = new int[num_threads * num_digits];
+
+    uint32_t* source_codes = codes;
+    int* source_indices = indices;
+    uint32_t* destination_codes = codes_temp;
+    int* destination_indices = indices_temp;
+    for (int shift = 0; shift < 32; shift += LBVH_RADIX_BITS) {
+        memset(digit_starts, 0, sizeof(int) * num_threads * num_digits);
+        parallel_for(num_threads, num_threads, [&](int thread_start, int thread_end) {
+            for (int t = thread_start; t < thread_end; t++) {
+                int end = (t + 1) * chunk_size < count ? (t + 1) * chunk_size : count;
+                for (int i = t * chunk_size; i < end; i++) {
+                    digit_starts[t * num_digits + ((source_codes[i] >> shift) & (num_digits - 1))]++;
+                }
+            }
+        });
+
+        // Turning the counts into starting positions: all of the 0 digits (from every thread, in thread order), then all of the 1 digits, ...
+        int position = 0;
+        for (int digit = 0; digit < num_digits; digit++) {
+            for (int t = 0; t < num_threads; t++) {
+                int digit_count = digit_starts[t * num_digits + digit];
+                digit_starts[t * num_digits + digit] = position;
+                position += digit_count;
+            }
+        }
+
+        parallel_for(num_threads, num_threads, [&](int thread_start, int thread_end) {
+            for (int t = thread_start; t < thread_end; t++) {
+                int end = (t + 1) * chunk_size < count ? (t + 1) * chunk_size : count;
+                for (int i = t * chunk_size; i < end; i++) {
+                    int destination = digit_starts[t * num_digits + ((source_codes[i] >> shift) & (num_digits - 1))]++;
+                    destination_codes[destination] = source_codes[i];
+                    destination_indices[destination] = source_indices[i];
+                }
+            }
+        });
+
+        uint32_t* swap_codes = source_codes;
+        source_codes = destination_codes;
+        destination_codes = swap_codes;
+        int* swap_indices = source_indices;
+        source_indices = destination_indices;
+        destination_indices = swap_indices;
+    }
+
+    if (source_codes != codes) {
+        memcpy(codes, source_codes, sizeof(uint32_t) * count);
+        memcpy(indices, source_indices, sizeof(int) * count);
+    }
+    delete[] digit_starts;
+}
+
+
+// Builds an LBVH over the given triangles on the host, split across the given number of threads
+// Just like build_bvh(), the triangles are rearranged in place into the order the leaves expect
+__host__ bvh build_lbvh(triangle_record* triangles, int num_triangles, int num_threads) {
+    bvh result;
+    result.nodes = nullptr;
+    result.num_nodes = 0;
+    if (num_triangles == 0) {
+        return result;
+    }
+    if (num_triangles < 4096) {
+        num_threads = 1;                                                                // Not worth starting threads for
+    }
+    result.num_nodes = 2 * num_triangles - 1;
+    result.nodes = new bvh_node[result.num_nodes];
+    if (num_triangles == 1) {
+        result.nodes[0].bounds = triangle_bounds(&triangles[0]);
+        result.nodes[0].offset = 0;
+        result.nodes[0].num_triangles = 1;
+        return result;
+    }
+
+    // Step 1: Morton codes, which first needs the box around every centroid
+    bounding_box* thread_bounds = new bounding_box[num_threads];
+    int chunk_size = (num_triangles + num_threads - 1) / num_threads;
+    parallel_for(num_threads, num_threads, [&](int thread_start, int thread_end) {
+        for (int t = thread_start; t < thread_end; t++) {
+            int end = (t + 1) * chunk_size < num_triangles ? (t + 1) * chunk_size : num_triangles;
+            for (int i = t * chunk_size; i < end; i++) {
+                thread_bounds[t].grow(triangle_bounds(&triangles[i]).center());
+            }
+        }
+    });
+    bounding_box centroid_bounds;
+    for (int t = 0; t < num_threads; t++) {
+        centroid_bounds.grow(thread_bounds[t]);
+    }
+    delete[] thread_bounds;
+
+    uint32_t* codes = new uint32_t[num_triangles];
+    int* indices = new int[num_triangles];
+    parallel_for(num_triangles, num_threads, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            codes[i] = morton_code(triangle_bounds(&triangles[i]).center(), centroid_bounds);
+            indices[i] = i;
+        }
+    });
+
+    // Step 2: sorting
+    uint32_t* codes_temp = new uint32_t[num_triangles];
+    int* indices_temp = new int[num_triangles];
+    radix_sort(codes, indices, codes_temp, indices_temp, num_triangles, num_threads);
+    delete[] codes_temp;
+    delete[] indices_temp;
+
+    lbvh_hierarchy h;
+    h.num_triangles = num_triangles;
+    h.codes = codes;
+    h.triangles = new triangle_record[num_triangles];
+    h.first = new int[num_triangles - 1];
+    h.last = new int[num_triangles - 1];
+    h.split = new int[num_triangles - 1];
+    h.internal_parents = new int[num_triangles - 1];
+    h.arrival_counts = new int[num_triangles - 1];
+    h.internal_bounds = new bounding_box[num_triangles - 1];
+    h.leaf_parents = new int[num_triangles];
+    h.nodes = result.nodes;
+    parallel_for(num_triangles, num_threads, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            h.triangles[i] = triangles[indices[i]];
+        }
+    });
+    memset(h.arrival_counts, 0, sizeof(int) * (num_triangles - 1));
+
+    // Steps 3 through 5, each one only starting once the one before it has finished everywhere
+    parallel_for(num_triangles - 1, num_threads, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            lbvh_emit_internal_node(&h, i);
+        }
+    });
+    parallel_for(num_triangles, num_threads, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            lbvh_propagate_bounds(&h, i);
+        }
+    });
+    parallel_for(result.num_nodes, num_threads, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            lbvh_write_node(&h, i);
+        }
+    });
+
+    memcpy(triangles, h.triangles, sizeof(triangle_record) * num_triangles);
+
+    delete[] codes;
+    delete[] indices;
+    delete[] h.triangles;
+    delete[] h.first;
+    delete[] h.last;
+    delete[] h.split;
+    delete[] h.internal_parents;
+    delete[] h.arrival_counts;
+    delete[] h.internal_bounds;
+    delete[] h.leaf_parents;
+    return result;
+}
+
+
+// Device versions of each step -- each thread does one element, and the kernels are launched one after the other on the same stream, so each step
+// only starts once the one before it has finished
+
+// Adds this block's boxes together in shared memory and has the first thread of the block write the total to block_bounds
+// Boxes are kept as 6 plain numbers in shared memory, since shared memory can't hold types with constructors
+__device__ void lbvh_block_reduce_bounds(bounding_box local_bounds, bounding_box* block_bounds) {
+    __shared__ real shared_bounds[6][LBVH_BLOCK_SIZE];
+    int t = threadIdx.x;
+    shared_bounds[0][t] = local_bounds.min.x;
+    shared_bounds[1][t] = local_bounds.min.y;
+    shared_bounds[2][t] = local_bounds.min.z;
+    shared_bounds[3][t] = local_bounds.max.x;
+    shared_bounds[4][t] = local_bounds.max.y;
+    shared_bounds[5][t] = local_bounds.max.z;
+    __syncthreads();
+
+    for (int stride = LBVH_BLOCK_SIZE / 2; stride > 0; stride /= 2) {
+        if (t < stride) {
+            for (int k = 0; k < 3; k++) {
+                shared_bounds[k][t] = fmin(shared_bounds[k][t], shared_bounds[k][t + stride]);
+                shared_bounds[k + 3][t] = fmax(shared_bounds[k + 3][t], shared_bounds[k + 3][t + stride]);
+            }
+        }
+        __syncthreads();
+    }
+
+    if (t == 0) {
+        block_bounds[blockIdx.x] = bounding_box(vec3(shared_bounds[0][0], shared_bounds[1][0], shared_bounds[2][0]),
+                                                vec3(shared_bounds[3][0], shared_bounds[4][0], shared_bounds[5][0]));
+    }
+}
+
+__global__ void lbvh_centroid_bounds_kernel(triangle_record* triangles, int num_triangles, bounding_box* block_bounds) {
+    bounding_box local_bounds;
+    for (int i = threadIdx.x + blockIdx.x * blockDim.x; i < num_triangles; i += blockDim.x * gridDim.x) {
+        local_bounds.grow(triangle_bounds(&triangles[i]).center());
+    }
+    lbvh_block_reduce_bounds(local_bounds, block_bounds);
+}
+
+__global__ void lbvh_merge_bounds_kernel(bounding_box* boxes, int num_boxes, bounding_box* total) {
+    bounding_box local_bounds;
+    for (int i = threadIdx.x; i < num_boxes; i += blockDim.x) {
+        local_bounds.grow(boxes[i]);
+    }
+    lbvh_block_reduce_bounds(local_bounds, total);                                      // Only ever launched with one block
+}
+
+__global__ void lbvh_morton_kernel(triangle_record* triangles, int num_triangles, bounding_box* centroid_bounds, uint32_t* codes, int* indices) {
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i < num_triangles) {
+        codes[i] = morton_code(triangle_bounds(&triangles[i]).center(), *centroid_bounds);
+        indices[i] = i;
+    }
+}
+
+
+// Does an exclusive prefix sum of each block's part of data in place (each element becomes the sum of everything before it in its block), and
+// writes the total of each block to block_sums (if it isn't null)
+__global__ void scan_blocks_kernel(int* data, int count, int* block_sums) {
+    __shared__ int shared_sums[LBVH_BLOCK_SIZE];
+    int t = threadIdx.x;
+    int i = t + blockIdx.x * LBVH_BLOCK_SIZE;
+    int value = i < count ? data[i] : 0;
+    shared_sums[t] = value;
+    __syncthreads();
+
+    // Every step adds in the value from offset spots back, doubling offset each time, which adds up everything up to and including each element
+    for (int offset = 1; offset < LBVH_BLOCK_SIZE; offset *= 2) {
+        int other = t >= offset ? shared_sums[t - offset] : 0;
+        __syncthreads();
+        shared_sums[t] += other;
+        __syncthreads();
+    }
+
+    if (i < count) {
+        data[i] = shared_sums[t] - value;
+    }
+    if (t == LBVH_BLOCK_SIZE - 1 && block_sums != nullptr) {
+        block_sums[blockIdx.x] = shared_sums[t];
+    }
+}
+
+__global__ void add_block_offsets_kernel(int* data, int count, int* block_offsets) {
+    int i = threadIdx.x + blockIdx.x * LBVH_BLOCK_SIZE;
+    if (i < count) {
+        data[i] += block_offsets[blockIdx.x];
+    }
+}
+
+// How many ints of scratch memory gpu_exclusive_scan() needs for the given count
+__host__ size_t scan_scratch_count(int count) {
+    size_t total = 0;
+    int level_count = (count + LBVH_BLOCK_SIZE - 1) / LBVH_BLOCK_SIZE;
+    while (level_count > 1) {
+        total += level_count;
+        level_count = (level_count + LBVH_BLOCK_SIZE - 1) / LBVH_BLOCK_SIZE;
+    }
+    return total;
+}
+
+// Exclusive prefix sum of the whole data array: every block is scanned on its own, then the blocks' totals are scanned (the same way, so this
+// recurses once per factor of LBVH_BLOCK_SIZE) and added back onto every element of their block
+__host__ void gpu_exclusive_scan(int* data, int count, int* scratch, hipStream_t stream) {
+    int num_blocks = (count + LBVH_BLOCK_SIZE - 1) / LBVH_BLOCK_SIZE;
+    scan_blocks_kernel<<<
+        dim3(num_blocks),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(data, count, num_blocks > 1 ? scratch : nullptr);
+    if (num_blocks > 1) {
+        gpu_exclusive_scan(scratch, num_blocks, scratch + num_blocks, stream);
+        add_block_offsets_kernel<<<
+            dim3(num_blocks),
+            dim3(LBVH_BLOCK_SIZE),
+            0,
+            stream
+        >>>(data, count, scratch);
+    }
+}
+
+
+// One pass of the device sort, which sorts by a single bit: every code with a 0 there goes first (in the order they came in), then every code with
+// a 1 there ("split"). The flags mark the 0s, and once they are prefix summed, each 0's flag is the number of 0s before it, which is exactly
+// where it goes
+__global__ void radix_split_flags_kernel(uint32_t* codes, int count, int bit, int* flags) {
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i < count) {
+        flags[i] = ((codes[i] >> bit) & 1) == 0;
+    }
+}
+
+__global__ void radix_split_scatter_kernel(uint32_t* codes_in, int* indices_in, uint32_t* codes_out, int* indices_out, int count, int bit,
+                                           int* zeros_before) {
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i >= count) {
+        return;
+    }
+    int total_zeros = zeros_before[count - 1] + (((codes_in[count - 1] >> bit) & 1) == 0);
+    bool is_zero = ((codes_in[i] >> bit) & 1) == 0;
+    int destination = is_zero ? zeros_before[i] : total_zeros + (i - zeros_before[i]);   // Everything before i that isn't a 0 is a 1
+    codes_out[destination] = codes_in[i];
+    indices_out[destination] = indices_in[i];
+}
+
+
+__global__ void lbvh_gather_kernel(triangle_record* triangles, int* indices, int num_triangles, triangle_record* sorted_triangles) {
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i < num_triangles) {
+        sorted_triangles[i] = triangles[indices[i]];
+    }
+}
+
+__global__ void lbvh_emit_kernel(lbvh_hierarchy h) {
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i < h.num_triangles - 1) {
+        lbvh_emit_internal_node(&h, i);
+    }
+}
+
+__global__ void lbvh_bounds_kernel(lbvh_hierarchy h) {
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i < h.num_triangles) {
+        lbvh_propagate_bounds(&h, i);
+    }
+}
+
+__global__ void lbvh_write_kernel(lbvh_hierarchy h) {
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i < 2 * h.num_triangles - 1) {
+        lbvh_write_node(&h, i);
+    }
+}
+
+
+// How many bytes of an arena's frame region build_lbvh_gpu() needs for the given number of triangles
+__host__ size_t lbvh_gpu_scratch_size(int num_triangles) {
+    size_t n = num_triangles;
+    size_t sizes[] = {
+        sizeof(bounding_box) * LBVH_BLOCK_SIZE,                                         // Per-block centroid bounds
+        sizeof(bounding_box),                                                           // All centroid bounds
+        sizeof(uint32_t) * n * 2,                                                       // Codes, and the other half of each sort pass
+        sizeof(int) * n * 2,                                                            // Indices, same
+        sizeof(int) * n,                                                                // Flags
+        sizeof(int) * scan_scratch_count(num_triangles),
+        sizeof(triangle_record) * n,                                                    // Sorted triangles
+        sizeof(int) * n * 5,                                                            // first, last, split, internal_parents, arrival_counts
+        sizeof(bounding_box) * n,                                                       // internal_bounds
+        sizeof(int) * n                                                                 // leaf_parents
+    };
+    size_t total = 0;
+    for (size_t size : sizes) {
+        total += size + 256;                                                            // + 256 for alignment
+    }
+    return total;
+}
+
+
+// Builds an LBVH on the device over the given device triangles (which get rearranged in place, just like with build_lbvh()), writing the flattened
+// tree into nodes (which must have room for 2 * num_triangles - 1 of them)
+// Everything is queued up on the given stream without waiting for any of it. All of the temporary memory comes out of the arena's frame region
+// (lbvh_gpu_scratch_size() says how much is needed), so it is thrown away with the rest of the frame. Returns false if the arena ran out of space
+__host__ bool build_lbvh_gpu(memory_arena* arena, triangle_record* triangles, int num_triangles, bvh_node* nodes, hipStream_t stream) {
+    if (num_triangles == 0) {
+        return true;
+    }
+    int n = num_triangles;
+    int num_blocks = (n + LBVH_BLOCK_SIZE - 1) / LBVH_BLOCK_SIZE;
+    int reduce_blocks = num_blocks < LBVH_BLOCK_SIZE ? num_blocks : LBVH_BLOCK_SIZE;
+
+    arena_region* scratch = &arena->frame;
+    bounding_box* block_bounds = (bounding_box*) arena_allocate(scratch, sizeof(bounding_box) * LBVH_BLOCK_SIZE, 256);
+    bounding_box* centroid_bounds = (bounding_box*) arena_allocate(scratch, sizeof(bounding_box), 256);
+    uint32_t* codes = (uint32_t*) arena_allocate(scratch, sizeof(uint32_t) * n * 2, 256);
+    int* indices = (int*) arena_allocate(scratch, sizeof(int) * n * 2, 256);
+    int* flags = (int*) arena_allocate(scratch, sizeof(int) * n, 256);
+    int* scan_scratch = (int*) arena_allocate(scratch, sizeof(int) * scan_scratch_count(n), 256);
+    lbvh_hierarchy h;
+    h.num_triangles = n;
+    h.triangles = (triangle_record*) arena_allocate(scratch, sizeof(triangle_record) * n, 256);
+    int* node_ints = (int*) arena_allocate(scratch, sizeof(int) * n * 5, 256);
+    h.internal_bounds = (bounding_box*) arena_allocate(scratch, sizeof(bounding_box) * n, 256);
+    h.leaf_parents = (int*) arena_allocate(scratch, sizeof(int) * n, 256);
+    if (block_bounds == nullptr || centroid_bounds == nullptr || codes == nullptr || indices == nullptr || flags == nullptr ||
+        (scan_scratch == nullptr && scan_scratch_count(n) > 0) || h.triangles == nullptr || node_ints == nullptr || h.internal_bounds == nullptr ||
+        h.leaf_parents == nullptr) {
+        return false;
+    }
+    h.first = node_ints;
+    h.last = node_ints + n;
+    h.split = node_ints + 2 * n;
+    h.internal_parents = node_ints + 3 * n;
+    h.arrival_counts = node_ints + 4 * n;
+    h.nodes = nodes;
+
+    // Step 1
+    lbvh_centroid_bounds_kernel<<<
+        dim3(reduce_blocks),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(triangles, n, block_bounds);
+    lbvh_merge_bounds_kernel<<<
+        dim3(1),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(block_bounds, reduce_blocks, centroid_bounds);
+    lbvh_morton_kernel<<<
+        dim3(num_blocks),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(triangles, n, centroid_bounds, codes, indices);
+
+    // Step 2, one bit at a time (LBVH_MORTON_BITS is even, so the result ends up back in the first half of codes and indices)
+    for (int bit = 0; bit < LBVH_MORTON_BITS; bit++) {
+        uint32_t* codes_in = bit % 2 == 0 ? codes : codes + n;
+        int* indices_in = bit % 2 == 0 ? indices : indices + n;
+        uint32_t* codes_out = bit % 2 == 0 ? codes + n : codes;
+        int* indices_out = bit % 2 == 0 ? indices + n : indices;
+        radix_split_flags_kernel<<<
+            dim3(num_blocks),
+            dim3(LBVH_BLOCK_SIZE),
+            0,
+            stream
+        >>>(codes_in, n, bit, flags);
+        gpu_exclusive_scan(flags, n, scan_scratch, stream);
+        radix_split_scatter_kernel<<<
+            dim3(num_blocks),
+            dim3(LBVH_BLOCK_SIZE),
+            0,
+            stream
+        >>>(codes_in, indices_in, codes_out, indices_out, n, bit, flags);
+    }
+    h.codes = codes;
+
+    lbvh_gather_kernel<<<
+        dim3(num_blocks),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(triangles, indices, n, h.triangles);
+
+    // Steps 3 through 5
+    hipMemsetAsync(h.arrival_counts, 0, sizeof(int) * n, stream);
+    hipMemsetAsync(h.internal_parents, 0xFF, sizeof(int) * n, stream);                  // -1, so a single triangle's lone leaf is the root
+    hipMemsetAsync(h.leaf_parents, 0xFF, sizeof(int) * n, stream);
+    lbvh_emit_kernel<<<
+        dim3(num_blocks),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(h);
+    lbvh_bounds_kernel<<<
+        dim3(num_blocks),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(h);
+    lbvh_write_kernel<<<
+        dim3((2 * n - 1 + LBVH_BLOCK_SIZE - 1) / LBVH_BLOCK_SIZE),
+        dim3(LBVH_BLOCK_SIZE),
+        0,
+        stream
+    >>>(h);
+
+    hipMemcpyAsync(triangles, h.triangles, sizeof(triangle_record) * n, hipMemcpyDeviceToDevice, stream);
+    return true;
+}
+
+
+// Compares the LBVH builders against the SAH builder in bvh.cpp for a scene of the given number of random triangles, printing how long each build
+// took and the SAH cost of each tree (lower is better), plus how many of a batch of rays found a different closest hit than with the SAH tree
+// (which should always be 0)
+__host__ void benchmark_lbvh(int num_triangles, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* original_triangles = make_benchmark_triangles(num_triangles, &random_state);
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+    size_t triangles_size = sizeof(triangle_record) * num_triangles;
+    triangle_record* triangles = new triangle_record[num_triangles];
+    int num_threads = std::thread::hardware_concurrency();
+    num_threads = num_threads > 0 ? num_threads : 1;
+
+    // Reference SAH build
+    memcpy(triangles, original_triangles, triangles_size);
+    auto sah_start = std::chrono::high_resolution_clock::now();
+    bvh sah_tree = build_bvh(triangles, num_triangles);
+    auto sah_end = std::chrono::high_resolution_clock::now();
+    collision* reference_hits = new collision[num_rays];
+    for (int i = 0; i < num_rays; i++) {
+        reference_hits[i] = bvh_closest_hit(&rays[i], sah_tree.nodes, sah_tree.num_nodes, triangles, INFINITY);
+    }
+
+    // Host LBVH build
+    memcpy(triangles, original_triangles, triangles_size);
+    auto host_start = std::chrono::high_resolution_clock::now();
+    bvh host_tree = build_lbvh(triangles, num_triangles, num_threads);
+    auto host_end = std::chrono::high_resolution_clock::now();
+    int host_mismatches = count_hit_mismatches(rays, num_rays, reference_hits, host_tree.nodes, host_tree.num_nodes, triangles);
+
+    // Device LBVH build, timed on the GPU without the uploads and downloads around it
+    int num_nodes = 2 * num_triangles - 1;
+    memory_arena arena = create_arena(MEMORY_TARGET_GPU, triangles_size + sizeof(bvh_node) * num_nodes + 512, lbvh_gpu_scratch_size(num_triangles));
+    triangle_record* gpu_triangles = (triangle_record*) arena_allocate(&arena.scene, triangles_size, 256);
+    bvh_node* gpu_nodes = (bvh_node*) arena_allocate(&arena.scene, sizeof(bvh_node) * num_nodes, 256);
+    arena_copy_from_cpu(&arena, gpu_triangles, original_triangles, triangles_size);
+
+    hipStream_t stream;
+    hipEvent_t gpu_start;
+    hipEvent_t gpu_end;
+    hipStreamCreate(&stream);
+    hipEventCreate(&gpu_start);
+    hipEventCreate(&gpu_end);
+    hipEventRecord(gpu_start, stream);
+    bool gpu_built = build_lbvh_gpu(&arena, gpu_triangles, num_triangles, gpu_nodes, stream);
+    hipEventRecord(gpu_end, stream);
+    hipEventSynchronize(gpu_end);
+    float gpu_ms = 0;
+    hipEventElapsedTime(&gpu_ms, gpu_start, gpu_end);
+
+    bvh_node* gpu_tree_nodes = new bvh_node[num_nodes];
+    arena_copy_to_cpu(&arena, gpu_tree_nodes, gpu_nodes, sizeof(bvh_node) * num_nodes);
+    arena_copy_to_cpu(&arena, triangles, gpu_triangles, triangles_size);
+    int gpu_mismatches = count_hit_mismatches(rays, num_rays, reference_hits, gpu_tree_nodes, num_nodes, triangles);
+
+    double sah_ms = std::chrono::duration_cast<std::chrono::microseconds>(sah_end - sah_start).count() / 1000.0;
+    double host_ms = std::chrono::duration_cast<std::chrono::microseconds>(host_end - host_start).count() / 1000.0;
+    printf("lbvh benchmark: %i triangles, %i rays\n", num_triangles, num_rays);
+    printf("  sah (reference): %.3f ms, sah cost %.2f\n", sah_ms, (double) bvh_sah_cost(sah_tree.nodes, sah_tree.num_nodes));
+    printf("  lbvh on host (%i threads): %.3f ms, sah cost %.2f, %i mismatch(es)\n",
+           num_threads, host_ms, (double) bvh_sah_cost(host_tree.nodes, host_tree.num_nodes), host_mismatches);
+    assert(host_mismatches == 0);
+    if (gpu_built) {
+        printf("  lbvh on device: %.3f ms, sah cost %.2f, %i mismatch(es)\n", gpu_ms, (double) bvh_sah_cost(gpu_tree_nodes, num_nodes), gpu_mismatches);
+        assert(gpu_mismatches == 0);
+    }
+
+    hipEventDestroy(gpu_start);
+    hipEventDestroy(gpu_end);
+    hipStreamDestroy(stream);
+    destroy_arena(&arena);
+    delete[] gpu_tree_nodes;
+    delete[] sah_tree.nodes;
+    delete[] host_tree.nodes;
+    delete[] reference_hits;
+    delete[] triangles;
+    delete[] original_triangles;
+    delete[] rays;
+}
@@ -1,216 +1,227 @@
 // A library file with all of the required main structs and their constructors, plus some methods to use on them
 
-// // These are the main, arbitrary structs. Structs designed for a more niche circumstance (such as a collision struct that holds a 
-// collision point vector, a collision triangle, and a collision distance) will be found in the specific_structs.cpp file
+// // These are the main, arbitrary structs. Structs designed for a more niche circumstance (such as a bounding box struct that is only used for 
+// building bounding volume hierarchies) will be found in the specific_structs.cpp file
+
+// The scalar type used for all of the renderer's math (geometry, intersections, colors, and the kernels)
+// Doubles by default, but the GPU we build for (gfx1032, an RDNA2 card) runs double math at a small fraction of the speed of float math, so compiling
+// with -DUSE_FLOAT_PRECISION switches everything over to floats
+#ifdef USE_FLOAT_PRECISION
+typedef float real;
+#else
+typedef double real;
+#endif
 
 // 3D vector with x-, y-, and z-values
-struct vector {
-    double* x = new double[1];
-    double* y = new double[1];
-    double* z = new double[1];
+// The components are stored by value (not as pointers), so a vec3 is trivially copyable: making one, passing one to a function, or returning one
+// never touches the heap, which matters a lot on the GPU where every "new" is slow. Because of that, all of the methods below return a new vec3
+// instead of changing this one
+struct vec3 {
+    real x;
+    real y;
+    real z;
 
-    __device__ __host__ vector() {}              // An empty constructor, only used for when allocating memory for a vector to take up in the future (i.e. 
-                                        // through "new vector[1]") -- same goes for all other empty constructors following
-    
-    __device__ __host__ vector(double _x, double _y, double _z) {
-        *x = _x;
-        *y = _y;
-        *z = _z;
-    }
+    __device__ __host__ vec3() : x(0), y(0), z(0) {}
 
-    __device__ __host__ ~vector() {
-        delete x, y, z;
-    }
+    __device__ __host__ vec3(real _x, real _y, real _z) : x(_x), y(_y), z(_z) {}
 
-    // Makes a deep copy of/clones this vector (where new vector values are totally separate from the this vector's values)
-    __device__ __host__ vector* clone() {
-        return new vector(*x, *y, *z);
+    // Returns the component along the given axis (0 for x, 1 for y, 2 for z)
+    __device__ __host__ real component(int axis) const {
+        return axis == 0 ? x : (axis == 1 ? y : z);
     }
 
-    // Tranforms the given vector by the given matrix
-    __device__ __host__ void transform(double* matrix) {
-        double result[] = {(matrix[0] + matrix[1] + matrix[2]) * *x, 
-                           (matrix[3] + matrix[4] + matrix[5]) * *y,
-                           (matrix[6] + matrix[7] + matrix[8]) * *z};
-        *x = result[0];
-        *y = result[1];
-        *z = result[2];
+    // Transforms this vector by the given 3x3 matrix, where the matrix is stored row by row (matrix[0], matrix[1], matrix[2] is the first row)
+    __device__ __host__ vec3 transform(const real* matrix) const {
+        return vec3((matrix[0] * x) + (matrix[1] * y) + (matrix[2] * z),
+                    (matrix[3] * x) + (matrix[4] * y) + (matrix[5] * z),
+                    (matrix[6] * x) + (matrix[7] * y) + (matrix[8] * z));
     }
 
+    // Returns this vector minus the given vector
+    __device__ __host__ vec3 sub(vec3 v) const {
+        return vec3(x - v.x, y - v.y, z - v.z);
+    }
 
-    // Subtracts the given vector from this vector
-    __device__ __host__ void sub(vector* v) {
-        *x -= *v->x;
-        *y -= *v->y;
-        *z -= *v->z;
+    // Returns this vector plus the given vector
+    __device__ __host__ vec3 add(vec3 v) const {
+        return vec3(x + v.x, y + v.y, z + v.z);
     }
 
-    // Adds the given vector to this vector
-    __device__ __host__ void add(vector* v) {
-        *x += *v->x;
-        *y += *v->y;
-        *z += *v->z;
+    // Returns this vector with every component multiplied by the given scalar
+    __device__ __host__ vec3 scale(real s) const {
+        return vec3(x * s, y * s, z * s);
     }
 
-    // 3D vector rotation methods that rotate this around the given vector center by the given radians, on the respective axis
-    __device__ __host__ void rotate_x(vector* center, double radians) {
-        double sine = sin(radians);
-        double cosine = cos(radians);
+    // 3D vector rotation methods that return this vector rotated around the given vector center by the given radians, on the respective axis
+    __device__ __host__ vec3 rotate_x(vec3 center, real radians) const {
+        real sine = sin(radians);
+        real cosine = cos(radians);
         
-        double transformation_matrix[] = {
+        real transformation_matrix[] = {
             1, 0, 0,
             0, cosine, -sine,
             0, sine, cosine
         };
         
-        sub(center);
-        transform(transformation_matrix);
-        add(center);
+        return sub(center).transform(transformation_matrix).add(center);
     }
 
-    __device__ __host__ void rotate_y(vector* center, double radians) {
-        double sine = sin(radians);
-        double cosine = cos(radians);
+    __device__ __host__ vec3 rotate_y(vec3 center, real radians) const {
+        real sine = sin(radians);
+        real cosine = cos(radians);
         
-        double transformation_matrix[] = {
+        real transformation_matrix[] = {
             cosine, 0, sine,
             0, 1, 0,
             -sine, 0, cosine
         };
         
-        sub(center);
-        transform(transformation_matrix);
-        add(center);
+        return sub(center).transform(transformation_matrix).add(center);
     }
 
-    __device__ __host__ void rotate_z(vector* center, double radians) {
-        double sine = sin(radians);
-        double cosine = cos(radians);
+    __device__ __host__ vec3 rotate_z(vec3 center, real radians) const {
+        real sine = sin(radians);
+        real cosine = cos(radians);
         
-        double transformation_matrix[] = {
+        real transformation_matrix[] = {
             cosine, -sine, 0,
             sine, cosine, 0,
             0, 0, 1
         };
         
-        sub(center);
-        transform(transformation_matrix);
-        add(center);
+        return sub(center).transform(transformation_matrix).add(center);
     }
 
     // Returns the magnitude (or length) of this vector
-    __device__ __host__ double magnitude() {
-        double sum = (*x * *x) + (*y * *y) + (*z * *z);
+    __device__ __host__ real magnitude() const {
+        real sum = (x * x) + (y * y) + (z * z);
         return sqrt(sum);
     }
 
-    // Shortens this vector to a length of 1
-    __device__ __host__ void normalize() {
-        double mag = magnitude();
-        *x /= mag;
-        *y /= mag;
-        *z /= mag;
+    // Returns this vector shortened (or lengthened) to a length of 1
+    __device__ __host__ vec3 normalize() const {
+        real mag = magnitude();
+        return vec3(x / mag, y / mag, z / mag);
     }
 
     // Returns the dot product of the given vector and this vector
-    __device__ __host__ double dot(vector* v) {
-        return (*x * *v->x) + (*y * *v->y) + (*z * *v->z);
+    __device__ __host__ real dot(vec3 v) const {
+        return (x * v.x) + (y * v.y) + (z * v.z);
     }
 
     // Returns the cross product of the this vector and the given vector
-    __device__ __host__ vector* cross(vector* v) {
-        vector* result = new vector((*y * *v->z) - (*z * *v->y),
-                                    (*z * *v->x) - (*x * *v->z),
-                                    (*x * *v->y) - (*y * *v->x));
-        return result;
+    __device__ __host__ vec3 cross(vec3 v) const {
+        return vec3((y * v.z) - (z * v.y),
+                    (z * v.x) - (x * v.z),
+                    (x * v.y) - (y * v.x));
     }
 };
 
 // RGB color with values between 0-1 (no alpha)
 struct color {
-    double* r = new double[1];
-    double* g = new double[1];
-    double* b = new double[1];
-
-    __device__ __host__ color() {}
+    real r;
+    real g;
+    real b;
 
-    __device__ __host__ color(double _r, double _g, double _b) {
-        *r = _r;
-        *g = _g;
-        *b = _b;
-    }
+    __device__ __host__ color() : r(0), g(0), b(0) {}
 
-    __device__ __host__ ~color() {
-        delete r, g, b;
-    }
+    __device__ __host__ color(real _r, real _g, real _b) : r(_r), g(_g), b(_b) {}
 };
 
 // A template for a material with different parameters that control how the material interacts with light (used in calculating BRDFs)
 struct material {
-    color* material_color = new color[1];
-    double* diffusion = new double[1];
-    double* reflection = new double[1];
-    double* refraction = new double[1];
+    color material_color;
+    real diffusion;
+    real reflection;
+    real refraction;
+
+    __device__ __host__ material() : diffusion(0), reflection(0), refraction(0) {}
 
-    __device__ __host__ material() {}
+    __device__ __host__ material(color _material_color, real _diffusion, real _reflection, real _refraction)
+        : material_color(_material_color), diffusion(_diffusion), reflection(_reflection), refraction(_refraction) {}
 
-    __device__ __host__ material(color* _material_color, double _diffusion, double _reflection, double _refraction) {
-        material_color = _material_color;
-        *diffusion = _diffusion;
-        *reflection = _reflection;
-        *refraction = _refraction;
+    // Returns true if every parameter of the given material is the same as this one's
+    __device__ __host__ bool equals(material m) const {
+        return material_color.r == m.material_color.r && material_color.g == m.material_color.g && material_color.b == m.material_color.b &&
+               diffusion == m.diffusion && reflection == m.reflection && refraction == m.refraction;
     }
+};
 
-    __device__ __host__ ~material() {
-        delete material_color, diffusion, reflection, refraction;
+// A scene-wide list of materials, where every distinct material is only stored once, and triangles refer to their material by its (16-bit) index 
+// into the list instead of each holding a whole copy of it
+// Materials are deduplicated when they are added, so adding the same material a thousand times still only stores it once
+struct material_table {
+    int num_materials;
+    int capacity;
+    material* materials;
+
+    static const int max_materials = 65536;            // The most materials that can be told apart with a 16-bit index
+
+    __host__ material_table() : num_materials(0), capacity(0), materials(nullptr) {}
+
+    __host__ ~material_table() {
+        delete[] materials;
+    }
+
+    // Adds the given material to the table if it isn't already in it, and returns its index either way
+    __host__ uint16_t add(material m) {
+        for (int i = 0; i < num_materials; i++) {
+            if (materials[i].equals(m)) {
+                return (uint16_t) i;
+            }
+        }
+
+        assert(num_materials < max_materials);
+        if (num_materials == capacity) {
+            // Out of space, so doubling the size of the list (like a std::vector does)
+            int new_capacity = capacity == 0 ? 8 : capacity * 2;
+            material* new_materials = new material[new_capacity];
+            for (int i = 0; i < num_materials; i++) {
+                new_materials[i] = materials[i];
+            }
+            delete[] materials;
+            materials = new_materials;
+            capacity = new_capacity;
+        }
+
+        materials[num_materials] = m;
+        num_materials++;
+        return (uint16_t) (num_materials - 1);
     }
 };
 
 // A 3D plane with components a, b, c, d, expressed by equation ax + by + cz + d = 0
 struct plane {
-    vector* normal = new vector[1];                     // vector to store the components of the plane's normal as (a, b, c)
-    double* d = new double[1];
+    vec3 normal;                                        // vector to store the components of the plane's normal as (a, b, c)
+    real d;
 
-    __device__ __host__ plane() {}
+    __device__ __host__ plane() : d(0) {}
 
-    __device__ __host__ plane(vector* _normal, double _d) {
-        normal = _normal;
-        *d = _d;
-    }
-
-    __device__ __host__ ~plane() {
-        delete normal, d;
-    }
+    __device__ __host__ plane(vec3 _normal, real _d) : normal(_normal), d(_d) {}
 };
 
 // A 3D Ray that starts from the 3D point origin and points in the direction given by the direction vector
 struct ray {
-    vector* origin = new vector[1];
-    vector* direction = new vector[1];
+    vec3 origin;
+    vec3 direction;
 
     __device__ __host__ ray() {}
 
-    __device__ __host__ ray(vector* _origin, vector* _direction) {
-        origin = _origin;
-        direction = _direction;
-    }
-
-    __device__ __host__ ~ray() {
-        delete origin, direction;
-    }
+    __device__ __host__ ray(vec3 _origin, vec3 _direction) : origin(_origin), direction(_direction) {}
 };
 
 // A 3D triangle defined by the 3 vectors a, b, and c, with the given material and plane
 struct triangle {
-    plane* surface_plane = new plane[1];               // the 3D plane that the triangle sits on
-    material* surface_material = new material[1];         // the material that the triangle is "made out of," defining how light rays should interact with the triangle
-    vector* a = new vector[1];
-    vector* b = new vector[1];
-    vector* c = new vector[1];
+    plane surface_plane;                                  // the 3D plane that the triangle sits on
+    material* surface_material = nullptr;                 // the material that the triangle is "made out of," defining how light rays should interact with the triangle
+                                                          // (not owned by the triangle, since many triangles can share the same material)
+    vec3 a;
+    vec3 b;
+    vec3 c;
 
     __device__ __host__ triangle() {}
 
-    __device__ __host__ triangle(plane* _surface_plane, material* _surface_material, vector* _a, vector* _b, vector* _c) {
+    __device__ __host__ triangle(plane _surface_plane, material* _surface_material, vec3 _a, vec3 _b, vec3 _c) {
         surface_plane = _surface_plane;
         surface_material = _surface_material;
         a = _a;
@@ -219,7 +230,7 @@ struct triangle {
     }
 
     // Alternate triangle constructor that doesn't require a plane
-    __device__ __host__ triangle(material* _surface_material, vector* _a, vector* _b, vector* _c) {
+    __device__ __host__ triangle(material* _surface_material, vec3 _a, vec3 _b, vec3 _c) {
         // Setting the struct's members
         surface_material = _surface_material;
         a = _a;
@@ -230,95 +241,224 @@ struct triangle {
         // Here we are taking the cross product of the vectors that make up two of the legs of the triangle to find the normal of the plane that the 
         // triangle sits on, because both of them are by definition situated on the same plane as the triangle, to find a vector that is parallel to both, 
         // which is equivalent to the normal of the plane
-        vector* ab = a->clone();
-        vector* bc = b->clone();
-        ab->sub(b);
-        bc->sub(c);
+        vec3 ab = a.sub(b);
+        vec3 bc = b.sub(c);
 
-        vector* plane_normal = ab->cross(bc);
-        plane_normal->normalize();                                                           // Normalizing to help with calculations
+        vec3 plane_normal = ab.cross(bc).normalize();                                       // Normalizing to help with calculations
         
         // Now we need to calculate the shift of the plane, aka d in the plane's equation
         // We do this by substituting in the coordinates for a known point that lies on the plane. What points do we know? Well, any of the 3 vertices of 
         // the triangle will work, because they define the plane of the triangle so they by definition lie on it
-        double* plane_a = plane_normal->x;
-        double* plane_b = plane_normal->y;
-        double* plane_c = plane_normal->z;
-
-        double* x0 = a->x;
-        double* y0 = a->y;
-        double* z0 = a->z;
-
-        double d = -((*plane_a * *x0) + (*plane_b * *y0) + (*plane_c * *z0));               // We are making the shift negative here because of how the 
+        real d = -plane_normal.dot(a);                                                      // We are making the shift negative here because of how the 
                                                                                             // plane equation is arranged (in this code, at least): ax + 
                                                                                             // by + cz + d = 0, where we are plugging in known values for 
                                                                                             // ax, by, and cz, and solving for d
-        surface_plane = new plane(plane_normal, d);
+        surface_plane = plane(plane_normal, d);
+    }
+};
+
+// Structure-of-arrays (SoA) storage for a whole list of triangles, used by the kernels instead of an array of triangle pointers
+// With triangle** every triangle, and every vertex inside of it, is its own allocation, so reading one vertex means following a chain of pointers
+// that each have to be loaded one after the other. Here every coordinate gets its own contiguous array instead (all of the v0 x-values next to each 
+// other, then all of the v0 y-values, and so on), so triangle i is just index i into each array and threads reading neighboring triangles read 
+// neighboring memory (coalesced loads)
+// Built once on the host from the existing triangle structs using triangle_soa_from_triangles(), then packed into the scene with pack_scene() and
+// sent to the GPU with upload_scene() (see scene_packing.cpp). Its arrays are freed with destroy_triangle_soa()
+struct triangle_soa {
+    int num_triangles;
+
+    // Vertex a of each triangle
+    real* v0_x;
+    real* v0_y;
+    real* v0_z;
+
+    // Vertex b of each triangle
+    real* v1_x;
+    real* v1_y;
+    real* v1_z;
+
+    // Vertex c of each triangle
+    real* v2_x;
+    real* v2_y;
+    real* v2_z;
+
+    uint16_t* material_index;           // The index into materials of the material each triangle is made out of
+    
+    int num_materials;
+    material* materials;                // Every distinct material used by the triangles (a copy of a material_table's list), only stored once no 
+                                        // matter how many triangles use it
+
+    __device__ __host__ triangle_soa() {}
+
+    // Allocates (but doesn't fill) all of the arrays needed to hold the given number of triangles and materials
+    __host__ triangle_soa(int _num_triangles, int _num_materials) {
+        num_triangles = _num_triangles;
+        num_materials = _num_materials;
+
+        v0_x = new real[num_triangles];
+        v0_y = new real[num_triangles];
+        v0_z = new real[num_triangles];
+        v1_x = new real[num_triangles];
+        v1_y = new real[num_triangles];
+        v1_z = new real[num_triangles];
+        v2_x = new real[num_triangles];
+        v2_y = new real[num_triangles];
+        v2_z = new real[num_triangles];
+        material_index = new uint16_t[num_triangles];
+        materials = new material[num_materials];
+    }
+
+    // Reads the vertices of the triangle at the given index back out of the arrays
+    __device__ __host__ vec3 get_a(int index) {
+        return vec3(v0_x[index], v0_y[index], v0_z[index]);
+    }
 
-        // Deleting local variables to free memory
-        delete plane_a, plane_b, plane_c, x0, y0, z0, ab, bc;
+    __device__ __host__ vec3 get_b(int index) {
+        return vec3(v1_x[index], v1_y[index], v1_z[index]);
     }
 
-    __device__ __host__ ~triangle() {
-        delete surface_plane, surface_material, a, b, c;
+    __device__ __host__ vec3 get_c(int index) {
+        return vec3(v2_x[index], v2_y[index], v2_z[index]);
     }
 };
 
-// A container to hold the height and width of an image (or anything else with height and width)
-struct dimensions {
-    int* width = new int[1];
-    int* height = new int[1];
+// Frees all of the arrays of the given triangle_soa (but not the triangle_soa itself, which may not have been made with "new")
+__host__ void destroy_triangle_soa(triangle_soa* triangles) {
+    delete[] triangles->v0_x;
+    delete[] triangles->v0_y;
+    delete[] triangles->v0_z;
+    delete[] triangles->v1_x;
+    delete[] triangles->v1_y;
+    delete[] triangles->v1_z;
+    delete[] triangles->v2_x;
+    delete[] triangles->v2_y;
+    delete[] triangles->v2_z;
+    delete[] triangles->material_index;
+    delete[] triangles->materials;
+}
+
+// Takes a list of triangle structs and copies them into a new triangle_soa
+// Materials go through a material_table, so triangles with equal materials share the same material index even if they point to different 
+// material structs
+__host__ triangle_soa* triangle_soa_from_triangles(triangle** triangles, int num_tris) {
+    // Finding all of the distinct materials first, so that we know how much space the material list needs
+    material_table table;
+    uint16_t* material_indices = new uint16_t[num_tris];
+    for (int i = 0; i < num_tris; i++) {
+        material_indices[i] = table.add(*triangles[i]->surface_material);
+    }
+
+    triangle_soa* result = new triangle_soa(num_tris, table.num_materials);
+    for (int i = 0; i < num_tris; i++) {
+        triangle* curr_tri = triangles[i];
+        result->v0_x[i] = curr_tri->a.x;
+        result->v0_y[i] = curr_tri->a.y;
+        result->v0_z[i] = curr_tri->a.z;
+        result->v1_x[i] = curr_tri->b.x;
+        result->v1_y[i] = curr_tri->b.y;
+        result->v1_z[i] = curr_tri->b.z;
+        result->v2_x[i] = curr_tri->c.x;
+        result->v2_y[i] = curr_tri->c.y;
+        result->v2_z[i] = curr_tri->c.z;
+        result->material_index[i] = material_indices[i];
+    }
+    for (int i = 0; i < table.num_materials; i++) {
+        result->materials[i] = table.materials[i];
+    }
+
+    delete[] material_indices;
+    return result;
+}
 
-    __device__ __host__ dimensions() {}
+// A compact, precomputed version of a triangle holding exactly what the intersection test needs and nothing else, made once when the scene is 
+// loaded (see build_triangle_records()) so that the kernel never has to rebuild a triangle's plane or follow any pointers to test it
+// Instead of the three vertices, it stores one vertex and the two edges leaving it (the other two vertices are just v0 + e1 and v0 + e2), which is
+// the form that the intersection math actually uses. The alignment rounds each record up to 64 bytes with floats (exactly one cache line) or 
+// 128 bytes with doubles (exactly two), so that a record never straddles more cache lines than it has to
+struct alignas(16 * sizeof(real)) triangle_record {
+    vec3 v0;                            // Vertex a
+    vec3 e1;                            // The edge from a to b (b - a)
+    vec3 e2;                            // The edge from a to c (c - a)
+    vec3 normal;                        // The normalized geometric normal of the triangle (the normal of the plane it sits on)
+    uint16_t material_index;            // The index of the triangle's material in the scene's material list
+    int source_index;                   // The index the triangle had in the list it was made from, which stays the same when a BVH builder 
+                                        // rearranges the records (fits in the padding the alignment adds anyway, so it costs no space)
+};
+
+// Makes the record for the triangle with vertices a, b, and c
+__device__ __host__ triangle_record make_triangle_record(vec3 a, vec3 b, vec3 c, uint16_t material_index, int source_index) {
+    triangle_record record;
+    record.v0 = a;
+    record.e1 = b.sub(a);
+    record.e2 = c.sub(a);
+    record.normal = record.e1.cross(record.e2).normalize();
+    record.material_index = material_index;
+    record.source_index = source_index;
+    return record;
+}
 
-    __device__ __host__ dimensions(int _width, int _height) {
-        *width = _width;
-        *height = _height;
+// Makes the triangle record for each triangle in the given triangle_soa
+__host__ triangle_record* build_triangle_records(triangle_soa* triangles) {
+    triangle_record* records = new triangle_record[triangles->num_triangles];
+    for (int i = 0; i < triangles->num_triangles; i++) {
+        records[i] = make_triangle_record(triangles->get_a(i), triangles->get_b(i), triangles->get_c(i), triangles->material_index[i], i);
     }
+    return records;
+}
 
-    __device__ __host__ ~dimensions() {
-        delete width, height;
+// The other way around: makes a triangle_soa with room for the given number of materials (which are left for the caller to fill in) out of the
+// given triangle records, with each triangle keeping its record's material index
+__host__ triangle_soa triangle_soa_from_records(triangle_record* records, int num_triangles, int num_materials) {
+    triangle_soa result(num_triangles, num_materials);
+    for (int i = 0; i < num_triangles; i++) {
+        vec3 b = records[i].v0.add(records[i].e1);
+        vec3 c = records[i].v0.add(records[i].e2);
+        result.v0_x[i] = records[i].v0.x;
+        result.v0_y[i] = records[i].v0.y;
+        result.v0_z[i] = records[i].v0.z;
+        result.v1_x[i] = b.x;
+        result.v1_y[i] = b.y;
+        result.v1_z[i] = b.z;
+        result.v2_x[i] = c.x;
+        result.v2_y[i] = c.y;
+        result.v2_z[i] = c.z;
+        result.material_index[i] = records[i].material_index;
     }
+    return result;
+}
+
+// A container to hold the height and width of an image (or anything else with height and width)
+struct dimensions {
+    int width;
+    int height;
+
+    __device__ __host__ dimensions() : width(0), height(0) {}
+
+    __device__ __host__ dimensions(int _width, int _height) : width(_width), height(_height) {}
 };
 
 // 3D camera, defines where the camera rays originate and in which direction they radiate, to control where the viewport is looking
 struct camera {
-    vector* origin = new vector[1];     // The 3D point where all camera rays originate from
-    vector* rotation = new vector[1];   // The direction where camera rays radiate from the origin, with components (x_rotation, y_rotation, 
+    vec3 origin;                        // The 3D point where all camera rays originate from
+    vec3 rotation;                      // The direction where camera rays radiate from the origin, with components (x_rotation, y_rotation, 
     // z_rotation)
-    double* fov_scale = new double[1];  // The field-of-view parameters, expressed in radians, that define how far left/right or up/down the camera 
+    real fov_scale;                     // The field-of-view parameters, expressed in radians, that define how far left/right or up/down the camera 
     // can see
 
-    __device__ __host__ camera() {}
+    __device__ __host__ camera() : fov_scale(0) {}
 
-    __device__ __host__ camera(vector* _origin, vector* _rotation, double _fov_scale) {
-        origin = _origin;
-        rotation = _rotation;
-        *fov_scale = _fov_scale;
-    }
-
-    __device__ __host__ ~camera() {
-        delete origin, rotation, fov_scale;
-    }
+    __device__ __host__ camera(vec3 _origin, vec3 _rotation, real _fov_scale) : origin(_origin), rotation(_rotation), fov_scale(_fov_scale) {}
 };
 
 // 3D point-source light with color, position, and intensity
 struct light {
-    vector* position = new vector[1];
-    color* rgb = new color[1];
-    double* intensity = new double[1];
+    vec3 position;
+    color rgb;
+    real intensity;
 
-    __device__ __host__ light() {}
+    __device__ __host__ light() : intensity(0) {}
 
-    __device__ __host__ light(vector* _position, color* _rgb, double _intensity) {
-        position = _position;
-        rgb = _rgb;
-        *intensity = _intensity;
-    }
-
-    __device__ __host__ ~light() {
-        delete position, rgb, intensity;
-    }
+    __device__ __host__ light(vec3 _position, color _rgb, real _intensity) : position(_position), rgb(_rgb), intensity(_intensity) {}
 };
 
 
@@ -330,10 +470,10 @@ struct light {
 // aligned with the triangle leg vectors that we are checking).
 // Basic intuition is to imagine walking clockwise along the outside of the triangle, and if the point being checked stays on your righthand side the
 // entire time you are walking, then it must be inside the triangle and not outside
-__device__ bool contains(double i, double j, double x1, double y1, double x2, double y2, double x3, double y3) {
-    double dotAB = -(i - y1) * (x2 - x1) + (j - x1) * (y2 - y1);
-    double dotBC = -(i - y2) * (x3 - x2) + (j - x2) * (y3 - y2);
-    double dotCA = -(i - y3) * (x1 - x3) + (j - x3) * (y1 - y3);
+__device__ __host__ bool contains(real i, real j, real x1, real y1, real x2, real y2, real x3, real y3) {
+    real dotAB = -(j - y1) * (x2 - x1) + (i - x1) * (y2 - y1);
+    real dotBC = -(j - y2) * (x3 - x2) + (i - x2) * (y3 - y2);
+    real dotCA = -(j - y3) * (x1 - x3) + (i - x3) * (y1 - y3);
     
     bool allPos = dotAB >= 0 && dotBC >= 0 && dotCA >= 0;
     bool allNeg = dotAB <= 0 && dotBC <= 0 && dotCA <= 0;
@@ -343,10 +483,10 @@ __device__ bool contains(double i, double j, double x1, double y1, double x2, do
 
 // Same method as above using pointers to save memory on unnecessary variable declarations (hopefully -- I'm not too familiar with C++ still so I'm not
 // sure if this is actually helping or hurting or if the compiler figures it all out no matter what and it's really the same either way)
-__device__ bool contains(double* i, double* j, double* x1, double* y1, double* x2, double* y2, double* x3, double* y3) {
-    double dotAB = -(*i - *y1) * (*x2 - *x1) + (*j - *x1) * (*y2 - *y1);
-    double dotBC = -(*i - *y2) * (*x3 - *x2) + (*j - *x2) * (*y3 - *y2);
-    double dotCA = -(*i - *y3) * (*x1 - *x3) + (*j - *x3) * (*y1 - *y3);
+__device__ __host__ bool contains(real* i, real* j, real* x1, real* y1, real* x2, real* y2, real* x3, real* y3) {
+    real dotAB = -(*j - *y1) * (*x2 - *x1) + (*i - *x1) * (*y2 - *y1);
+    real dotBC = -(*j - *y2) * (*x3 - *x2) + (*i - *x2) * (*y3 - *y2);
+    real dotCA = -(*j - *y3) * (*x1 - *x3) + (*i - *x3) * (*y1 - *y3);
     
     bool allPos = dotAB >= 0 && dotBC >= 0 && dotCA >= 0;
     bool allNeg = dotAB <= 0 && dotBC <= 0 && dotCA <= 0;
@@ -355,137 +495,226 @@ __device__ bool contains(double* i, double* j, double* x1, double* y1, double* x
 }
 
 
-// Returns the t-value (or distance) where the given ray intersects the given plane
-// If an intersection point exists, has_intersection will be set to true, otherwise (i.e. if plane is behind ray or if plane and ray are parallel),
-// has_intersection will be set to false (if there is no intersection, the function will also return 0)
+// The result of a single intersection test, returned by value so that nothing about a hit ever needs to be allocated
+// If has_collision is false, none of the other values mean anything
+struct collision {
+    bool has_collision;
+    real collision_distance;            // The t-value along the ray where the hit happened (the actual distance if the ray's direction is normalized)
+    vec3 collision_point;
+    int triangle_index;                 // The index of the triangle that was hit, or -1 if the test wasn't against an indexed triangle
+    int instance_index;                 // The index of the mesh instance that was hit, or -1 if the scene isn't instanced (see instancing.cpp)
+    real barycentric_u;                 // Where on the triangle the hit is, as the weights of its second and third vertices (the first vertex's
+    real barycentric_v;                 // weight is 1 - u - v), for interpolating anything stored per vertex. Not set by the original test
+
+    __device__ __host__ collision() : has_collision(false), collision_distance(0), triangle_index(-1), instance_index(-1), barycentric_u(0),
+                                      barycentric_v(0) {}
+};
+
+
+// Gets the 3D point from a ray at a given t value (where the ray equation is O + vt, where O is the ray origin and v is the ray's direction -- this
+// function just plugs in a given t and returns the 3D point that results from the equation)
+__device__ __host__ vec3 get_point_from_t(ray* r, real t) {
+    return r->origin.add(r->direction.scale(t));
+}
+
+
+// Returns where the given ray intersects the given plane
+// If an intersection point exists, has_collision will be true, otherwise (i.e. if plane and ray are parallel) has_collision will be false
 // To find the intersection point, we need to plug in the ray components (parameterized using the parameter t) into the plane equation and solve.
 // For the ray components to be "paramaterized," it means that the origin and direction x-, y-, and z-values are expressed in terms of a constant "t."
 // Changing this "t" constant gives x-, y-, and z-values corresponding to the point along the ray that is equal to origin + t * direction.
 // To express x-, y-, and z-values in terms of t: x = x0 + xt, y = y0 + yt, and z = z0 + zt, where (x0, y0, z0) is the origin and (xt, yt, zt) is the
 // direction of the ray. Substituting these into the plane's equation ax + by + cz + d = 0 and solving gives us the intersection point.
-__device__ double* ray_plane_intersection_t(ray* r, plane* p, bool* has_intersection) {
-    if (r->direction->dot(p->normal) == 0) {
-        *has_intersection = false;
-        return 0;
-    } else {
-        *has_intersection = true;
-    }
-    double* a = p->normal->x;
-    double* b = p->normal->y;
-    double* c = p->normal->z;
-    double* d = p->d;
-
-    double* x0 = r->origin->x;
-    double* y0 = r->origin->y;
-    double* z0 = r->origin->z;
-    
-    double* xt = r->direction->x;
-    double* yt = r->direction->y;
-    double* zt = r->direction->z;
-
+__device__ __host__ collision ray_plane_intersection_t(ray* r, plane* p) {
+    collision result;
     
-    double left = (*a * *xt) + (*b * *yt) + (*c * *zt);              // The total t-values added up in the ray-plane equation being solved -- this 
+    real left = p->normal.dot(r->direction);                            // The total t-values added up in the ray-plane equation being solved -- this 
                                                                         // is negative because we are subtracting the values from the left side of the 
                                                                         // equation to the right side of the equation
-    double right = -((*a * *x0) + (*b * *y0) + (*c * *z0) + *d);           // The total constants added up in the ray-plane equation being solved
-                                                                        
-                                                                        
-
-    double* result = new double[1];
-    result[0] = right / left;
-    return result;                                                     // After the last step, the equation is something like c = kt, where c and k are some given constants, and 
-                                                                        // we need to isolate t so we divide both sides by k to get t = c / k
-}
-
+    if (left == 0) {
+        return result;
+    }
+    real right = -(p->normal.dot(r->origin) + p->d);                   // The total constants added up in the ray-plane equation being solved
 
-// Gets the 3D point from a ray at a given t value (where the ray equation is O + vt, where O is the ray origin and v is the ray's direction -- this
-// function just plugs in a given t and returns the 3D point that results from the equation)
-__device__ vector* get_point_from_t(ray* r, double* t) {
-    vector* origin = r->origin;
-    vector* direction = r->direction;
-    vector* result = new vector(*origin->x + (*direction->x * *t),
-                                *origin->y + (*direction->y * *t),
-                                *origin->z + (*direction->z * *t));
+    result.has_collision = true;
+    result.collision_distance = right / left;                           // After the last step, the equation is something like c = kt, where c and k 
+                                                                        // are some given constants, and we need to isolate t so we divide both sides 
+                                                                        // by k to get t = c / k
+    result.collision_point = get_point_from_t(r, result.collision_distance);
     return result;
 }
 
 
-// In the future, will use the Möller–Trumbore ray-triangle intersection algorithm, actually much simpler than I had previously thought.
-// https://en.wikipedia.org/wiki/Möller–Trumbore_intersection_algorithm
-// Basically, instead of using a precalculated plane normal for the plane the given triangle sits on, we express the plane in terms of two of the 
-// vectors that make up the legs of the triangle.
-// By scaling these two leg vectors by the barycentric coordinates u and v of the triangle, we can essentially use them as basis vectors for the plane,
-// and describe any point on the plane with just u and v.
-// My explanation here is very lacking as I have just started understanding the Möller–Trumbore algorithm, so if you want more depth look at the linked
-// Wikipedia page, it explains much better than I can with just code comments.
-// As of now, still using same algorithm as above then just doing bounds-checking to see if the intersection point we find is inside the triangle
-// With this method, however, we return the actual coordinates of the 3D collision point (if it exists) and we return the t value of the collision 
-// through the t_out argument
-__device__ vector* ray_triangle_intersection_t(ray* r, triangle* t, bool* has_intersection, double* t_out) {
-    plane* p = t->surface_plane;
-    
-    if (r->direction->dot(p->normal) == 0) {
-        *has_intersection = false;
-        vector* result = new vector(0, 0, 0);
-        *t_out = 0;
+// The original ray-triangle test: intersects the ray with the triangle's plane, then checks whether the hit point is inside the triangle when both
+// are seen from straight above (in x and y only). That only works as long as the triangle doesn't look squashed from above: the more it faces
+// sideways, the more rounding throws the check off, and for a vertical triangle (which looks like a line from above) it finds hits that aren't
+// there. It also works out the plane hit and the hit point before it can reject anything. Only kept around for the triangle struct and to check
+// the newer tests against (see benchmark_triangle_intersection())
+__device__ __host__ collision ray_triangle_intersection_t(ray* r, plane* p, vec3 a, vec3 b, vec3 c) {
+    collision result = ray_plane_intersection_t(r, p);
+    if (!result.has_collision) {
         return result;
     }
 
-    double* a = p->normal->x;
-    double* b = p->normal->y;
-    double* c = p->normal->z;
-    double* d = p->d;
+    vec3 point = result.collision_point;
+    if (!contains(point.x, point.y, a.x, a.y, b.x, b.y, c.x, c.y)) {
+        return collision();
+    }
+    return result;
+}
 
-    double* x0 = r->origin->x;
-    double* y0 = r->origin->y;
-    double* z0 = r->origin->z;
-    
-    double* xt = r->direction->x;
-    double* yt = r->direction->y;
-    double* zt = r->direction->z;
 
-    
-    double left = (*a * *xt) + (*b * *yt) + (*c * *zt);             // The total t-values added up in the ray-plane equation being solved -- this 
-                                                                        // is negative because we are subtracting the values from the left side of the 
-                                                                        // equation to the right side of the equation
-    double right = -((*a * *x0) + (*b * *y0) + (*c * *z0) + *d);          // The total constants added up in the ray-plane equation being solved
-                                                                        
-                                                                        
+__device__ __host__ collision ray_triangle_intersection_t(ray* r, triangle* t) {
+    return ray_triangle_intersection_t(r, &t->surface_plane, t->a, t->b, t->c);
+}
 
 
-    *t_out = right / left;                                             // After the last step, the equation is something like c = kt, where c and k 
-                                                                        // are some given constants, and we need to isolate t so we divide both sides 
-                                                                        // by k to get t = c / k
-    // Now we need to find the collision point's coordinates in 3D and 
-    vector* collision_point = get_point_from_t(r, t_out);
-
-    double* x1 = t->a->x;
-    double* y1 = t->a->y;
-    double* x2 = t->b->x;
-    double* y2 = t->b->y;
-    double* x3 = t->c->x;
-    double* y3 = t->c->y;
-    
-    double* i = collision_point->x;
-    double* j = collision_point->y;
+// The original test from above, for a precomputed triangle record (with the given index, which is saved in the collision)
+__device__ __host__ collision ray_triangle_intersection_xy(ray* r, triangle_record* tri, int index) {
+    plane p = plane(tri->normal, -tri->normal.dot(tri->v0));
+
+    collision result = ray_triangle_intersection_t(r, &p, tri->v0, tri->v0.add(tri->e1), tri->v0.add(tri->e2));
+    if (result.has_collision) {
+        result.triangle_index = index;
+    }
+    return result;
+}
+
+
+// The Möller–Trumbore ray-triangle test (https://en.wikipedia.org/wiki/Möller–Trumbore_intersection_algorithm), which only counts hits with a
+// t-value between 0 and t_max (so that a closest-hit loop can pass its closest hit so far and have everything behind it thrown out early)
+// Any point on the triangle's plane can be written as v0 + u * e1 + v * e2, and the point is inside the triangle exactly when u >= 0, v >= 0, and
+// u + v <= 1 (u and v are the barycentric coordinates of b and c). Setting that equal to origin + t * direction gives three equations in t, u,
+// and v, which Cramer's rule solves with a handful of cross and dot products -- and u gets checked before v and t are even worked out, so most
+// misses are thrown out after a single dot product past the setup. No plane, no normal, and no hit point are needed
+__device__ __host__ collision ray_triangle_intersection_moller_trumbore(ray* r, triangle_record* tri, int index, real t_max) {
+    collision result;
+    vec3 p = r->direction.cross(tri->e2);
+    real determinant = tri->e1.dot(p);
+    if (determinant == 0) {
+        return result;                                                                  // The ray is parallel to the triangle
+    }
+    real inverse_determinant = 1 / determinant;
+
+    vec3 s = r->origin.sub(tri->v0);
+    real u = s.dot(p) * inverse_determinant;
+    if (u < 0 || u > 1) {
+        return result;
+    }
+    vec3 q = s.cross(tri->e1);
+    real v = r->direction.dot(q) * inverse_determinant;
+    if (v < 0 || u + v > 1) {
+        return result;
+    }
+    real t = tri->e2.dot(q) * inverse_determinant;
+    if (t <= 0 || t >= t_max) {
+        return result;
+    }
 
-    *has_intersection = contains(i, j, x1, y1, x2, y2, x3, y3);
+    result.has_collision = true;
+    result.collision_distance = t;
+    result.collision_point = get_point_from_t(r, t);
+    result.barycentric_u = u;
+    result.barycentric_v = v;
+    result.triangle_index = index;
+    return result;
+}
 
-    if (*has_intersection) {
-        return collision_point;
-    } else {
-        vector* result = new vector(0, 0, 0);
-        *t_out = 0;
+
+// The watertight ray-triangle test (Woop, Benthin, and Wald, "Watertight Ray/Triangle Intersection", 2013), with the same results as
+// ray_triangle_intersection_moller_trumbore() except right on the triangle's edges
+// Möller–Trumbore can let a ray slip through the crack between two triangles that share an edge, since rounding can make both of them say the
+// ray is just outside. Here, everything is first moved so the ray starts at the origin and sheared so that it points straight along its biggest
+// axis, which turns the test into a 2D one: the ray is inside the triangle if the three edge functions (twice the signed areas of the triangles
+// between the ray and each edge) all have the same sign. Two triangles sharing an edge work out that edge's function from the exact same
+// numbers in the exact same order, just with the opposite sign, so a ray can't miss both (or, as long as the records were made from the same
+// vertices, see make_triangle_record(), since v1 and v2 are rebuilt here as v0 + e1 and v0 + e2)
+__device__ __host__ collision ray_triangle_intersection_watertight(ray* r, triangle_record* tri, int index, real t_max) {
+    collision result;
+
+    // Picking the axis the ray goes along the most as the new z, and the other two as x and y (swapped if needed to keep the winding the same)
+    vec3 d = r->direction;
+    real abs_x = fabs(d.x);
+    real abs_y = fabs(d.y);
+    real abs_z = fabs(d.z);
+    int kz = abs_x > abs_y ? (abs_x > abs_z ? 0 : 2) : (abs_y > abs_z ? 1 : 2);
+    int kx = kz == 2 ? 0 : kz + 1;
+    int ky = kx == 2 ? 0 : kx + 1;
+    real d_z = d.component(kz);
+    if (d_z < 0) {
+        int temp = kx;
+        kx = ky;
+        ky = temp;
+    }
+    real shear_x = d.component(kx) / d_z;
+    real shear_y = d.component(ky) / d_z;
+    real shear_z = 1 / d_z;
+
+    // The vertices relative to the ray's origin, sheared so that the ray points straight along z
+    vec3 a = tri->v0.sub(r->origin);
+    vec3 b = tri->v0.add(tri->e1).sub(r->origin);
+    vec3 c = tri->v0.add(tri->e2).sub(r->origin);
+    real a_x = a.component(kx) - shear_x * a.component(kz);
+    real a_y = a.component(ky) - shear_y * a.component(kz);
+    real b_x = b.component(kx) - shear_x * b.component(kz);
+    real b_y = b.component(ky) - shear_y * b.component(kz);
+    real c_x = c.component(kx) - shear_x * c.component(kz);
+    real c_y = c.component(ky) - shear_y * c.component(kz);
+
+    // The edge functions, each the (scaled) barycentric coordinate of the vertex across from that edge
+    real edge_a = c_x * b_y - c_y * b_x;
+    real edge_b = a_x * c_y - a_y * c_x;
+    real edge_c = b_x * a_y - b_y * a_x;
+#ifdef USE_FLOAT_PRECISION
+    if (edge_a == 0 || edge_b == 0 || edge_c == 0) {
+        // Exactly on an edge in floats, so working the edge functions out again in doubles to find out which side it's really on
+        edge_a = (real) ((double) c_x * (double) b_y - (double) c_y * (double) b_x);
+        edge_b = (real) ((double) a_x * (double) c_y - (double) a_y * (double) c_x);
+        edge_c = (real) ((double) b_x * (double) a_y - (double) b_y * (double) a_x);
+    }
+#endif
+    if ((edge_a < 0 || edge_b < 0 || edge_c < 0) && (edge_a > 0 || edge_b > 0 || edge_c > 0)) {
         return result;
     }
+    real determinant = edge_a + edge_b + edge_c;
+    if (determinant == 0) {
+        return result;
+    }
+
+    // The t-value, still scaled by the determinant so that the range check doesn't need a division
+    real scaled_t = edge_a * shear_z * a.component(kz) + edge_b * shear_z * b.component(kz) + edge_c * shear_z * c.component(kz);
+    if (determinant < 0 ? (scaled_t >= 0 || scaled_t <= t_max * determinant) : (scaled_t <= 0 || scaled_t >= t_max * determinant)) {
+        return result;
+    }
+
+    real inverse_determinant = 1 / determinant;
+    result.has_collision = true;
+    result.collision_distance = scaled_t * inverse_determinant;
+    result.collision_point = get_point_from_t(r, result.collision_distance);
+    result.barycentric_u = edge_b * inverse_determinant;
+    result.barycentric_v = edge_c * inverse_determinant;
+    result.triangle_index = index;
+    return result;
+}
+
+
+// Tests the given ray against a precomputed triangle record (with the given index, which is saved in the collision), only counting hits with a
+// t-value between 0 and t_max. This is the test every accelerator uses: Möller–Trumbore, or the watertight test if compiled with
+// -DUSE_WATERTIGHT_INTERSECTION
+__device__ __host__ collision ray_triangle_intersection_t(ray* r, triangle_record* tri, int index, real t_max) {
+#ifdef USE_WATERTIGHT_INTERSECTION
+    return ray_triangle_intersection_watertight(r, tri, index, t_max);
+#else
+    return ray_triangle_intersection_moller_trumbore(r, tri, index, t_max);
+#endif
 }
 
 
 
 
 // Print methods for debugging
-__device__ __host__ void print_vector(vector* v) {
-    printf("(%f, %f, %f)", *v->x, *v->y, *v->z);
+__device__ __host__ void print_vec3(vec3 v) {
+    printf("(%f, %f, %f)", v.x, v.y, v.z);
 }
 
 
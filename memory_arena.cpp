@@ -0,0 +1,187 @@
+// This file has the memory arena that every upload to the GPU goes through
+// Instead of calling hipMalloc for every single thing we send over (and never freeing any of it), the arena grabs one big block of memory up front
+// and hands out pieces of it by just moving a pointer forward ("bump" allocation). Nothing is freed one piece at a time -- instead, a whole region
+// is reset at once when everything in it is no longer needed:
+//     - The scene region holds things that stay around for as long as the scene does (the packed scene), and is reset when the scene changes
+//     - The frame region holds scratch memory that only lives for one frame (the framebuffer), and is reset at the start of every frame
+
+// Which kind of memory an arena (or anything else that can live in either place) uses -- the CPU version does the exact same thing with regular
+// memory, so that everything built on top of it can be tried out without a GPU
+enum memory_target {
+    MEMORY_TARGET_GPU,
+    MEMORY_TARGET_CPU
+};
+
+// One region of an arena, with its own bump pointer and usage statistics
+struct arena_region {
+    unsigned char* base;                // The start of this region's memory
+    size_t capacity;                    // The total size of the region in bytes
+    size_t used;                        // How far the bump pointer has moved, in bytes (includes padding)
+    size_t peak;                        // The most that has ever been used at once since the arena was made
+    size_t padding;                     // How many of the used bytes were skipped over to line allocations up to their alignment -- this is the
+                                        // arena's only source of fragmentation, since nothing is ever freed out of the middle of a region
+    int num_allocations;                // How many allocations have been made since the last reset
+};
+
+struct memory_arena {
+    memory_target target;
+    unsigned char* memory;              // The single block both regions are carved out of
+    arena_region scene;
+    arena_region frame;
+};
+
+
+// Makes an arena with the given region sizes, using a single allocation for both of them
+__host__ memory_arena create_arena(memory_target target, size_t scene_capacity, size_t frame_capacity) {
+    memory_arena result;
+    result.target = target;
+
+    scene_capacity = (scene_capacity + 255) & ~((size_t) 255);        // Rounding up so that the frame region starts on a nicely aligned address too
+    size_t total = scene_capacity + frame_capacity;
+    if (target == MEMORY_TARGET_GPU) {
+        hipMalloc(&result.memory, total);
+    } else {
+        result.memory = new unsigned char[total];
+    }
+
+    result.scene = {result.memory, scene_capacity, 0, 0, 0, 0};
+    result.frame = {result.memory + scene_capacity, frame_capacity, 0, 0, 0, 0};
+    return result;
+}
+
+
+__host__ void destroy_arena(memory_arena* arena) {
+    if (arena->memory == nullptr) {
+        return;
+    }
+    if (arena->target == MEMORY_TARGET_GPU) {
+        hipFree(arena->memory);
+    } else {
+        delete[] arena->memory;
+    }
+    arena->memory = nullptr;
+}
+
+
+// Makes sure the arena's regions are at least as big as the given sizes, remaking the arena (and throwing away everything in it) if they aren't
+// Regions only ever grow, so after the first few frames this stops reallocating
+__host__ void reserve_arena(memory_arena* arena, memory_target target, size_t scene_capacity, size_t frame_capacity) {
+    if (arena->memory != nullptr && arena->target == target && arena->scene.capacity >= scene_capacity && arena->frame.capacity >= frame_capacity) {
+        return;
+    }
+
+    // Keeping the peaks around so the stats still cover the whole run
+    size_t scene_peak = arena->memory != nullptr ? arena->scene.peak : 0;
+    size_t frame_peak = arena->memory != nullptr ? arena->frame.peak : 0;
+    if (arena->memory != nullptr) {
+        scene_capacity = scene_capacity > arena->scene.capacity ? scene_capacity : arena->scene.capacity;
+        frame_capacity = frame_capacity > arena->frame.capacity ? frame_capacity : arena->frame.capacity;
+    }
+
+    destroy_arena(arena);
+    *arena = create_arena(target, scene_capacity, frame_capacity);
+    arena->scene.peak = scene_peak;
+    arena->frame.peak = frame_peak;
+}
+
+
+// Hands out the given number of bytes from the given region, lined up to the given alignment (which must be a power of 2)
+// Returns null if the region doesn't have enough space left
+__host__ void* arena_allocate(arena_region* region, size_t size, size_t alignment) {
+    size_t address = (size_t) (region->base + region->used);
+    size_t aligned_address = (address + alignment - 1) & ~(alignment - 1);
+    size_t skipped = aligned_address - address;
+
+    if (region->used + skipped + size > region->capacity) {
+        printf("memory arena: out of space (%zu bytes requested, %zu of %zu bytes used)\n", size, region->used, region->capacity);
+        return nullptr;
+    }
+
+    region->used += skipped + size;
+    region->padding += skipped;
+    region->num_allocations++;
+    if (region->used > region->peak) {
+        region->peak = region->used;
+    }
+    return (void*) aligned_address;
+}
+
+
+// Throws away everything in a region at once, so its memory can be handed out again
+__host__ void reset_region(arena_region* region) {
+    region->used = 0;
+    region->padding = 0;
+    region->num_allocations = 0;
+}
+
+
+// Copies bytes into arena memory from the CPU, using whichever copy fits the arena's memory type
+__host__ void arena_copy_from_cpu(memory_arena* arena, void* destination, const void* source, size_t size) {
+    if (arena->target == MEMORY_TARGET_GPU) {
+        hipMemcpy(destination, source, size, hipMemcpyHostToDevice);
+    } else {
+        memcpy(destination, source, size);
+    }
+}
+
+
+// Copies bytes out of arena memory back to the CPU
+__host__ void arena_copy_to_cpu(memory_arena* arena, void* destination, const void* source, size_t size) {
+    if (arena->target == MEMORY_TARGET_GPU) {
+        hipMemcpy(destination, source, size, hipMemcpyDeviceToHost);
+    } else {
+        memcpy(destination, source, size);
+    }
+}
+
+
+__host__ void arena_memset(memory_arena* arena, void* destination, int value, size_t size) {
+    if (arena->target == MEMORY_TARGET_GPU) {
+        hipMemset(destination, value, size);
+    } else {
+        memset(destination, value, size);
+    }
+}
+
+
+// Same as the three above, but queued on the given stream without waiting for it (for GPU arenas, which needs pinned CPU memory to actually run
+// asynchronously) -- CPU arenas have nothing to wait for, so they just do it right away
+__host__ void arena_copy_from_cpu_async(memory_arena* arena, void* destination, const void* source, size_t size, hipStream_t stream) {
+    if (arena->target == MEMORY_TARGET_GPU) {
+        hipMemcpyAsync(destination, source, size, hipMemcpyHostToDevice, stream);
+    } else {
+        memcpy(destination, source, size);
+    }
+}
+
+
+__host__ void arena_copy_to_cpu_async(memory_arena* arena, void* destination, const void* source, size_t size, hipStream_t stream) {
+    if (arena->target == MEMORY_TARGET_GPU) {
+        hipMemcpyAsync(destination, source, size, hipMemcpyDeviceToHost, stream);
+    } else {
+        memcpy(destination, source, size);
+    }
+}
+
+
+__host__ void arena_memset_async(memory_arena* arena, void* destination, int value, size_t size, hipStream_t stream) {
+    if (arena->target == MEMORY_TARGET_GPU) {
+        hipMemsetAsync(destination, value, size, stream);
+    } else {
+        memset(destination, value, size);
+    }
+}
+
+
+__host__ void print_region_stats(const char* name, arena_region* region) {
+    double fragmentation = region->used == 0 ? 0 : 100.0 * region->padding / region->used;
+    printf("  %s region: %zu bytes current, %zu bytes peak, %zu bytes capacity, %i allocation(s), %.1f%% fragmentation\n",
+           name, region->used, region->peak, region->capacity, region->num_allocations, fragmentation);
+}
+
+
+__host__ void print_arena_stats(memory_arena* arena) {
+    printf("memory arena (%s):\n", arena->target == MEMORY_TARGET_GPU ? "GPU" : "CPU");
+    print_region_stats("scene", &arena->scene);
+    print_region_stats("frame", &arena->frame);
+}
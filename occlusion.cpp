@@ -0,0 +1,328 @@
+// This file has the occlusion (any-hit) queries, for shadow rays
+// Lighting a point with a light (see the light struct) only needs to know whether anything at all is between the two, not what the closest thing
+// is, so these walks stop at the very first triangle they find closer than t_max, and don't bother sorting children by distance either (which
+// only helps to find the closest hit sooner). Each accelerator gets its own version, and scene_occluded() / segment_occluded() pick the right one
+// for a packed scene, the same way scene_closest_hit() does
+
+#define SHADOW_RAY_EPSILON 1e-4         // How much of a shadow segment is skipped at each end (as a fraction of its length), so that the surfaces the
+                                        // segment starts and ends on don't count as being in the way because of rounding
+
+
+// Returns whether the ray hits any of the given triangles closer than t_max
+__device__ __host__ bool triangles_any_hit(ray* r, triangle_record* triangles, int first, int count, real t_max) {
+    for (int i = first; i < first + count; i++) {
+        if (ray_triangle_intersection_t(r, &triangles[i], i, t_max).has_collision) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Returns whether the ray hits any triangle closer than t_max, walking the given BVH like bvh_closest_hit() but stopping at the first hit
+// Children are visited left first instead of nearest first, since with no closest hit to shrink t_max, the order doesn't save any work
+__device__ __host__ bool bvh_any_hit(ray* r, bvh_node* nodes, int num_nodes, triangle_record* triangles, real t_max) {
+    if (num_nodes == 0) {
+        return false;
+    }
+
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    int stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        bvh_node* node = &nodes[node_index];
+        if (node->bounds.intersect(origin, inverse_direction, t_max) != INFINITY) {
+            if (node->is_leaf()) {
+                if (triangles_any_hit(r, triangles, node->offset, node->num_triangles, t_max)) {
+                    return true;
+                }
+            } else {
+                stack[stack_size++] = node->offset;
+                node_index++;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            return false;
+        }
+        node_index = stack[--stack_size];
+    }
+}
+
+
+// The same as bvh_any_hit(), for a BVH reordered into one of the layouts in bvh_layout.cpp (where both children of a node sit next to each other)
+__device__ __host__ bool paired_bvh_any_hit(ray* r, paired_bvh_node* nodes, int num_nodes, triangle_record* triangles, real t_max) {
+    if (num_nodes == 0) {
+        return false;
+    }
+
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    int stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        paired_bvh_node* node = &nodes[node_index];
+        if (node->bounds.intersect(origin, inverse_direction, t_max) != INFINITY) {
+            if (node->is_leaf()) {
+                if (triangles_any_hit(r, triangles, node->offset, node->num_triangles, t_max)) {
+                    return true;
+                }
+            } else {
+                stack[stack_size++] = node->offset + 1;
+                node_index = node->offset;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            return false;
+        }
+        node_index = stack[--stack_size];
+    }
+}
+
+
+// Returns whether the ray hits any triangle closer than t_max in the given wide BVH, stopping at the first hit
+// Like wide_bvh_closest_hit(), the interior children that are hit get saved as one stack entry per node, just in slot order instead of sorted
+__device__ __host__ bool wide_bvh_any_hit(ray* r, wide_bvh_node* nodes, int num_nodes, triangle_record* triangles, real t_max) {
+    if (num_nodes == 0) {
+        return false;
+    }
+
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    wide_bvh_stack_entry stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        wide_bvh_node* node = &nodes[node_index];
+        vec3 step = node->scale();
+        int next = -1;
+        uint32_t count = 0;
+        for (int i = 0; i < WIDE_BVH_WIDTH; i++) {
+            if (node->child_offset[i] < 0) {
+                break;
+            }
+            if (node->child_bounds(i, step).intersect(origin, inverse_direction, t_max) == INFINITY) {
+                continue;
+            }
+
+            if (node->child_triangles[i] > 0) {
+                if (triangles_any_hit(r, triangles, node->child_offset[i], node->child_triangles[i], t_max)) {
+                    return true;
+                }
+            } else if (next == -1) {
+                next = node->child_offset[i];
+            } else {
+                if (count == 0) {
+                    stack[stack_size++] = {node_index, 0};
+                }
+                wide_bvh_stack_entry* entry = &stack[stack_size - 1];
+                entry->remaining = (entry->remaining & 0x0FFFFFFF) | ((uint32_t) i << (3 * count)) | ((count + 1) << 28);
+                count++;
+            }
+        }
+
+        // Every box on the stack was already hit, and t_max never shrinks here, so there's no need to test them again
+        if (next == -1 && stack_size > 0) {
+            wide_bvh_stack_entry* entry = &stack[stack_size - 1];
+            uint32_t saved = entry->remaining >> 28;
+            next = nodes[entry->node].child_offset[entry->remaining & 7];
+            if (saved == 1) {
+                stack_size--;
+            } else {
+                entry->remaining = ((entry->remaining & 0x0FFFFFFF) >> 3) | ((saved - 1) << 28);
+            }
+        }
+        if (next == -1) {
+            return false;
+        }
+        node_index = next;
+    }
+}
+
+
+// Returns whether the ray hits any triangle closer than t_max in the given grid, stepping through its cells like grid_closest_hit() until either a
+// hit turns up or the walk gets past t_max
+__device__ __host__ bool grid_any_hit(ray* r, grid_accelerator* grid, triangle_record* triangles, real t_max) {
+    if (grid->num_levels == 0) {
+        return false;
+    }
+
+    grid_level* top = &grid->levels[0];
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    real t_enter = top->bounds.intersect(r->origin, inverse_direction, t_max);
+    if (t_enter == INFINITY) {
+        return false;
+    }
+    t_enter = fmax(t_enter, (real) 0);
+
+    grid_dda walk;
+    walk.start(top, r->origin, r->direction, t_enter);
+    while (true) {
+        grid_cell* cell = &grid->cells[top->first_cell + walk.cell_index()];
+        real t_exit = walk.t_exit();
+        if (cell->child_level == -1) {
+            for (int i = cell->first_reference; i < cell->first_reference + cell->num_references; i++) {
+                if (triangles_any_hit(r, triangles, grid->references[i], 1, t_max)) {
+                    return true;
+                }
+            }
+        } else {
+            grid_level* inner = &grid->levels[cell->child_level];
+            grid_dda inner_walk;
+            inner_walk.start(inner, r->origin, r->direction, t_enter);
+            while (true) {
+                grid_cell* inner_cell = &grid->cells[inner->first_cell + inner_walk.cell_index()];
+                for (int i = inner_cell->first_reference; i < inner_cell->first_reference + inner_cell->num_references; i++) {
+                    if (triangles_any_hit(r, triangles, grid->references[i], 1, t_max)) {
+                        return true;
+                    }
+                }
+                if (t_max <= inner_walk.t_exit() || !inner_walk.advance()) {
+                    break;
+                }
+            }
+        }
+
+        if (t_max <= t_exit || !walk.advance()) {
+            return false;
+        }
+        t_enter = t_exit;
+    }
+}
+
+
+// Returns whether the ray hits any triangle closer than t_max in the given instanced scene, walking the TLAS and each instance's BLAS (with an
+// object-space copy of the ray, see instanced_closest_hit()) and stopping at the first hit
+__device__ __host__ bool instanced_any_hit(ray* r, instanced_view* scene, real t_max) {
+    if (scene->num_tlas_nodes == 0) {
+        return false;
+    }
+
+    bvh_node* nodes = scene->tlas_nodes;
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    int stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        bvh_node* node = &nodes[node_index];
+        if (node->bounds.intersect(origin, inverse_direction, t_max) != INFINITY) {
+            if (node->is_leaf()) {
+                for (int i = node->offset; i < node->offset + node->num_triangles; i++) {
+                    mesh_instance* instance = &scene->instances[scene->tlas_instances[i]];
+                    mesh_blas* mesh = &scene->meshes[instance->mesh_index];
+                    ray object_ray = ray(instance->world_to_object.apply_to_point(r->origin),
+                                         instance->world_to_object.apply_to_vector(r->direction));
+                    if (bvh_any_hit(&object_ray, scene->blas_nodes + mesh->first_node, mesh->num_nodes, scene->triangles + mesh->first_triangle,
+                                    t_max)) {
+                        return true;
+                    }
+                }
+            } else {
+                stack[stack_size++] = node->offset;
+                node_index++;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            return false;
+        }
+        node_index = stack[--stack_size];
+    }
+}
+
+
+// Returns the ray for the shadow segment from point from to point to: its direction is the whole segment (not normalized), so the segment is
+// t-values 0 to 1, and its origin is moved SHADOW_RAY_EPSILON of the way along. Anything hit closer than *t_max (which is set to the matching end
+// of the segment, SHADOW_RAY_EPSILON short of to) is in the way
+__device__ __host__ ray make_shadow_ray(vec3 from, vec3 to, real* t_max) {
+    vec3 segment = to.sub(from);
+    *t_max = 1 - 2 * (real) SHADOW_RAY_EPSILON;
+    return ray(from.add(segment.scale(SHADOW_RAY_EPSILON)), segment);
+}
+
+
+// Makes the given number of point lights, spread out above the benchmark scene's box (between the camera and the triangles' far side)
+__host__ light* make_benchmark_lights(int num_lights, uint32_t* random_state) {
+    light* lights = new light[num_lights];
+    for (int i = 0; i < num_lights; i++) {
+        vec3 position = vec3(benchmark_random(random_state) * 120 - 60, benchmark_random(random_state) * 120 - 60,
+                             benchmark_random(random_state) * 40);
+        lights[i] = light(position, color(1, 1, 1), 1);
+    }
+    return lights;
+}
+
+
+// Traces primary rays into a BVH over the given number of random triangles, then, for scenes with 1, 4, 16, and 64 point lights, traces a shadow
+// ray from every hit point to every light, both with bvh_closest_hit() and with bvh_any_hit(), and prints how many shadow rays per second each
+// got through, how many of the shadow rays were blocked, and how many the two disagreed on (which should always be 0)
+__host__ void benchmark_occlusion(int num_triangles, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, &random_state);
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+    bvh tree = build_bvh(triangles, num_triangles);
+
+    vec3* points = new vec3[num_rays];
+    int num_points = 0;
+    for (int i = 0; i < num_rays; i++) {
+        collision hit = bvh_closest_hit(&rays[i], tree.nodes, tree.num_nodes, triangles, INFINITY);
+        if (hit.has_collision) {
+            points[num_points++] = hit.collision_point;
+        }
+    }
+    printf("occlusion benchmark: %i triangles, %i shading points\n", num_triangles, num_points);
+
+    for (int num_lights = 1; num_lights <= 64; num_lights *= 4) {
+        light* lights = make_benchmark_lights(num_lights, &random_state);
+        int num_shadow_rays = num_points * num_lights;
+        bool* blocked = new bool[num_shadow_rays];
+
+        auto closest_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < num_points; i++) {
+            for (int j = 0; j < num_lights; j++) {
+                real t_max;
+                ray shadow = make_shadow_ray(points[i], lights[j].position, &t_max);
+                blocked[i * num_lights + j] = bvh_closest_hit(&shadow, tree.nodes, tree.num_nodes, triangles, t_max).has_collision;
+            }
+        }
+        auto closest_end = std::chrono::high_resolution_clock::now();
+
+        int num_blocked = 0;
+        int num_mismatches = 0;
+        auto any_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < num_points; i++) {
+            for (int j = 0; j < num_lights; j++) {
+                real t_max;
+                ray shadow = make_shadow_ray(points[i], lights[j].position, &t_max);
+                bool occluded = bvh_any_hit(&shadow, tree.nodes, tree.num_nodes, triangles, t_max);
+                num_blocked += occluded;
+                num_mismatches += occluded != blocked[i * num_lights + j];
+            }
+        }
+        auto any_end = std::chrono::high_resolution_clock::now();
+
+        double closest_ms = std::chrono::duration_cast<std::chrono::microseconds>(closest_end - closest_start).count() / 1000.0;
+        double any_ms = std::chrono::duration_cast<std::chrono::microseconds>(any_end - any_start).count() / 1000.0;
+        printf("  %i light(s): closest hit %.2f M shadow rays/s, any hit %.2f M shadow rays/s", num_lights, num_shadow_rays / closest_ms / 1000.0,
+               num_shadow_rays / any_ms / 1000.0);
+        printf(" (%.1f k points/s with every light tested), %.1f%% blocked, %i mismatch(es)\n", num_points / any_ms,
+               100.0 * num_blocked / num_shadow_rays, num_mismatches);
+        assert(num_mismatches == 0);
+
+        delete[] blocked;
+        delete[] lights;
+    }
+
+    delete[] points;
+    delete[] tree.nodes;
+    delete[] triangles;
+    delete[] rays;
+}
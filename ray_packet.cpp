@@ -0,0 +1,570 @@
+// This file has ray packets, for tracing coherent rays (like neighboring primary rays) on the host 8 at a time with SIMD instructions
+// Neighboring camera rays go through almost exactly the same BVH nodes, so instead of walking the tree once per ray, a packet of 8 rays walks it
+// together: every node's box (and every leaf's triangles) is tested against all 8 rays at once, with one SIMD instruction doing the same math for
+// several rays, and the packet goes into a node as long as at least one of its rays hits the node's box (a bitmask keeps track of which rays did)
+// The SIMD code comes in three versions, and the best one the CPU has is picked when the program runs (by asking the CPU with CPUID):
+//     AVX2: 256-bit registers, so 8 rays in one register with floats, or in two with doubles
+//     SSE: 128-bit registers, which every 64-bit x86 CPU has, so 4 rays per register with floats, or 2 with doubles
+//     scalar: one ray at a time (for CPUs that aren't x86), with the same per-ray tests as bvh_closest_hit()
+// The SIMD tests use the same formulas in the same order as bounding_box::intersect() and ray_triangle_intersection_moller_trumbore() (packets
+// always use Möller–Trumbore, even if compiled with -DUSE_WATERTIGHT_INTERSECTION), so they find the same hits as single rays walked with
+// bvh_closest_hit_moller_trumbore() except where a NaN shows up: a ray starting exactly on a box's face while parallel to it works out
+// 0 * infinity, and fmin/fmax skip the NaN while SIMD min and max just return their second operand, so the two can disagree on whether that ray
+// grazes the box. benchmark_ray_packets() only traces camera rays, which start in front of every box, so it asserts that there are no mismatches
+
+#define RAY_PACKET_SIZE 8
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(__HIP_DEVICE_COMPILE__)
+#define RAY_PACKET_X86                  // The SSE and AVX2 versions only exist on 64-bit x86 hosts
+#endif
+
+// Which version of the packet tests to use, from slowest to fastest
+enum ray_packet_level {
+    RAY_PACKET_SCALAR,
+    RAY_PACKET_SSE,
+    RAY_PACKET_AVX2
+};
+
+// 8 rays, stored component by component (all 8 origin x's, then all 8 origin y's, ...) so that one SIMD load picks up the same component of
+// neighboring rays. Only the first num_rays rays are real, the rest are ignored
+struct alignas(32) ray_packet {
+    real origin_x[RAY_PACKET_SIZE];
+    real origin_y[RAY_PACKET_SIZE];
+    real origin_z[RAY_PACKET_SIZE];
+    real direction_x[RAY_PACKET_SIZE];
+    real direction_y[RAY_PACKET_SIZE];
+    real direction_z[RAY_PACKET_SIZE];
+    real inverse_x[RAY_PACKET_SIZE];
+    real inverse_y[RAY_PACKET_SIZE];
+    real inverse_z[RAY_PACKET_SIZE];
+    int num_rays;
+};
+
+// The closest hit so far for each ray of a packet (t is INFINITY and triangle is -1 for rays that haven't hit anything)
+struct alignas(32) ray_packet_hits {
+    real t[RAY_PACKET_SIZE];
+    real u[RAY_PACKET_SIZE];
+    real v[RAY_PACKET_SIZE];
+    int triangle[RAY_PACKET_SIZE];
+};
+
+
+// Packs up to RAY_PACKET_SIZE of the given rays into a packet
+__host__ ray_packet make_ray_packet(ray* rays, int num_rays) {
+    ray_packet packet;
+    packet.num_rays = num_rays;
+    for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+        ray r = rays[i < num_rays ? i : 0];                                             // The unused spots just repeat the first ray
+        packet.origin_x[i] = r.origin.x;
+        packet.origin_y[i] = r.origin.y;
+        packet.origin_z[i] = r.origin.z;
+        packet.direction_x[i] = r.direction.x;
+        packet.direction_y[i] = r.direction.y;
+        packet.direction_z[i] = r.direction.z;
+        packet.inverse_x[i] = 1 / r.direction.x;
+        packet.inverse_y[i] = 1 / r.direction.y;
+        packet.inverse_z[i] = 1 / r.direction.z;
+    }
+    return packet;
+}
+
+
+// The scalar version: tests each of the rays in mask against the given box (hit only if it enters before its closest hit so far), and returns the
+// mask of the ones that hit it, with where each one entered the box in t_enter (INFINITY for rays that missed it or that aren't in mask, so that
+// only the rays that are actually going into the node count toward which child gets visited first)
+struct ray_packet_scalar {
+    __host__ static int test_box(ray_packet* packet, bounding_box* box, real* t_max, int mask, real* t_enter) {
+        int result = 0;
+        for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+            t_enter[i] = INFINITY;
+            if (mask & (1 << i)) {
+                t_enter[i] = box->intersect(vec3(packet->origin_x[i], packet->origin_y[i], packet->origin_z[i]),
+                                            vec3(packet->inverse_x[i], packet->inverse_y[i], packet->inverse_z[i]), t_max[i]);
+                result |= (t_enter[i] != INFINITY) << i;
+            }
+        }
+        return result;
+    }
+
+    // Tests each of the rays in mask against the given triangle, and updates the hits of the ones that hit it closer than their closest hit so far
+    __host__ static void test_triangle(ray_packet* packet, triangle_record* tri, int index, int mask, ray_packet_hits* hits) {
+        for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+            if (mask & (1 << i)) {
+                ray r = ray(vec3(packet->origin_x[i], packet->origin_y[i], packet->origin_z[i]),
+                            vec3(packet->direction_x[i], packet->direction_y[i], packet->direction_z[i]));
+                collision hit = ray_triangle_intersection_moller_trumbore(&r, tri, index, hits->t[i]);
+                if (hit.has_collision) {
+                    hits->t[i] = hit.collision_distance;
+                    hits->u[i] = hit.barycentric_u;
+                    hits->v[i] = hit.barycentric_v;
+                    hits->triangle[i] = index;
+                }
+            }
+        }
+    }
+};
+
+
+#ifdef RAY_PACKET_X86
+// The SIMD operations the SSE and AVX2 versions need, for whichever precision real is
+#ifdef USE_FLOAT_PRECISION
+#define SSE_LANES 4
+#define sse_real __m128
+#define sse_load _mm_load_ps
+#define sse_store _mm_store_ps
+#define sse_set1 _mm_set1_ps
+#define sse_add _mm_add_ps
+#define sse_sub _mm_sub_ps
+#define sse_mul _mm_mul_ps
+#define sse_div _mm_div_ps
+#define sse_min _mm_min_ps
+#define sse_max _mm_max_ps
+#define sse_less _mm_cmplt_ps
+#define sse_less_equal _mm_cmple_ps
+#define sse_not_equal _mm_cmpneq_ps
+#define sse_and _mm_and_ps
+#define sse_and_not _mm_andnot_ps
+#define sse_or _mm_or_ps
+#define sse_movemask _mm_movemask_ps
+#define AVX_LANES 8
+#define avx_real __m256
+#define avx_load _mm256_load_ps
+#define avx_store _mm256_store_ps
+#define avx_set1 _mm256_set1_ps
+#define avx_add _mm256_add_ps
+#define avx_sub _mm256_sub_ps
+#define avx_mul _mm256_mul_ps
+#define avx_div _mm256_div_ps
+#define avx_min _mm256_min_ps
+#define avx_max _mm256_max_ps
+#define avx_less(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define avx_less_equal(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define avx_not_equal(a, b) _mm256_cmp_ps(a, b, _CMP_NEQ_UQ)
+#define avx_and _mm256_and_ps
+#define avx_or _mm256_or_ps
+#define avx_blend _mm256_blendv_ps
+#define avx_movemask _mm256_movemask_ps
+#else
+#define SSE_LANES 2
+#define sse_real __m128d
+#define sse_load _mm_load_pd
+#define sse_store _mm_store_pd
+#define sse_set1 _mm_set1_pd
+#define sse_add _mm_add_pd
+#define sse_sub _mm_sub_pd
+#define sse_mul _mm_mul_pd
+#define sse_div _mm_div_pd
+#define sse_min _mm_min_pd
+#define sse_max _mm_max_pd
+#define sse_less _mm_cmplt_pd
+#define sse_less_equal _mm_cmple_pd
+#define sse_not_equal _mm_cmpneq_pd
+#define sse_and _mm_and_pd
+#define sse_and_not _mm_andnot_pd
+#define sse_or _mm_or_pd
+#define sse_movemask _mm_movemask_pd
+#define AVX_LANES 4
+#define avx_real __m256d
+#define avx_load _mm256_load_pd
+#define avx_store _mm256_store_pd
+#define avx_set1 _mm256_set1_pd
+#define avx_add _mm256_add_pd
+#define avx_sub _mm256_sub_pd
+#define avx_mul _mm256_mul_pd
+#define avx_div _mm256_div_pd
+#define avx_min _mm256_min_pd
+#define avx_max _mm256_max_pd
+#define avx_less(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define avx_less_equal(a, b) _mm256_cmp_pd(a, b, _CMP_LE_OQ)
+#define avx_not_equal(a, b) _mm256_cmp_pd(a, b, _CMP_NEQ_UQ)
+#define avx_and _mm256_and_pd
+#define avx_or _mm256_or_pd
+#define avx_blend _mm256_blendv_pd
+#define avx_movemask _mm256_movemask_pd
+#endif
+
+
+// The SIMD box tests test every ray, even the ones outside the mask, so this sets t_enter back to INFINITY for those afterward (see
+// ray_packet_scalar::test_box())
+__host__ void clear_unmasked_enters(int mask, real* t_enter) {
+    for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+        if ((mask & (1 << i)) == 0) {
+            t_enter[i] = INFINITY;
+        }
+    }
+}
+
+
+// The SSE version, a few rays (SSE_LANES) per instruction. Both tests work the same way as the scalar ones, with the slab test's fmin and fmax as
+// SIMD min and max, and Möller–Trumbore's early outs turned into masks that are all combined at the end
+struct ray_packet_sse {
+    __host__ static int test_box(ray_packet* packet, bounding_box* box, real* t_max, int mask, real* t_enter) {
+        int result = 0;
+        for (int i = 0; i < RAY_PACKET_SIZE; i += SSE_LANES) {
+            sse_real tx1 = sse_mul(sse_sub(sse_set1(box->min.x), sse_load(packet->origin_x + i)), sse_load(packet->inverse_x + i));
+            sse_real tx2 = sse_mul(sse_sub(sse_set1(box->max.x), sse_load(packet->origin_x + i)), sse_load(packet->inverse_x + i));
+            sse_real enter = sse_min(tx1, tx2);
+            sse_real exit = sse_max(tx1, tx2);
+            sse_real ty1 = sse_mul(sse_sub(sse_set1(box->min.y), sse_load(packet->origin_y + i)), sse_load(packet->inverse_y + i));
+            sse_real ty2 = sse_mul(sse_sub(sse_set1(box->max.y), sse_load(packet->origin_y + i)), sse_load(packet->inverse_y + i));
+            enter = sse_max(enter, sse_min(ty1, ty2));
+            exit = sse_min(exit, sse_max(ty1, ty2));
+            sse_real tz1 = sse_mul(sse_sub(sse_set1(box->min.z), sse_load(packet->origin_z + i)), sse_load(packet->inverse_z + i));
+            sse_real tz2 = sse_mul(sse_sub(sse_set1(box->max.z), sse_load(packet->origin_z + i)), sse_load(packet->inverse_z + i));
+            enter = sse_max(enter, sse_min(tz1, tz2));
+            exit = sse_min(exit, sse_max(tz1, tz2));
+
+            sse_real hit = sse_and(sse_and(sse_less_equal(enter, exit), sse_less(sse_set1(0), exit)), sse_less(enter, sse_load(t_max + i)));
+            sse_store(t_enter + i, sse_or(sse_and(hit, enter), sse_and_not(hit, sse_set1(INFINITY))));
+            result |= sse_movemask(hit) << i;
+        }
+        clear_unmasked_enters(mask, t_enter);
+        return result & mask;
+    }
+
+    __host__ static void test_triangle(ray_packet* packet, triangle_record* tri, int index, int mask, ray_packet_hits* hits) {
+        for (int i = 0; i < RAY_PACKET_SIZE; i += SSE_LANES) {
+            if (((mask >> i) & ((1 << SSE_LANES) - 1)) == 0) {
+                continue;
+            }
+            sse_real d_x = sse_load(packet->direction_x + i);
+            sse_real d_y = sse_load(packet->direction_y + i);
+            sse_real d_z = sse_load(packet->direction_z + i);
+            sse_real p_x = sse_sub(sse_mul(d_y, sse_set1(tri->e2.z)), sse_mul(d_z, sse_set1(tri->e2.y)));
+            sse_real p_y = sse_sub(sse_mul(d_z, sse_set1(tri->e2.x)), sse_mul(d_x, sse_set1(tri->e2.z)));
+            sse_real p_z = sse_sub(sse_mul(d_x, sse_set1(tri->e2.y)), sse_mul(d_y, sse_set1(tri->e2.x)));
+            sse_real determinant = sse_add(sse_add(sse_mul(sse_set1(tri->e1.x), p_x), sse_mul(sse_set1(tri->e1.y), p_y)),
+                                           sse_mul(sse_set1(tri->e1.z), p_z));
+            sse_real valid = sse_not_equal(determinant, sse_set1(0));
+            sse_real inverse_determinant = sse_div(sse_set1(1), determinant);
+
+            sse_real s_x = sse_sub(sse_load(packet->origin_x + i), sse_set1(tri->v0.x));
+            sse_real s_y = sse_sub(sse_load(packet->origin_y + i), sse_set1(tri->v0.y));
+            sse_real s_z = sse_sub(sse_load(packet->origin_z + i), sse_set1(tri->v0.z));
+            sse_real u = sse_mul(sse_add(sse_add(sse_mul(s_x, p_x), sse_mul(s_y, p_y)), sse_mul(s_z, p_z)), inverse_determinant);
+            valid = sse_and(valid, sse_and(sse_less_equal(sse_set1(0), u), sse_less_equal(u, sse_set1(1))));
+
+            sse_real q_x = sse_sub(sse_mul(s_y, sse_set1(tri->e1.z)), sse_mul(s_z, sse_set1(tri->e1.y)));
+            sse_real q_y = sse_sub(sse_mul(s_z, sse_set1(tri->e1.x)), sse_mul(s_x, sse_set1(tri->e1.z)));
+            sse_real q_z = sse_sub(sse_mul(s_x, sse_set1(tri->e1.y)), sse_mul(s_y, sse_set1(tri->e1.x)));
+            sse_real v = sse_mul(sse_add(sse_add(sse_mul(d_x, q_x), sse_mul(d_y, q_y)), sse_mul(d_z, q_z)), inverse_determinant);
+            valid = sse_and(valid, sse_and(sse_less_equal(sse_set1(0), v), sse_less_equal(sse_add(u, v), sse_set1(1))));
+
+            sse_real t = sse_mul(sse_add(sse_add(sse_mul(sse_set1(tri->e2.x), q_x), sse_mul(sse_set1(tri->e2.y), q_y)),
+                                         sse_mul(sse_set1(tri->e2.z), q_z)), inverse_determinant);
+            sse_real t_max = sse_load(hits->t + i);
+            valid = sse_and(valid, sse_and(sse_less(sse_set1(0), t), sse_less(t, t_max)));
+
+            int hit_mask = sse_movemask(valid) & (mask >> i);
+            if (hit_mask == 0) {
+                continue;
+            }
+            sse_store(hits->t + i, sse_or(sse_and(valid, t), sse_and_not(valid, t_max)));
+            sse_store(hits->u + i, sse_or(sse_and(valid, u), sse_and_not(valid, sse_load(hits->u + i))));
+            sse_store(hits->v + i, sse_or(sse_and(valid, v), sse_and_not(valid, sse_load(hits->v + i))));
+            for (int lane = 0; lane < SSE_LANES; lane++) {
+                if (hit_mask & (1 << lane)) {
+                    hits->triangle[i + lane] = index;
+                }
+            }
+        }
+    }
+};
+
+
+// The AVX2 version, the same as the SSE one with twice as many rays per instruction. Has to be compiled for AVX2 no matter what the rest of the
+// program is compiled for, so that one build runs everywhere (it's only ever called on CPUs that have AVX2, see ray_packet_cpu_level())
+struct ray_packet_avx2 {
+    __attribute__((target("avx2"))) __host__ static int test_box(ray_packet* packet, bounding_box* box, real* t_max, int mask, real* t_enter) {
+        int result = 0;
+        for (int i = 0; i < RAY_PACKET_SIZE; i += AVX_LANES) {
+            avx_real tx1 = avx_mul(avx_sub(avx_set1(box->min.x), avx_load(packet->origin_x + i)), avx_load(packet->inverse_x + i));
+            avx_real tx2 = avx_mul(avx_sub(avx_set1(box->max.x), avx_load(packet->origin_x + i)), avx_load(packet->inverse_x + i));
+            avx_real enter = avx_min(tx1, tx2);
+            avx_real exit = avx_max(tx1, tx2);
+            avx_real ty1 = avx_mul(avx_sub(avx_set1(box->min.y), avx_load(packet->origin_y + i)), avx_load(packet->inverse_y + i));
+            avx_real ty2 = avx_mul(avx_sub(avx_set1(box->max.y), avx_load(packet->origin_y + i)), avx_load(packet->inverse_y + i));
+            enter = avx_max(enter, avx_min(ty1, ty2));
+            exit = avx_min(exit, avx_max(ty1, ty2));
+            avx_real tz1 = avx_mul(avx_sub(avx_set1(box->min.z), avx_load(packet->origin_z + i)), avx_load(packet->inverse_z + i));
+            avx_real tz2 = avx_mul(avx_sub(avx_set1(box->max.z), avx_load(packet->origin_z + i)), avx_load(packet->inverse_z + i));
+            enter = avx_max(enter, avx_min(tz1, tz2));
+            exit = avx_min(exit, avx_max(tz1, tz2));
+
+            avx_real hit = avx_and(avx_and(avx_less_equal(enter, exit), avx_less(avx_set1(0), exit)), avx_less(enter, avx_load(t_max + i)));
+            avx_store(t_enter + i, avx_blend(avx_set1(INFINITY), enter, hit));
+            result |= avx_movemask(hit) << i;
+        }
+        clear_unmasked_enters(mask, t_enter);
+        return result & mask;
+    }
+
+    __attribute__((target("avx2"))) __host__ static void test_triangle(ray_packet* packet, triangle_record* tri, int index, int mask,
+                                                                       ray_packet_hits* hits) {
+        for (int i = 0; i < RAY_PACKET_SIZE; i += AVX_LANES) {
+            if (((mask >> i) & ((1 << AVX_LANES) - 1)) == 0) {
+                continue;
+            }
+            avx_real d_x = avx_load(packet->direction_x + i);
+            avx_real d_y = avx_load(packet->direction_y + i);
+            avx_real d_z = avx_load(packet->direction_z + i);
+            avx_real p_x = avx_sub(avx_mul(d_y, avx_set1(tri->e2.z)), avx_mul(d_z, avx_set1(tri->e2.y)));
+            avx_real p_y = avx_sub(avx_mul(d_z, avx_set1(tri->e2.x)), avx_mul(d_x, avx_set1(tri->e2.z)));
+            avx_real p_z = avx_sub(avx_mul(d_x, avx_set1(tri->e2.y)), avx_mul(d_y, avx_set1(tri->e2.x)));
+            avx_real determinant = avx_add(avx_add(avx_mul(avx_set1(tri->e1.x), p_x), avx_mul(avx_set1(tri->e1.y), p_y)),
+                                           avx_mul(avx_set1(tri->e1.z), p_z));
+            avx_real valid = avx_not_equal(determinant, avx_set1(0));
+            avx_real inverse_determinant = avx_div(avx_set1(1), determinant);
+
+            avx_real s_x = avx_sub(avx_load(packet->origin_x + i), avx_set1(tri->v0.x));
+            avx_real s_y = avx_sub(avx_load(packet->origin_y + i), avx_set1(tri->v0.y));
+            avx_real s_z = avx_sub(avx_load(packet->origin_z + i), avx_set1(tri->v0.z));
+            avx_real u = avx_mul(avx_add(avx_add(avx_mul(s_x, p_x), avx_mul(s_y, p_y)), avx_mul(s_z, p_z)), inverse_determinant);
+            valid = avx_and(valid, avx_and(avx_less_equal(avx_set1(0), u), avx_less_equal(u, avx_set1(1))));
+
+            avx_real q_x = avx_sub(avx_mul(s_y, avx_set1(tri->e1.z)), avx_mul(s_z, avx_set1(tri->e1.y)));
+            avx_real q_y = avx_sub(avx_mul(s_z, avx_set1(tri->e1.x)), avx_mul(s_x, avx_set1(tri->e1.z)));
+            avx_real q_z = avx_sub(avx_mul(s_x, avx_set1(tri->e1.y)), avx_mul(s_y, avx_set1(tri->e1.x)));
+            avx_real v = avx_mul(avx_add(avx_add(avx_mul(d_x, q_x), avx_mul(d_y, q_y)), avx_mul(d_z, q_z)), inverse_determinant);
+            valid = avx_and(valid, avx_and(avx_less_equal(avx_set1(0), v), avx_less_equal(avx_add(u, v), avx_set1(1))));
+
+            avx_real t = avx_mul(avx_add(avx_add(avx_mul(avx_set1(tri->e2.x), q_x), avx_mul(avx_set1(tri->e2.y), q_y)),
+                                         avx_mul(avx_set1(tri->e2.z), q_z)), inverse_determinant);
+            avx_real t_max = avx_load(hits->t + i);
+            valid = avx_and(valid, avx_and(avx_less(avx_set1(0), t), avx_less(t, t_max)));
+
+            int hit_mask = avx_movemask(valid) & (mask >> i);
+            if (hit_mask == 0) {
+                continue;
+            }
+            avx_store(hits->t + i, avx_blend(t_max, t, valid));
+            avx_store(hits->u + i, avx_blend(avx_load(hits->u + i), u, valid));
+            avx_store(hits->v + i, avx_blend(avx_load(hits->v + i), v, valid));
+            for (int lane = 0; lane < AVX_LANES; lane++) {
+                if (hit_mask & (1 << lane)) {
+                    hits->triangle[i + lane] = index;
+                }
+            }
+        }
+    }
+};
+#endif
+
+
+// Returns the fastest version of the packet tests this CPU can run, asking it with CPUID the first time: AVX2 needs the CPU to have it and the
+// operating system to save the 256-bit registers between threads (the OSXSAVE bit, then XGETBV), and SSE is always there on 64-bit x86
+__host__ ray_packet_level ray_packet_cpu_level() {
+    static int level = -1;
+    if (level != -1) {
+        return (ray_packet_level) level;
+    }
+    level = RAY_PACKET_SCALAR;
+#ifdef RAY_PACKET_X86
+    level = RAY_PACKET_SSE;
+    unsigned int registers[4];                                                          // eax, ebx, ecx, and edx
+#if defined(_MSC_VER) && !defined(__clang__)
+    __cpuidex((int*) registers, 1, 0);
+#else
+    __cpuid_count(1, 0, registers[0], registers[1], registers[2], registers[3]);
+#endif
+    bool has_avx = (registers[2] & (1u << 27)) && (registers[2] & (1u << 28));         // OSXSAVE and AVX
+    if (has_avx) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long long enabled_state = _xgetbv(0);
+#else
+        unsigned int xcr0_low;
+        unsigned int xcr0_high;
+        __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+        unsigned long long enabled_state = xcr0_low;
+#endif
+        has_avx = (enabled_state & 6) == 6;                                             // The OS saves both the SSE and the AVX registers
+    }
+#if defined(_MSC_VER) && !defined(__clang__)
+    __cpuidex((int*) registers, 7, 0);
+#else
+    __cpuid_count(7, 0, registers[0], registers[1], registers[2], registers[3]);
+#endif
+    if (has_avx && (registers[1] & (1u << 5))) {
+        level = RAY_PACKET_AVX2;
+    }
+#endif
+    return (ray_packet_level) level;
+}
+
+
+// Walks the given BVH with a whole packet at once, the same way bvh_closest_hit() walks it with one ray, using the given version of the tests
+// The packet goes into a node if any of its rays hit the node's box, and into the child that one of its rays gets to first when both are hit.
+// Nodes saved for later get their boxes tested again when they come off the stack, since the rays' closest hits may have gotten closer since
+template <typename tests>
+__host__ void trace_ray_packet_with(ray_packet* packet, bvh_node* nodes, int num_nodes, triangle_record* triangles, ray_packet_hits* hits) {
+    for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+        hits->t[i] = INFINITY;
+        hits->u[i] = 0;
+        hits->v[i] = 0;
+        hits->triangle[i] = -1;
+    }
+    if (num_nodes == 0) {
+        return;
+    }
+
+    alignas(32) real left_enter[RAY_PACKET_SIZE];
+    alignas(32) real right_enter[RAY_PACKET_SIZE];
+    int all_rays = (1 << packet->num_rays) - 1;
+    int node_mask = tests::test_box(packet, &nodes[0].bounds, hits->t, all_rays, left_enter);
+    if (node_mask == 0) {
+        return;
+    }
+
+    int stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        bvh_node* node = &nodes[node_index];
+        if (node->is_leaf()) {
+            for (int i = node->offset; i < node->offset + node->num_triangles; i++) {
+                tests::test_triangle(packet, &triangles[i], i, node_mask, hits);
+            }
+        } else {
+            int left_index = node_index + 1;
+            int right_index = node->offset;
+            int left_mask = tests::test_box(packet, &nodes[left_index].bounds, hits->t, node_mask, left_enter);
+            int right_mask = tests::test_box(packet, &nodes[right_index].bounds, hits->t, node_mask, right_enter);
+            if (left_mask != 0 && right_mask != 0) {
+                real left_nearest = INFINITY;
+                real right_nearest = INFINITY;
+                for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+                    left_nearest = fmin(left_nearest, left_enter[i]);                     // Rays that missed have INFINITY here
+                    right_nearest = fmin(right_nearest, right_enter[i]);
+                }
+                bool left_first = left_nearest <= right_nearest;
+                stack[stack_size++] = left_first ? right_index : left_index;
+                node_index = left_first ? left_index : right_index;
+                node_mask = left_first ? left_mask : right_mask;
+                continue;
+            }
+            if (left_mask != 0 || right_mask != 0) {
+                node_index = left_mask != 0 ? left_index : right_index;
+                node_mask = left_mask | right_mask;
+                continue;
+            }
+        }
+
+        bool found = false;
+        while (stack_size > 0 && !found) {
+            node_index = stack[--stack_size];
+            node_mask = tests::test_box(packet, &nodes[node_index].bounds, hits->t, all_rays, left_enter);
+            found = node_mask != 0;
+        }
+        if (!found) {
+            break;
+        }
+    }
+}
+
+
+// Finds the closest hit of every ray in the given packet in the given BVH, using the given version of the tests (which has to be one this CPU can
+// run, see ray_packet_cpu_level()), and writes them to results (one per ray, in the same order the rays went into the packet)
+__host__ void trace_ray_packet(ray_packet* packet, bvh_node* nodes, int num_nodes, triangle_record* triangles, ray_packet_level level,
+                               collision* results) {
+    ray_packet_hits hits;
+#ifdef RAY_PACKET_X86
+    if (level == RAY_PACKET_AVX2) {
+        trace_ray_packet_with<ray_packet_avx2>(packet, nodes, num_nodes, triangles, &hits);
+    } else if (level == RAY_PACKET_SSE) {
+        trace_ray_packet_with<ray_packet_sse>(packet, nodes, num_nodes, triangles, &hits);
+    } else {
+        trace_ray_packet_with<ray_packet_scalar>(packet, nodes, num_nodes, triangles, &hits);
+    }
+#else
+    trace_ray_packet_with<ray_packet_scalar>(packet, nodes, num_nodes, triangles, &hits);
+#endif
+
+    for (int i = 0; i < packet->num_rays; i++) {
+        collision result;
+        if (hits.triangle[i] != -1) {
+            result.has_collision = true;
+            result.collision_distance = hits.t[i];
+            result.collision_point = vec3(packet->origin_x[i], packet->origin_y[i], packet->origin_z[i])
+                                         .add(vec3(packet->direction_x[i], packet->direction_y[i], packet->direction_z[i]).scale(hits.t[i]));
+            result.barycentric_u = hits.u[i];
+            result.barycentric_v = hits.v[i];
+            result.triangle_index = hits.triangle[i];
+        }
+        results[i] = result;
+    }
+}
+
+
+__device__ __host__ ray generate_camera_ray(camera* curr_cam, dimensions* img_dim, int pixel_x, int pixel_y);         // In Main.hip
+
+
+// Traces the primary rays of a camera looking into a BVH over the given number of random triangles at several resolutions, one ray at a time and
+// then in 4x2-pixel packets with every version of the packet tests this CPU can run, and prints how many rays per second each got through and
+// how many rays the packets disagreed with single rays on (which has to be 0, see the top of this file)
+__host__ void benchmark_ray_packets(int num_triangles) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, &random_state);
+    bvh tree = build_bvh(triangles, num_triangles);
+    ray_packet_level cpu_level = ray_packet_cpu_level();
+    const char* level_names[3] = {"scalar", "sse", "avx2"};
+    printf("ray packet benchmark: %i triangles, best packet tests on this cpu: %s\n", num_triangles, level_names[cpu_level]);
+
+    int resolutions[4][2] = {{160, 120}, {320, 240}, {640, 480}, {1280, 720}};
+    for (int resolution = 0; resolution < 4; resolution++) {
+        int width = resolutions[resolution][0];
+        int height = resolutions[resolution][1];
+        int num_pixels = width * height;
+        camera cam = camera(vec3(0, 0, 0), vec3(0, 0, 0), (real) width);
+        dimensions dims = dimensions(width, height);
+
+        collision* single_hits = new collision[num_pixels];
+        auto single_start = std::chrono::high_resolution_clock::now();
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                ray r = generate_camera_ray(&cam, &dims, x, y);
+                single_hits[y * width + x] = bvh_closest_hit_moller_trumbore(&r, tree.nodes, tree.num_nodes, triangles, INFINITY);
+            }
+        }
+        auto single_end = std::chrono::high_resolution_clock::now();
+        double single_ms = std::chrono::duration_cast<std::chrono::microseconds>(single_end - single_start).count() / 1000.0;
+        printf("  %ix%i: single rays %.2f Mrays/s", width, height, num_pixels / single_ms / 1000.0);
+
+        for (int level = RAY_PACKET_SCALAR; level <= cpu_level; level++) {
+            int num_mismatches = 0;
+            auto packet_start = std::chrono::high_resolution_clock::now();
+            for (int tile_y = 0; tile_y < height; tile_y += 2) {
+                for (int tile_x = 0; tile_x < width; tile_x += 4) {
+                    ray rays[RAY_PACKET_SIZE];
+                    int pixels[RAY_PACKET_SIZE];
+                    int num_rays = 0;
+                    for (int y = tile_y; y < tile_y + 2 && y < height; y++) {
+                        for (int x = tile_x; x < tile_x + 4 && x < width; x++) {
+                            pixels[num_rays] = y * width + x;
+                            rays[num_rays++] = generate_camera_ray(&cam, &dims, x, y);
+                        }
+                    }
+                    ray_packet packet = make_ray_packet(rays, num_rays);
+                    collision results[RAY_PACKET_SIZE];
+                    trace_ray_packet(&packet, tree.nodes, tree.num_nodes, triangles, (ray_packet_level) level, results);
+                    for (int i = 0; i < num_rays; i++) {
+                        collision* single = &single_hits[pixels[i]];
+                        if (results[i].has_collision != single->has_collision ||
+                            (single->has_collision && results[i].collision_distance != single->collision_distance)) {
+                            num_mismatches++;
+                        }
+                    }
+                }
+            }
+            auto packet_end = std::chrono::high_resolution_clock::now();
+            double packet_ms = std::chrono::duration_cast<std::chrono::microseconds>(packet_end - packet_start).count() / 1000.0;
+            printf(", %s packets %.2f Mrays/s (%.2fx, %i mismatch(es))", level_names[level], num_pixels / packet_ms / 1000.0, single_ms / packet_ms,
+                   num_mismatches);
+            assert(num_mismatches == 0);
+        }
+        printf("\n");
+        delete[] single_hits;
+    }
+
+    delete[] tree.nodes;
+    delete[] triangles;
+}
@@ -0,0 +1,438 @@
+// This file has the spatial split BVH (SBVH) builder, for scenes with big, long, thin triangles (like the walls, floors, and beams of a building)
+// The regular builder (see build_bvh_node()) only ever splits up the list of triangles ("object splits"), so a long triangle always ends up whole
+// in one child, and that child's box has to stretch all the way around it -- so the two children's boxes overlap a lot, and a ray going through
+// the overlap has to go into both of them
+// The SBVH builder can also cut space itself ("spatial splits"): a plane is picked, and any triangle crossing it goes into both children, with
+// each child's copy of it (a "reference") only counting the part of the triangle on its own side. The children's boxes then don't overlap at all,
+// at the cost of some triangles being stored more than once. That growth is capped by a memory budget: once the references reach
+// (1 + memory_budget) times the number of triangles, only object splits are used
+// The result is a regular bvh_node array over its own array of triangle records (where duplicated triangles show up once per leaf they are in),
+// so it is traced with the exact same code as any other BVH
+
+#ifndef SBVH_MEMORY_BUDGET
+#define SBVH_MEMORY_BUDGET 0.5          // The default memory budget, how many extra references there can be, as a fraction of the triangles
+#endif
+#define SBVH_OVERLAP_THRESHOLD 1e-5     // Spatial splits are only tried at nodes whose best object split's children overlap by more than this
+                                        // fraction of the root's area, since with less overlap than that they are almost never better
+
+// One reference to a triangle, or to the part of it inside bounds when the triangle has been cut by spatial splits
+struct sbvh_reference {
+    bounding_box bounds;
+    int triangle;
+};
+
+// Everything the builder needs to keep track of while it recursively builds the tree
+struct sbvh_build_state {
+    triangle_record* triangles;
+    bvh_node* nodes;
+    int num_nodes;
+    int* leaf_triangles;                // The triangle index of every reference that ended up in a leaf, in leaf order
+    int num_leaf_triangles;
+    int num_references;                 // How many references there are across the whole tree so far (triangles, plus one per duplicate)
+    int max_references;                 // The budget: no spatial split is allowed to make num_references go above this
+    real root_area;
+};
+
+// The outcome of SBVH as a whole: a tree, and the triangle records its leaves point into
+struct sbvh {
+    bvh tree;
+    triangle_record* triangles;
+    int num_triangles;                  // The number of records in triangles, which counts every duplicate
+};
+
+
+// Returns the given vector with its component along the given axis changed to value
+__host__ vec3 sbvh_with_component(vec3 v, int axis, real value) {
+    return vec3(axis == 0 ? value : v.x, axis == 1 ? value : v.y, axis == 2 ? value : v.z);
+}
+
+
+// Returns the part of box a that is also inside box b (empty if they don't overlap)
+__host__ bounding_box sbvh_clip_box(bounding_box a, bounding_box b) {
+    bounding_box result = bounding_box(vec3(fmax(a.min.x, b.min.x), fmax(a.min.y, b.min.y), fmax(a.min.z, b.min.z)),
+                                       vec3(fmin(a.max.x, b.max.x), fmin(a.max.y, b.max.y), fmin(a.max.z, b.max.z)));
+    if (result.min.x > result.max.x || result.min.y > result.max.y || result.min.z > result.max.z) {
+        return bounding_box();
+    }
+    return result;
+}
+
+
+// Cuts the given reference with the plane at position along axis, finding the box around the part of its triangle on each side of the plane
+// Walks the triangle's three edges, putting every corner on the side(s) it is on and every point where an edge crosses the plane on both sides,
+// and then keeps each side's box inside the reference's own box (since the reference may already be just a piece of the triangle)
+__host__ void split_sbvh_reference(triangle_record* tri, sbvh_reference reference, int axis, real position, sbvh_reference* left,
+                                   sbvh_reference* right) {
+    vec3 corners[3] = {tri->v0, tri->v0.add(tri->e1), tri->v0.add(tri->e2)};
+    bounding_box left_bounds;
+    bounding_box right_bounds;
+    for (int i = 0; i < 3; i++) {
+        vec3 a = corners[i];
+        vec3 b = corners[(i + 1) % 3];
+        real a_position = a.component(axis);
+        real b_position = b.component(axis);
+        if (a_position <= position) {
+            left_bounds.grow(a);
+        }
+        if (a_position >= position) {
+            right_bounds.grow(a);
+        }
+        if ((a_position < position && b_position > position) || (a_position > position && b_position < position)) {
+            real t = (position - a_position) / (b_position - a_position);
+            vec3 crossing = sbvh_with_component(a.add(b.sub(a).scale(t)), axis, position);
+            left_bounds.grow(crossing);
+            right_bounds.grow(crossing);
+        }
+    }
+
+    bounding_box left_side = reference.bounds;
+    left_side.max = sbvh_with_component(left_side.max, axis, position);
+    bounding_box right_side = reference.bounds;
+    right_side.min = sbvh_with_component(right_side.min, axis, position);
+    left->bounds = sbvh_clip_box(left_bounds, left_side);
+    left->triangle = reference.triangle;
+    right->bounds = sbvh_clip_box(right_bounds, right_side);
+    right->triangle = reference.triangle;
+}
+
+
+// Returns which of the BVH_BINS spatial bins (equal slices of the node's box along axis) the given position falls into
+__host__ int sbvh_spatial_bin(real position, real axis_min, real bin_width) {
+    int bin = (int) ((position - axis_min) / bin_width);
+    return bin < 0 ? 0 : (bin >= BVH_BINS ? BVH_BINS - 1 : bin);
+}
+
+
+// Fills in the node at the given index with the given references, splitting it (and building its children too) when a split is expected to be
+// faster than testing every reference. Takes ownership of references and deletes it once done with it
+// Like build_bvh_node(), the best binned object split is found by SAH. Then, if that split's children overlap by much, spatial splits are also
+// tried: the node's box is cut into BVH_BINS equal slices, every reference is chopped up across the slices it spans, and each boundary between
+// slices is scored the same way, with every reference that crosses it counted on both sides
+__host__ void build_sbvh_node(sbvh_build_state* state, int node_index, sbvh_reference* references, int count, int depth) {
+    bvh_node* node = &state->nodes[node_index];
+
+    bounding_box bounds;
+    bounding_box centroid_bounds;
+    for (int i = 0; i < count; i++) {
+        bounds.grow(references[i].bounds);
+        centroid_bounds.grow(references[i].bounds.center());
+    }
+    node->bounds = bounds;
+    node->num_triangles = count;
+
+    // Finding the best object split, the same way as build_bvh_node()
+    real parent_area = bounds.surface_area();
+    real best_cost = INFINITY;
+    int best_axis = -1;
+    int best_split = 0;
+    bool best_is_spatial = false;
+    int object_axis = -1;               // The best object split, kept even if a spatial split beats it, in case that one doesn't work out
+    int object_split = 0;
+    bounding_box best_object_left;
+    bounding_box best_object_right;
+    for (int axis = 0; count > 1 && depth < BVH_MAX_DEPTH && axis < 3; axis++) {
+        real axis_min = centroid_bounds.min.component(axis);
+        real axis_extent = centroid_bounds.max.component(axis) - axis_min;
+        if (axis_extent <= 0) {
+            continue;
+        }
+
+        int bin_counts[BVH_BINS] = {0};
+        bounding_box bin_bounds[BVH_BINS];
+        for (int i = 0; i < count; i++) {
+            int bin = bvh_bin_index(references[i].bounds.center(), axis, axis_min, axis_extent);
+            bin_counts[bin]++;
+            bin_bounds[bin].grow(references[i].bounds);
+        }
+
+        bounding_box right_boxes[BVH_BINS];
+        int right_counts[BVH_BINS];
+        bounding_box right_bounds;
+        int right_count = 0;
+        for (int split = BVH_BINS - 1; split > 0; split--) {
+            right_bounds.grow(bin_bounds[split]);
+            right_count += bin_counts[split];
+            right_boxes[split] = right_bounds;
+            right_counts[split] = right_count;
+        }
+
+        bounding_box left_bounds;
+        int left_count = 0;
+        for (int split = 1; split < BVH_BINS; split++) {
+            left_bounds.grow(bin_bounds[split - 1]);
+            left_count += bin_counts[split - 1];
+            if (left_count == 0 || right_counts[split] == 0) {
+                continue;
+            }
+            real cost = BVH_TRAVERSAL_COST +
+                        (left_bounds.surface_area() * left_count + right_boxes[split].surface_area() * right_counts[split]) / parent_area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+                object_axis = axis;
+                object_split = split;
+                best_object_left = left_bounds;
+                best_object_right = right_boxes[split];
+            }
+        }
+    }
+
+    // Trying spatial splits, if the object split's children overlap enough to make it worth it
+    bounding_box overlap = sbvh_clip_box(best_object_left, best_object_right);
+    bool try_spatial = best_axis != -1 && !overlap.is_empty() && overlap.surface_area() / state->root_area > SBVH_OVERLAP_THRESHOLD;
+    for (int axis = 0; try_spatial && axis < 3; axis++) {
+        real axis_min = bounds.min.component(axis);
+        real bin_width = (bounds.max.component(axis) - axis_min) / BVH_BINS;
+        if (bin_width <= 0) {
+            continue;
+        }
+
+        int entries[BVH_BINS] = {0};                                                    // How many references start in each slice
+        int exits[BVH_BINS] = {0};                                                      // How many references end in each slice
+        bounding_box bin_bounds[BVH_BINS];
+        for (int i = 0; i < count; i++) {
+            int first_bin = sbvh_spatial_bin(references[i].bounds.min.component(axis), axis_min, bin_width);
+            int last_bin = sbvh_spatial_bin(references[i].bounds.max.component(axis), axis_min, bin_width);
+            entries[first_bin]++;
+            exits[last_bin]++;
+
+            // Chopping the reference up at every slice boundary it crosses, and growing each slice by just its own piece
+            sbvh_reference rest = references[i];
+            for (int bin = first_bin; bin < last_bin; bin++) {
+                sbvh_reference piece;
+                split_sbvh_reference(&state->triangles[rest.triangle], rest, axis, axis_min + (bin + 1) * bin_width, &piece, &rest);
+                bin_bounds[bin].grow(piece.bounds);
+            }
+            bin_bounds[last_bin].grow(rest.bounds);
+        }
+
+        real right_areas[BVH_BINS];
+        int right_counts[BVH_BINS];
+        bounding_box right_bounds;
+        int right_count = 0;
+        for (int split = BVH_BINS - 1; split > 0; split--) {
+            right_bounds.grow(bin_bounds[split]);
+            right_count += exits[split];
+            right_areas[split] = right_bounds.surface_area();
+            right_counts[split] = right_count;
+        }
+
+        bounding_box left_bounds;
+        int left_count = 0;
+        for (int split = 1; split < BVH_BINS; split++) {
+            left_bounds.grow(bin_bounds[split - 1]);
+            left_count += entries[split - 1];
+            int num_duplicates = left_count + right_counts[split] - count;
+            if (left_count == 0 || right_counts[split] == 0 || state->num_references + num_duplicates > state->max_references) {
+                continue;
+            }
+            real cost = BVH_TRAVERSAL_COST + (left_bounds.surface_area() * left_count + right_areas[split] * right_counts[split]) / parent_area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+                best_is_spatial = true;
+            }
+        }
+    }
+
+    if (best_axis == -1 || (count <= BVH_MAX_LEAF_SIZE && best_cost >= count)) {
+        // A leaf
+        node->offset = state->num_leaf_triangles;
+        for (int i = 0; i < count; i++) {
+            state->leaf_triangles[state->num_leaf_triangles++] = references[i].triangle;
+        }
+        delete[] references;
+        return;
+    }
+
+    // Sorting the references into the two children (with room for every reference to end up on both sides of a spatial split)
+    sbvh_reference* left = new sbvh_reference[count];
+    sbvh_reference* right = new sbvh_reference[count];
+    int left_count = 0;
+    int right_count = 0;
+    if (best_is_spatial) {
+        real axis_min = bounds.min.component(best_axis);
+        real bin_width = (bounds.max.component(best_axis) - axis_min) / BVH_BINS;
+        real position = axis_min + best_split * bin_width;
+        for (int i = 0; i < count; i++) {
+            int first_bin = sbvh_spatial_bin(references[i].bounds.min.component(best_axis), axis_min, bin_width);
+            int last_bin = sbvh_spatial_bin(references[i].bounds.max.component(best_axis), axis_min, bin_width);
+            if (last_bin < best_split) {
+                left[left_count++] = references[i];
+            } else if (first_bin >= best_split) {
+                right[right_count++] = references[i];
+            } else {
+                sbvh_reference left_piece;
+                sbvh_reference right_piece;
+                split_sbvh_reference(&state->triangles[references[i].triangle], references[i], best_axis, position, &left_piece, &right_piece);
+                // A piece can come out empty when the triangle itself only touches the plane, in which case it just goes on the other side
+                if (!left_piece.bounds.is_empty()) {
+                    left[left_count++] = left_piece;
+                }
+                if (!right_piece.bounds.is_empty()) {
+                    right[right_count++] = right_piece;
+                }
+                if (left_piece.bounds.is_empty() && right_piece.bounds.is_empty()) {
+                    left[left_count++] = references[i];
+                }
+            }
+        }
+        state->num_references += left_count + right_count - count;
+    }
+    if (!best_is_spatial || left_count == 0 || right_count == 0) {
+        // An object split (or a spatial split that turned out to put everything on one side, which falls back to the best object split)
+        if (best_is_spatial) {
+            state->num_references -= left_count + right_count - count;
+        }
+        left_count = 0;
+        right_count = 0;
+        real axis_min = centroid_bounds.min.component(object_axis);
+        real axis_extent = centroid_bounds.max.component(object_axis) - axis_min;
+        for (int i = 0; i < count; i++) {
+            if (bvh_bin_index(references[i].bounds.center(), object_axis, axis_min, axis_extent) < object_split) {
+                left[left_count++] = references[i];
+            } else {
+                right[right_count++] = references[i];
+            }
+        }
+    }
+    delete[] references;
+
+    int left_index = state->num_nodes++;
+    build_sbvh_node(state, left_index, left, left_count, depth + 1);
+    int right_index = state->num_nodes++;
+    build_sbvh_node(state, right_index, right, right_count, depth + 1);
+
+    node = &state->nodes[node_index];
+    node->offset = right_index;
+    node->num_triangles = 0;
+}
+
+
+// Builds an SBVH over the given triangles, which may use up to (1 + memory_budget) times as many triangle records as there are triangles (see
+// SBVH_MEMORY_BUDGET). The given triangles are left alone, and the result has its own copy of them in the leaves' order
+__host__ sbvh build_sbvh(triangle_record* triangles, int num_triangles, real memory_budget) {
+    sbvh result;
+    result.tree.nodes = nullptr;
+    result.tree.num_nodes = 0;
+    result.triangles = nullptr;
+    result.num_triangles = 0;
+    if (num_triangles == 0) {
+        return result;
+    }
+
+    sbvh_build_state state;
+    state.triangles = triangles;
+    state.max_references = num_triangles + (int) (num_triangles * memory_budget);
+    state.num_references = num_triangles;
+    state.nodes = new bvh_node[2 * state.max_references - 1];                           // Each leaf holds at least one reference
+    state.num_nodes = 1;
+    state.leaf_triangles = new int[state.max_references];
+    state.num_leaf_triangles = 0;
+
+    sbvh_reference* references = new sbvh_reference[num_triangles];
+    bounding_box root_bounds;
+    for (int i = 0; i < num_triangles; i++) {
+        references[i].bounds = triangle_bounds(&triangles[i]);
+        references[i].triangle = i;
+        root_bounds.grow(references[i].bounds);
+    }
+    state.root_area = root_bounds.surface_area();
+    build_sbvh_node(&state, 0, references, num_triangles, 0);                           // Deletes references when done with it
+
+    result.num_triangles = state.num_leaf_triangles;
+    result.triangles = new triangle_record[state.num_leaf_triangles];
+    for (int i = 0; i < state.num_leaf_triangles; i++) {
+        result.triangles[i] = triangles[state.leaf_triangles[i]];
+    }
+    result.tree.nodes = state.nodes;
+    result.tree.num_nodes = state.num_nodes;
+    delete[] state.leaf_triangles;
+    return result;
+}
+
+
+// Adds up how much the two children of every interior node overlap, as a fraction of the root's area (0 means no two siblings ever overlap, and
+// the bigger it is, the more often rays have to go into both children of a node)
+__host__ real bvh_node_overlap(bvh_node* nodes, int num_nodes) {
+    if (num_nodes == 0 || nodes[0].bounds.surface_area() <= 0) {
+        return 0;
+    }
+    real overlap = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        if (!nodes[i].is_leaf()) {
+            bounding_box both = sbvh_clip_box(nodes[i + 1].bounds, nodes[nodes[i].offset].bounds);
+            overlap += both.is_empty() ? 0 : both.surface_area();
+        }
+    }
+    return overlap / nodes[0].bounds.surface_area();
+}
+
+
+// Makes a benchmark scene of long, thin triangles, like the floors, walls, and beams of a building: each one runs a long way along x or y but is
+// thin across the other two axes
+__host__ triangle_record* make_architectural_benchmark_triangles(int num_triangles, uint32_t* random_state) {
+    triangle_record* triangles = new triangle_record[num_triangles];
+    for (int i = 0; i < num_triangles; i++) {
+        int axis = i % 2;
+        vec3 a = vec3(benchmark_random(random_state) * 100 - 50, benchmark_random(random_state) * 100 - 50, benchmark_random(random_state) * 100 + 10);
+        real length = 10 + benchmark_random(random_state) * 40;
+        vec3 along = sbvh_with_component(vec3(0, 0, 0), axis, length);
+        real width = (benchmark_random(random_state) < 0.5 ? -1 : 1) * (0.25 + benchmark_random(random_state));
+        vec3 across = sbvh_with_component(vec3(0, 0, benchmark_random(random_state) * 2 - 1), 1 - axis, width);
+        triangles[i] = make_triangle_record(a, a.add(along), a.add(along.scale(0.5)).add(across), 0, i);
+    }
+    return triangles;
+}
+
+
+// Builds a regular SAH BVH and an SBVH over a scene of the given number of long, thin triangles, and prints how long each took to build, how much
+// their nodes overlap, how many references the SBVH needed, each tree's SAH cost, how long each took to trace the given number of rays, and how
+// many rays the two disagreed on (which should always be 0)
+__host__ void benchmark_sbvh(int num_triangles, int num_rays, real memory_budget) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* triangles = make_architectural_benchmark_triangles(num_triangles, &random_state);
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+
+    auto sbvh_build_start = std::chrono::high_resolution_clock::now();
+    sbvh spatial = build_sbvh(triangles, num_triangles, memory_budget);
+    auto sbvh_build_end = std::chrono::high_resolution_clock::now();
+
+    auto bvh_build_start = std::chrono::high_resolution_clock::now();
+    bvh tree = build_bvh(triangles, num_triangles);
+    auto bvh_build_end = std::chrono::high_resolution_clock::now();
+
+    collision* bvh_hits = new collision[num_rays];
+    auto bvh_trace_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_rays; i++) {
+        bvh_hits[i] = bvh_closest_hit(&rays[i], tree.nodes, tree.num_nodes, triangles, INFINITY);
+    }
+    auto bvh_trace_end = std::chrono::high_resolution_clock::now();
+
+    auto sbvh_trace_start = std::chrono::high_resolution_clock::now();
+    int num_mismatches = count_hit_mismatches(rays, num_rays, bvh_hits, spatial.tree.nodes, spatial.tree.num_nodes, spatial.triangles);
+    auto sbvh_trace_end = std::chrono::high_resolution_clock::now();
+
+    double bvh_build_ms = std::chrono::duration_cast<std::chrono::microseconds>(bvh_build_end - bvh_build_start).count() / 1000.0;
+    double sbvh_build_ms = std::chrono::duration_cast<std::chrono::microseconds>(sbvh_build_end - sbvh_build_start).count() / 1000.0;
+    double bvh_trace_ms = std::chrono::duration_cast<std::chrono::microseconds>(bvh_trace_end - bvh_trace_start).count() / 1000.0;
+    double sbvh_trace_ms = std::chrono::duration_cast<std::chrono::microseconds>(sbvh_trace_end - sbvh_trace_start).count() / 1000.0;
+    printf("sbvh benchmark: %i long, thin triangles, %i rays, memory budget %.2f\n", num_triangles, num_rays, (double) memory_budget);
+    printf("  sah bvh: build %.3f ms, overlap %.2f, sah cost %.2f, trace %.3f ms\n", bvh_build_ms, (double) bvh_node_overlap(tree.nodes, tree.num_nodes),
+           (double) bvh_sah_cost(tree.nodes, tree.num_nodes), bvh_trace_ms);
+    printf("  sbvh: build %.3f ms, overlap %.2f, sah cost %.2f, trace %.3f ms\n", sbvh_build_ms,
+           (double) bvh_node_overlap(spatial.tree.nodes, spatial.tree.num_nodes), (double) bvh_sah_cost(spatial.tree.nodes, spatial.tree.num_nodes),
+           sbvh_trace_ms);
+    printf("  %i references for %i triangles (%.2fx), %i mismatch(es)\n", spatial.num_triangles, num_triangles,
+           (double) spatial.num_triangles / num_triangles, num_mismatches);
+    assert(num_mismatches == 0);
+
+    delete[] tree.nodes;
+    delete[] spatial.tree.nodes;
+    delete[] spatial.triangles;
+    delete[] bvh_hits;
+    delete[] triangles;
+    delete[] rays;
+}
@@ -0,0 +1,566 @@
+// This file has the scene packer, which flattens a whole scene (camera, image dimensions, lights, materials, triangle records, and the BVH over them)
+// into one contiguous block of bytes so that it can be sent to the GPU with a single copy, instead of one hipMalloc and one hipMemcpy for every
+// member of every struct
+// Inside the block, nothing points to anything else with a real pointer (a real pointer is only valid in the memory it was made in, so a CPU pointer
+// copied to the GPU points to garbage) -- instead, every array is found by its offset, in bytes, from the start of the block. That makes the block
+// "relocatable": it works the same no matter where it gets copied to, whether that's GPU memory or just somewhere else in CPU memory
+
+// The header at the very start of every packed scene, which holds the small per-scene structs directly and the offsets of all of the arrays that
+// come after it
+struct packed_scene {
+    camera cam;
+    dimensions img_dimensions;
+
+    int num_lights;
+    int num_materials;
+    int num_triangles;
+    int num_bvh_nodes;
+    int num_wide_bvh_nodes;             // Only one of the two BVHs is ever packed (the wide one if compiled with -DUSE_WIDE_BVH), the other has 0 nodes
+    int num_paired_bvh_nodes;           // Replaces the regular BVH when compiled with -DBVH_NODE_LAYOUT (see bvh_layout.cpp), 0 otherwise
+    int num_bvh_parents;                // The parent of every BVH node, only packed for the stackless traversal (see bvh_stackless.cpp)
+    int num_triangle_blocks;            // Only packed with -DUSE_TRIANGLE_BLOCKS, where the BVH nodes are the blocked BVH's (see triangle_blocks.cpp)
+
+    accelerator_type accelerator;       // Which structure the scene gets traced with (see scene_closest_hit()), only the one picked gets packed
+    int num_grid_levels;
+    int num_grid_cells;
+    int num_grid_references;
+
+    // Only used by instanced scenes (see pack_instanced_scene()), which are traced through the TLAS instead, and whose mesh BVHs all sit in the
+    // regular BVH node array one after another. For a regular scene these are all 0
+    int num_meshes;
+    int num_instances;
+    int num_tlas_nodes;                 // There is always room for 2 * num_instances - 1 TLAS nodes, the most a TLAS can have, so that a moved
+                                        // instance's new TLAS can be written over the old one in place (see update_packed_instances())
+
+    size_t total_size;                  // The size of the whole block in bytes, this header included
+
+    // Offsets (in bytes, counted from the start of this header) of each array stored in the block
+    size_t lights_offset;
+    size_t materials_offset;
+    size_t triangles_offset;
+    size_t bvh_nodes_offset;
+    size_t wide_bvh_nodes_offset;
+    size_t paired_bvh_nodes_offset;
+    size_t bvh_parents_offset;
+    size_t triangle_blocks_offset;
+    size_t grid_levels_offset;
+    size_t grid_cells_offset;
+    size_t grid_references_offset;
+    size_t meshes_offset;
+    size_t instances_offset;
+    size_t tlas_nodes_offset;
+    size_t tlas_instances_offset;
+
+    // Turns an offset into an actual pointer, relative to wherever this block currently lives
+    __device__ __host__ char* at_offset(size_t offset) {
+        return (char*) this + offset;
+    }
+
+    __device__ __host__ light* get_lights() {
+        return (light*) at_offset(lights_offset);
+    }
+
+    __device__ __host__ material* get_materials() {
+        return (material*) at_offset(materials_offset);
+    }
+
+    __device__ __host__ triangle_record* get_triangles() {
+        return (triangle_record*) at_offset(triangles_offset);
+    }
+
+    __device__ __host__ bvh_node* get_bvh_nodes() {
+        return (bvh_node*) at_offset(bvh_nodes_offset);
+    }
+
+    __device__ __host__ wide_bvh_node* get_wide_bvh_nodes() {
+        return (wide_bvh_node*) at_offset(wide_bvh_nodes_offset);
+    }
+
+    __device__ __host__ paired_bvh_node* get_paired_bvh_nodes() {
+        return (paired_bvh_node*) at_offset(paired_bvh_nodes_offset);
+    }
+
+    __device__ __host__ int* get_bvh_parents() {
+        return (int*) at_offset(bvh_parents_offset);
+    }
+
+    __device__ __host__ triangle_block* get_triangle_blocks() {
+        return (triangle_block*) at_offset(triangle_blocks_offset);
+    }
+
+    // The grid accelerator, pointing into this block
+    __device__ __host__ grid_accelerator get_grid() {
+        grid_accelerator result;
+        result.levels = (grid_level*) at_offset(grid_levels_offset);
+        result.num_levels = num_grid_levels;
+        result.cells = (grid_cell*) at_offset(grid_cells_offset);
+        result.num_cells = num_grid_cells;
+        result.references = (int*) at_offset(grid_references_offset);
+        result.num_references = num_grid_references;
+        return result;
+    }
+
+    __device__ __host__ mesh_blas* get_meshes() {
+        return (mesh_blas*) at_offset(meshes_offset);
+    }
+
+    __device__ __host__ mesh_instance* get_instances() {
+        return (mesh_instance*) at_offset(instances_offset);
+    }
+
+    __device__ __host__ bvh_node* get_tlas_nodes() {
+        return (bvh_node*) at_offset(tlas_nodes_offset);
+    }
+
+    __device__ __host__ int* get_tlas_instances() {
+        return (int*) at_offset(tlas_instances_offset);
+    }
+
+    // Everything instanced_closest_hit() needs, pointing into this block
+    __device__ __host__ instanced_view get_instanced_view() {
+        instanced_view result;
+        result.tlas_nodes = get_tlas_nodes();
+        result.num_tlas_nodes = num_tlas_nodes;
+        result.tlas_instances = get_tlas_instances();
+        result.instances = get_instances();
+        result.meshes = get_meshes();
+        result.blas_nodes = get_bvh_nodes();
+        result.triangles = get_triangles();
+        return result;
+    }
+};
+
+#define SCENE_DELTA_CHUNK 4096          // The size, in bytes, of the pieces a scene is compared and re-uploaded in (see upload_scene_delta())
+
+// Counts for a single upload, to keep track of how much is being sent over and how many calls it took to do it
+struct scene_upload_stats {
+    size_t bytes;
+    int allocation_calls;
+    int copy_calls;
+};
+
+
+// Rounds the given offset up to the next multiple of 16 bytes, so that every array in the block starts properly aligned
+__host__ size_t align_offset(size_t offset) {
+    return (offset + 15) & ~((size_t) 15);
+}
+
+
+// Lays out a scene into a single block of CPU memory, given a header with every count already filled in and the arrays to copy in
+// Works out every offset first so we know how big the block needs to be, then copies everything in. Shared by pack_scene() and
+// pack_instanced_scene(), which just differ in what goes into the arrays
+__host__ packed_scene* pack_scene_block(packed_scene header, light* lights, material* materials, triangle_record* records, bvh_node* bvh_nodes,
+                                        wide_bvh_node* wide_bvh_nodes, paired_bvh_node* paired_bvh_nodes, int* bvh_parents,
+                                        triangle_block* triangle_blocks, grid_accelerator* grid, mesh_blas* meshes, mesh_instance* instances,
+                                        bvh_node* tlas_nodes, int* tlas_instances) {
+    int tlas_capacity = header.num_instances > 0 ? 2 * header.num_instances - 1 : 0;
+
+    size_t offset = align_offset(sizeof(packed_scene));
+    header.lights_offset = offset;
+    offset = align_offset(offset + sizeof(light) * header.num_lights);
+    header.materials_offset = offset;
+    offset = align_offset(offset + sizeof(material) * header.num_materials);
+    offset = (offset + alignof(triangle_record) - 1) & ~(alignof(triangle_record) - 1);         // Records line up to whole cache lines
+    header.triangles_offset = offset;
+    offset = align_offset(offset + sizeof(triangle_record) * header.num_triangles);
+    header.bvh_nodes_offset = offset;
+    offset = align_offset(offset + sizeof(bvh_node) * header.num_bvh_nodes);
+    header.wide_bvh_nodes_offset = offset;
+    offset = align_offset(offset + sizeof(wide_bvh_node) * header.num_wide_bvh_nodes);
+    header.paired_bvh_nodes_offset = offset;
+    offset = align_offset(offset + sizeof(paired_bvh_node) * header.num_paired_bvh_nodes);
+    header.bvh_parents_offset = offset;
+    offset = align_offset(offset + sizeof(int) * header.num_bvh_parents);
+    offset = (offset + alignof(triangle_block) - 1) & ~(alignof(triangle_block) - 1);
+    header.triangle_blocks_offset = offset;
+    offset = align_offset(offset + sizeof(triangle_block) * header.num_triangle_blocks);
+    header.grid_levels_offset = offset;
+    offset = align_offset(offset + sizeof(grid_level) * header.num_grid_levels);
+    header.grid_cells_offset = offset;
+    offset = align_offset(offset + sizeof(grid_cell) * header.num_grid_cells);
+    header.grid_references_offset = offset;
+    offset = align_offset(offset + sizeof(int) * header.num_grid_references);
+    header.meshes_offset = offset;
+    offset = align_offset(offset + sizeof(mesh_blas) * header.num_meshes);
+    header.instances_offset = offset;
+    offset = align_offset(offset + sizeof(mesh_instance) * header.num_instances);
+    header.tlas_nodes_offset = offset;
+    offset = align_offset(offset + sizeof(bvh_node) * tlas_capacity);
+    header.tlas_instances_offset = offset;
+    offset = align_offset(offset + sizeof(int) * header.num_instances);
+    header.total_size = offset;
+
+    char* block = new char[header.total_size];
+    memset(block, 0, header.total_size);
+    packed_scene* result = (packed_scene*) block;
+    *result = header;
+
+    // Optional sections (no grid, no instances, ...) have a count of 0 and a null array, and memcpy with a null pointer is undefined even for 0
+    // bytes, so only the sections that are actually there get copied
+    if (header.num_lights > 0) {
+        memcpy(result->get_lights(), lights, sizeof(light) * header.num_lights);
+    }
+    if (header.num_materials > 0) {
+        memcpy(result->get_materials(), materials, sizeof(material) * header.num_materials);
+    }
+    if (header.num_triangles > 0) {
+        memcpy(result->get_triangles(), records, sizeof(triangle_record) * header.num_triangles);
+    }
+    if (header.num_bvh_nodes > 0) {
+        memcpy(result->get_bvh_nodes(), bvh_nodes, sizeof(bvh_node) * header.num_bvh_nodes);
+    }
+    if (header.num_wide_bvh_nodes > 0) {
+        memcpy(result->get_wide_bvh_nodes(), wide_bvh_nodes, sizeof(wide_bvh_node) * header.num_wide_bvh_nodes);
+    }
+    if (header.num_paired_bvh_nodes > 0) {
+        memcpy(result->get_paired_bvh_nodes(), paired_bvh_nodes, sizeof(paired_bvh_node) * header.num_paired_bvh_nodes);
+    }
+    if (header.num_bvh_parents > 0) {
+        memcpy(result->get_bvh_parents(), bvh_parents, sizeof(int) * header.num_bvh_parents);
+    }
+    if (header.num_triangle_blocks > 0) {
+        memcpy(result->get_triangle_blocks(), triangle_blocks, sizeof(triangle_block) * header.num_triangle_blocks);
+    }
+    if (grid != nullptr) {
+        grid_accelerator packed_grid = result->get_grid();
+        if (header.num_grid_levels > 0) {
+            memcpy(packed_grid.levels, grid->levels, sizeof(grid_level) * header.num_grid_levels);
+        }
+        if (header.num_grid_cells > 0) {
+            memcpy(packed_grid.cells, grid->cells, sizeof(grid_cell) * header.num_grid_cells);
+        }
+        if (header.num_grid_references > 0) {
+            memcpy(packed_grid.references, grid->references, sizeof(int) * header.num_grid_references);
+        }
+    }
+    if (header.num_meshes > 0) {
+        memcpy(result->get_meshes(), meshes, sizeof(mesh_blas) * header.num_meshes);
+    }
+    if (header.num_instances > 0) {
+        memcpy(result->get_instances(), instances, sizeof(mesh_instance) * header.num_instances);
+        memcpy(result->get_tlas_instances(), tlas_instances, sizeof(int) * header.num_instances);
+    }
+    if (header.num_tlas_nodes > 0) {
+        memcpy(result->get_tlas_nodes(), tlas_nodes, sizeof(bvh_node) * header.num_tlas_nodes);
+    }
+    return result;
+}
+
+
+// Lays out the given scene into a single block of CPU memory, along with the given kind of accelerator built over it
+// The triangles go in as precomputed triangle records (see build_triangle_records()), since those are all the kernels need -- with a BVH, the
+// records are stored in the BVH's order, so triangle indices in the packed scene don't match the ones in the given triangle_soa (and with an SBVH,
+// there can be more records than triangles, see sbvh.cpp, but each record's source_index still points back to its triangle)
+// If bvh_cache_path isn't null, a BVH gets read from the cache file at that path instead of built when the file matches the scene, or built and
+// saved there when it doesn't (see load_or_build_bvh())
+__host__ packed_scene* pack_scene(camera* cam, dimensions* img_dimensions, light* lights, int num_lights, triangle_soa* triangles,
+                                  accelerator_type accelerator, const char* bvh_cache_path) {
+    int num_tris = triangles->num_triangles;
+    triangle_record* records = nullptr;
+    cached_bvh cached;
+    cached.from_cache = false;
+    cached.triangles = nullptr;
+    cached.nodes = nullptr;
+    bvh tree;
+    tree.nodes = nullptr;
+    tree.num_nodes = 0;
+    wide_bvh wide_tree;
+    wide_tree.nodes = nullptr;
+    wide_tree.num_nodes = 0;
+    paired_bvh paired_tree;
+    paired_tree.nodes = nullptr;
+    paired_tree.num_nodes = 0;
+    blocked_bvh blocked;
+    blocked.nodes = nullptr;
+    blocked.num_nodes = 0;
+    blocked.blocks = nullptr;
+    blocked.num_blocks = 0;
+    grid_accelerator grid;
+    grid.num_levels = 0;
+    grid.num_cells = 0;
+    grid.num_references = 0;
+    if (accelerator == ACCELERATOR_BVH && bvh_cache_path != nullptr) {
+        load_or_build_bvh(bvh_cache_path, triangles, &cached);                         // Records and nodes stay owned by cached
+        records = cached.triangles;
+        tree.nodes = cached.nodes;
+        tree.num_nodes = cached.num_nodes;
+    } else {
+        records = build_triangle_records(triangles);
+    }
+    if (accelerator == ACCELERATOR_SBVH) {
+        // The SBVH has its own copy of the records, with the duplicated ones in it, which is what gets packed
+        sbvh spatial = build_sbvh(records, num_tris, SBVH_MEMORY_BUDGET);
+        delete[] records;
+        records = spatial.triangles;
+        num_tris = spatial.num_triangles;
+        tree = spatial.tree;
+    }
+    if (accelerator == ACCELERATOR_BVH || accelerator == ACCELERATOR_SBVH) {
+        if (accelerator == ACCELERATOR_BVH && bvh_cache_path == nullptr) {
+            tree = build_bvh(records, num_tris);
+        }
+#if defined(USE_WIDE_BVH)
+        wide_tree = collapse_bvh(tree.nodes, tree.num_nodes);
+        tree.num_nodes = 0;                                                             // Only the wide nodes get packed
+#elif defined(USE_TRIANGLE_BLOCKS)
+        blocked = build_triangle_blocks(tree.nodes, tree.num_nodes, records, num_tris);
+#elif defined(USE_PAIRED_BVH)
+        paired_tree = layout_scene_bvh(tree.nodes, tree.num_nodes, records, cam, img_dimensions, BVH_NODE_LAYOUT);
+        tree.num_nodes = 0;                                                             // Only the reordered nodes get packed
+#endif
+    } else if (accelerator == ACCELERATOR_GRID || accelerator == ACCELERATOR_TWO_LEVEL_GRID) {
+        grid = build_grid(records, num_tris, accelerator == ACCELERATOR_TWO_LEVEL_GRID);
+    }
+#if defined(USE_STACKLESS_TRAVERSAL) && !defined(USE_WIDE_BVH) && !defined(USE_TRIANGLE_BLOCKS)
+    int* parents = build_bvh_parents(tree.nodes, tree.num_nodes);
+    int num_parents = tree.num_nodes;
+#else
+    int* parents = nullptr;
+    int num_parents = 0;
+#endif
+
+    packed_scene header;
+    header.cam = *cam;
+    header.img_dimensions = *img_dimensions;
+    header.num_lights = num_lights;
+    header.num_materials = triangles->num_materials;
+    header.num_triangles = num_tris;
+    header.num_bvh_nodes = blocked.nodes != nullptr ? blocked.num_nodes : tree.num_nodes;            // The blocked BVH replaces the regular one
+    header.num_wide_bvh_nodes = wide_tree.num_nodes;
+    header.num_paired_bvh_nodes = paired_tree.num_nodes;
+    header.num_bvh_parents = num_parents;
+    header.num_triangle_blocks = blocked.num_blocks;
+    header.accelerator = accelerator;
+    header.num_grid_levels = grid.num_levels;
+    header.num_grid_cells = grid.num_cells;
+    header.num_grid_references = grid.num_references;
+    header.num_meshes = 0;
+    header.num_instances = 0;
+    header.num_tlas_nodes = 0;
+    packed_scene* result = pack_scene_block(header, lights, triangles->materials, records, blocked.nodes != nullptr ? blocked.nodes : tree.nodes,
+                                            wide_tree.nodes, paired_tree.nodes, parents, blocked.blocks, &grid, nullptr, nullptr, nullptr, nullptr);
+    delete[] parents;
+
+    if (bvh_cache_path != nullptr && accelerator == ACCELERATOR_BVH) {
+        release_cached_bvh(&cached);
+    } else {
+        delete[] records;
+        delete[] tree.nodes;
+    }
+    delete[] wide_tree.nodes;
+    delete[] paired_tree.nodes;
+    delete[] blocked.nodes;
+    delete[] blocked.blocks;
+    if (grid.num_levels > 0) {
+        destroy_grid(&grid);
+    }
+    return result;
+}
+
+
+// Lays out an instanced scene (see instancing.cpp) into a single block of CPU memory, so that the block only holds each unique mesh once no
+// matter how many times it shows up
+// Instanced scenes always use the binary BVHs, even when compiled with -DUSE_WIDE_BVH
+__host__ packed_scene* pack_instanced_scene(camera* cam, dimensions* img_dimensions, light* lights, int num_lights, material* materials,
+                                            int num_materials, instanced_scene* scene) {
+    if (scene->tlas_out_of_date) {
+        build_tlas(scene);
+    }
+
+    packed_scene header;
+    header.cam = *cam;
+    header.img_dimensions = *img_dimensions;
+    header.num_lights = num_lights;
+    header.num_materials = num_materials;
+    header.num_triangles = scene->num_triangles;
+    header.num_bvh_nodes = scene->num_blas_nodes;
+    header.num_wide_bvh_nodes = 0;
+    header.num_paired_bvh_nodes = 0;
+    header.num_bvh_parents = 0;
+    header.num_triangle_blocks = 0;
+    header.accelerator = ACCELERATOR_BVH;
+    header.num_grid_levels = 0;
+    header.num_grid_cells = 0;
+    header.num_grid_references = 0;
+    header.num_meshes = scene->num_meshes;
+    header.num_instances = scene->num_instances;
+    header.num_tlas_nodes = scene->tlas.num_nodes;
+    return pack_scene_block(header, lights, materials, scene->triangles, scene->blas_nodes, nullptr, nullptr, nullptr, nullptr, nullptr,
+                            scene->meshes, scene->instances, scene->tlas.nodes, scene->tlas_instances);
+}
+
+
+// Writes the instances and TLAS of the given instanced scene over the ones in a block it was packed into earlier, after instances have been moved
+// (see set_instance_transform()), without repacking any of the meshes. The scene must still have the same instances it was packed with
+__host__ void update_packed_instances(packed_scene* packed, instanced_scene* scene) {
+    assert(packed->num_instances == scene->num_instances && packed->num_meshes == scene->num_meshes);
+    if (scene->tlas_out_of_date) {
+        build_tlas(scene);
+    }
+
+    packed->num_tlas_nodes = scene->tlas.num_nodes;
+    memcpy(packed->get_instances(), scene->instances, sizeof(mesh_instance) * scene->num_instances);
+    memcpy(packed->get_tlas_nodes(), scene->tlas.nodes, sizeof(bvh_node) * scene->tlas.num_nodes);
+    memcpy(packed->get_tlas_instances(), scene->tlas_instances, sizeof(int) * scene->num_instances);
+}
+
+
+// Finds the closest triangle the given ray hits (closer than t_max) in a packed scene, with whichever accelerator the scene was packed with
+// Every thread of a kernel takes the same branch here, since it only depends on the scene
+__device__ __host__ collision scene_closest_hit(packed_scene* scene, ray* r, real t_max) {
+    if (scene->num_instances > 0) {
+        instanced_view instanced = scene->get_instanced_view();
+        return instanced_closest_hit(r, &instanced, t_max);
+    }
+
+    switch (scene->accelerator) {
+        case ACCELERATOR_BVH:
+        case ACCELERATOR_SBVH:
+#if defined(USE_WIDE_BVH)
+            return wide_bvh_closest_hit(r, scene->get_wide_bvh_nodes(), scene->num_wide_bvh_nodes, scene->get_triangles(), t_max);
+#elif defined(USE_TRIANGLE_BLOCKS)
+            return blocked_bvh_closest_hit(r, scene->get_bvh_nodes(), scene->num_bvh_nodes, scene->get_triangle_blocks(), t_max);
+#elif defined(USE_STACKLESS_TRAVERSAL)
+            return bvh_closest_hit_stackless(r, scene->get_bvh_nodes(), scene->get_bvh_parents(), scene->num_bvh_nodes, scene->get_triangles(),
+                                             t_max);
+#elif defined(USE_PAIRED_BVH)
+            return paired_bvh_closest_hit(r, scene->get_paired_bvh_nodes(), scene->num_paired_bvh_nodes, scene->get_triangles(), t_max);
+#else
+            return bvh_closest_hit(r, scene->get_bvh_nodes(), scene->num_bvh_nodes, scene->get_triangles(), t_max);
+#endif
+        case ACCELERATOR_GRID:
+        case ACCELERATOR_TWO_LEVEL_GRID: {
+            grid_accelerator grid = scene->get_grid();
+            return grid_closest_hit(r, &grid, scene->get_triangles(), t_max);
+        }
+        default:
+            return brute_force_closest_hit(r, scene->get_triangles(), scene->num_triangles, t_max);
+    }
+}
+
+
+// Returns whether the given ray hits anything closer than t_max in a packed scene, with whichever accelerator the scene was packed with, stopping
+// at the first hit it finds (see occlusion.cpp)
+__device__ __host__ bool scene_occluded(packed_scene* scene, ray* r, real t_max) {
+    if (scene->num_instances > 0) {
+        instanced_view instanced = scene->get_instanced_view();
+        return instanced_any_hit(r, &instanced, t_max);
+    }
+
+    switch (scene->accelerator) {
+        case ACCELERATOR_BVH:
+        case ACCELERATOR_SBVH:
+#if defined(USE_WIDE_BVH)
+            return wide_bvh_any_hit(r, scene->get_wide_bvh_nodes(), scene->num_wide_bvh_nodes, scene->get_triangles(), t_max);
+#elif defined(USE_TRIANGLE_BLOCKS)
+            return blocked_bvh_any_hit(r, scene->get_bvh_nodes(), scene->num_bvh_nodes, scene->get_triangle_blocks(), t_max);
+#elif defined(USE_PAIRED_BVH)
+            return paired_bvh_any_hit(r, scene->get_paired_bvh_nodes(), scene->num_paired_bvh_nodes, scene->get_triangles(), t_max);
+#else
+            return bvh_any_hit(r, scene->get_bvh_nodes(), scene->num_bvh_nodes, scene->get_triangles(), t_max);
+#endif
+        case ACCELERATOR_GRID:
+        case ACCELERATOR_TWO_LEVEL_GRID: {
+            grid_accelerator grid = scene->get_grid();
+            return grid_any_hit(r, &grid, scene->get_triangles(), t_max);
+        }
+        default:
+            return triangles_any_hit(r, scene->get_triangles(), 0, scene->num_triangles, t_max);
+    }
+}
+
+
+// Returns whether anything in a packed scene is between the two given points (like a surface point and a light's position), see make_shadow_ray()
+__device__ __host__ bool segment_occluded(packed_scene* scene, vec3 from, vec3 to) {
+    real t_max;
+    ray shadow = make_shadow_ray(from, to, &t_max);
+    return scene_occluded(scene, &shadow, t_max);
+}
+
+
+// Copies a packed scene into the given arena's scene region in one allocation and one copy, and returns the address of the copy (or null if the 
+// arena is out of space)
+// If stats isn't null, the number of bytes and calls used are added to it
+__host__ packed_scene* upload_scene(packed_scene* cpu_scene, memory_arena* arena, scene_upload_stats* stats) {
+    size_t size = cpu_scene->total_size;
+    packed_scene* result = (packed_scene*) arena_allocate(&arena->scene, size, 256);
+    if (result == nullptr) {
+        return nullptr;
+    }
+    arena_copy_from_cpu(arena, result, cpu_scene, size);
+
+    if (stats != nullptr) {
+        stats->bytes += size;
+        stats->allocation_calls += 1;
+        stats->copy_calls += 1;
+    }
+
+    return result;
+}
+
+
+// Same as upload_scene(), but queued on the given stream without waiting for it: the scene is copied into staging (pinned CPU memory with room for
+// the whole scene, which must not be touched again until the copy is done) first, so that the copy to the GPU can run asynchronously from there.
+// Afterwards staging mirrors what is at the returned address, ready for upload_scene_delta()
+__host__ packed_scene* upload_scene_async(packed_scene* cpu_scene, unsigned char* staging, memory_arena* arena, hipStream_t stream,
+                                          scene_upload_stats* stats) {
+    size_t size = cpu_scene->total_size;
+    packed_scene* result = (packed_scene*) arena_allocate(&arena->scene, size, 256);
+    if (result == nullptr) {
+        return nullptr;
+    }
+    memcpy(staging, cpu_scene, size);
+    arena_copy_from_cpu_async(arena, result, staging, size, stream);
+
+    if (stats != nullptr) {
+        stats->bytes += size;
+        stats->allocation_calls += 1;
+        stats->copy_calls += 1;
+    }
+
+    return result;
+}
+
+
+// Brings a scene that was already uploaded to gpu_scene up to date with cpu_scene (which must be the same size), by only copying the
+// SCENE_DELTA_CHUNK-byte chunks that changed since then, queued on the given stream without waiting for them. staging is the pinned CPU mirror
+// of what is at gpu_scene: chunks are compared against it, and the changed ones are copied into it first so the async copies read pinned memory
+// Neighboring changed chunks go over in a single copy. Returns how many bytes were copied (0 if nothing changed). If stats isn't null, the number
+// of bytes and calls used are added to it
+__host__ size_t upload_scene_delta(packed_scene* cpu_scene, unsigned char* staging, packed_scene* gpu_scene, memory_arena* arena, hipStream_t stream,
+                                   scene_upload_stats* stats) {
+    unsigned char* source = (unsigned char*) cpu_scene;
+    size_t size = cpu_scene->total_size;
+    size_t copied = 0;
+    size_t offset = 0;
+    while (offset < size) {
+        size_t chunk = size - offset < SCENE_DELTA_CHUNK ? size - offset : SCENE_DELTA_CHUNK;
+        if (memcmp(staging + offset, source + offset, chunk) == 0) {
+            offset += chunk;
+            continue;
+        }
+
+        // Growing the copy over every changed chunk in a row
+        size_t start = offset;
+        while (offset < size) {
+            chunk = size - offset < SCENE_DELTA_CHUNK ? size - offset : SCENE_DELTA_CHUNK;
+            if (memcmp(staging + offset, source + offset, chunk) == 0) {
+                break;
+            }
+            offset += chunk;
+        }
+        memcpy(staging + start, source + start, offset - start);
+        arena_copy_from_cpu_async(arena, (unsigned char*) gpu_scene + start, staging + start, offset - start, stream);
+        copied += offset - start;
+        if (stats != nullptr) {
+            stats->bytes += offset - start;
+            stats->copy_calls += 1;
+        }
+    }
+    return copied;
+}
+
+
+__host__ void print_upload_stats(scene_upload_stats* stats) {
+    printf("scene upload: %zu bytes, %i allocation call(s), %i copy call(s)\n", stats->bytes, stats->allocation_calls, stats->copy_calls);
+}
@@ -1,48 +1,80 @@
 // A library file with all of the required more-specific structs and their constructors, plus some methods to use on them -- Mostly structs that are 
 // only needed to couple certain specific datatypes together, without any methods to act on them
 
-// A collision class to hold all the necessary information about 
-struct collision {
-    triangle* collision_triangle;
-    color* collision_color;
-    vector* collision_point;
-    double* collision_distance;
-};
-
 // A bounding box struct for creating bounding volume hierarchies (that partition space into volumes to speed up ray-triangle intersection calculation)
-// that holds the array index that correspond to the triangle contained within the bounding box
 // Basically, kind of like bounding boxes in rasterization: instead of looking at every triangle (or every pixel on screen in the case of 
 // rasterization), we split up space into different partitions that each contain multiple triangles and/or multiple other bounding boxes, and then we
 // calculate the bounding box-ray intersections (easier and faster than triangles), and if a ray intersects a box, the ray then looks for 
 // intersections with only the triangles contained in that box.
 // This strategy is MUCH faster because it actually decreases the big-O time complexity of ray-triangle intersection calculation, which is BIG.
-// P.S.: Not sure if we should use doubles or ints for the coordinates defining the bounding box, or if it even matters
+// The box is stored as its two opposite corners (min holds the smallest x, y, and z of anything inside it, max holds the largest), by value, so that a
+// whole array of boxes (like the nodes of a BVH, see bvh.cpp) can be copied to the GPU as one block
 struct bounding_box {
-    int* child_index;                 // The index of the child triangle contained in this bounding box
-    
-    // The six coordinates defining the bounds of the box (min x, max x, min y, max y, min z, max z), any point between these coordinates is inside 
-    // the box and any point not between them is outside
-    double* x_min;
-    double* x_max;
-    double* y_min;
-    double* y_max;
-    double* z_min;
-    double* z_max;
-
-    __device__ bounding_box() {}
-
-    __device__ bounding_box(int* _child_index, double* _x_min, double* _x_max, double* _y_min, double* _y_max, double* _z_min, double* _z_max) {
-        child_index = _child_index;
-        
-        x_min = _x_min;
-        x_max = _x_max;
-        y_min = _y_min;
-        y_max = _y_max;
-        z_min = _z_min;
-        z_max = _z_max;
+    vec3 min;
+    vec3 max;
+
+    // An "empty" box, with min at +infinity and max at -infinity, so that growing it to fit anything makes it exactly the size of that thing
+    __device__ __host__ bounding_box() : min(INFINITY, INFINITY, INFINITY), max(-INFINITY, -INFINITY, -INFINITY) {}
+
+    __device__ __host__ bounding_box(vec3 _min, vec3 _max) : min(_min), max(_max) {}
+
+    // Grows this box just enough to fit the given point
+    __device__ __host__ void grow(vec3 point) {
+        min = vec3(fmin(min.x, point.x), fmin(min.y, point.y), fmin(min.z, point.z));
+        max = vec3(fmax(max.x, point.x), fmax(max.y, point.y), fmax(max.z, point.z));
+    }
+
+    // Grows this box just enough to fit the given box (growing by an empty box leaves this one as it is)
+    __device__ __host__ void grow(bounding_box box) {
+        min = vec3(fmin(min.x, box.min.x), fmin(min.y, box.min.y), fmin(min.z, box.min.z));
+        max = vec3(fmax(max.x, box.max.x), fmax(max.y, box.max.y), fmax(max.z, box.max.z));
+    }
+
+    __device__ __host__ bool is_empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
     }
 
-    __device__ ~bounding_box() {
-        delete child_index, x_min, x_max, y_min, y_max, z_min, z_max;
+    __device__ __host__ vec3 center() const {
+        return min.add(max).scale(0.5);
+    }
+
+    // Returns the size of the box along each axis
+    __device__ __host__ vec3 extent() const {
+        return max.sub(min);
+    }
+
+    // The total area of the box's six faces, which is what the SAH (see bvh.cpp) uses to estimate how likely a random ray is to hit the box
+    __device__ __host__ real surface_area() const {
+        if (is_empty()) {
+            return 0;
+        }
+        vec3 e = extent();
+        return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    // Returns the t-value along the given ray where it enters this box, or INFINITY if it misses the box or only reaches it after t_max
+    // Uses the "slab" test: the box is the overlap of three slabs (the space between two parallel planes, one pair per axis), so we find the range 
+    // of t-values where the ray is inside each slab and check if all three ranges overlap. inverse_direction is 1 / the ray's direction (worked out
+    // once per ray instead of once per box), which also makes axis-parallel rays work out on their own, since 1 / 0 is infinity
+    __device__ __host__ real intersect(vec3 origin, vec3 inverse_direction, real t_max) const {
+        real tx1 = (min.x - origin.x) * inverse_direction.x;
+        real tx2 = (max.x - origin.x) * inverse_direction.x;
+        real t_enter = fmin(tx1, tx2);
+        real t_exit = fmax(tx1, tx2);
+
+        real ty1 = (min.y - origin.y) * inverse_direction.y;
+        real ty2 = (max.y - origin.y) * inverse_direction.y;
+        t_enter = fmax(t_enter, fmin(ty1, ty2));
+        t_exit = fmin(t_exit, fmax(ty1, ty2));
+
+        real tz1 = (min.z - origin.z) * inverse_direction.z;
+        real tz2 = (max.z - origin.z) * inverse_direction.z;
+        t_enter = fmax(t_enter, fmin(tz1, tz2));
+        t_exit = fmin(t_exit, fmax(tz1, tz2));
+
+        if (t_exit >= t_enter && t_exit > 0 && t_enter < t_max) {
+            return t_enter;
+        }
+        return INFINITY;
     }
 };
@@ -0,0 +1,491 @@
+// This file has triangle blocks, for testing one ray against a whole BVH leaf's worth of triangles at once
+// Ray packets (see ray_packet.cpp) only help when neighboring rays go the same way, which secondary rays (reflections, shadows, ...) don't, but
+// even for a single ray most of the time in a BVH walk goes into the triangle tests at the leaves. So instead, the triangles of each leaf get
+// stored in blocks of TRIANGLE_BLOCK_WIDTH, component by component (all of the block's v0 x's, then all of its v0 y's, ...), and the ray is tested
+// against the whole block in one pass of Möller–Trumbore:
+//     On the host, with SSE or AVX2 (whichever the CPU has, see ray_packet_cpu_level()), one instruction does the same step for several triangles
+//     On the GPU (or on any host), with a fully unrolled loop over the block, so the tests of different triangles don't wait on each other
+// Every version uses the same formulas in the same order as ray_triangle_intersection_moller_trumbore(), and blocks always use Möller–Trumbore
+// (even if compiled with -DUSE_WATERTIGHT_INTERSECTION). On the GPU the compiler may fuse a multiply and an add in one version but not the other,
+// which can change the last bit of a hit. The host code is built without FMA (the AVX2 version only targets "avx2"), so there every version
+// finds exactly the same hits as bvh_closest_hit_moller_trumbore(), and benchmark_triangle_blocks() asserts that it does
+// Since a block tests a whole width of triangles for about the price of one, any subtree with no more than TRIANGLE_BLOCK_WIDTH triangles gets
+// turned into a single leaf when the blocks are built (see build_triangle_blocks()), which is what lets 8-wide blocks fill up even though
+// BVH_MAX_LEAF_SIZE is 4
+
+#ifndef TRIANGLE_BLOCK_WIDTH
+#define TRIANGLE_BLOCK_WIDTH 4          // How many triangles each block holds, 4 or 8 (compile with -DTRIANGLE_BLOCK_WIDTH=8 to change it)
+#endif
+
+// Up to TRIANGLE_BLOCK_WIDTH triangles, stored component by component. Unused spots are all zeros (which can never be hit, since their
+// determinant is 0) and have a triangle index of -1
+struct alignas(32) triangle_block {
+    real v0_x[TRIANGLE_BLOCK_WIDTH];
+    real v0_y[TRIANGLE_BLOCK_WIDTH];
+    real v0_z[TRIANGLE_BLOCK_WIDTH];
+    real e1_x[TRIANGLE_BLOCK_WIDTH];
+    real e1_y[TRIANGLE_BLOCK_WIDTH];
+    real e1_z[TRIANGLE_BLOCK_WIDTH];
+    real e2_x[TRIANGLE_BLOCK_WIDTH];
+    real e2_y[TRIANGLE_BLOCK_WIDTH];
+    real e2_z[TRIANGLE_BLOCK_WIDTH];
+    int triangle[TRIANGLE_BLOCK_WIDTH];  // The index of each triangle in the triangle records, for the collisions that come out of the blocks
+};
+
+// A BVH whose leaves point to triangle blocks instead of triangles: a leaf's offset is the index of its first block, and its num_triangles
+// triangles fill the blocks from there on (so it has num_triangles / TRIANGLE_BLOCK_WIDTH blocks, rounded up)
+struct blocked_bvh {
+    bvh_node* nodes;
+    int num_nodes;
+    triangle_block* blocks;
+    int num_blocks;
+};
+
+// The closest hit a walk through a blocked BVH has found so far
+struct triangle_block_hit {
+    real t;
+    real u;
+    real v;
+    int triangle;                       // -1 until something gets hit
+};
+
+
+// Copies the given node of a BVH into the blocked BVH being built, with its whole subtree, and returns its index in the blocked BVH
+// counts and firsts hold the number of triangles and the first triangle of every node's subtree (a subtree's triangles are always next to each
+// other, since the builders put every node's triangles together)
+__host__ int build_triangle_block_node(bvh_node* nodes, int node_index, int* counts, int* firsts, triangle_record* triangles, blocked_bvh* result) {
+    int index = result->num_nodes++;
+    bvh_node* node = &nodes[node_index];
+    bvh_node* blocked = &result->nodes[index];
+    blocked->bounds = node->bounds;
+    if (node->is_leaf() || counts[node_index] <= TRIANGLE_BLOCK_WIDTH) {
+        blocked->offset = result->num_blocks;
+        blocked->num_triangles = counts[node_index];
+        for (int i = 0; i < counts[node_index]; i++) {
+            int lane = i % TRIANGLE_BLOCK_WIDTH;
+            if (lane == 0) {
+                memset(&result->blocks[result->num_blocks], 0, sizeof(triangle_block));
+                for (int j = 0; j < TRIANGLE_BLOCK_WIDTH; j++) {
+                    result->blocks[result->num_blocks].triangle[j] = -1;
+                }
+                result->num_blocks++;
+            }
+            triangle_block* block = &result->blocks[result->num_blocks - 1];
+            triangle_record* tri = &triangles[firsts[node_index] + i];
+            block->v0_x[lane] = tri->v0.x;
+            block->v0_y[lane] = tri->v0.y;
+            block->v0_z[lane] = tri->v0.z;
+            block->e1_x[lane] = tri->e1.x;
+            block->e1_y[lane] = tri->e1.y;
+            block->e1_z[lane] = tri->e1.z;
+            block->e2_x[lane] = tri->e2.x;
+            block->e2_y[lane] = tri->e2.y;
+            block->e2_z[lane] = tri->e2.z;
+            block->triangle[lane] = firsts[node_index] + i;
+        }
+        return index;
+    }
+
+    build_triangle_block_node(nodes, node_index + 1, counts, firsts, triangles, result);
+    int right_index = build_triangle_block_node(nodes, node->offset, counts, firsts, triangles, result);
+    result->nodes[index].offset = right_index;
+    result->nodes[index].num_triangles = 0;
+    return index;
+}
+
+
+// Builds the blocked version of the given BVH (in depth-first order, like build_bvh() and build_sbvh() make) over the given triangle records
+// The nodes and blocks are new arrays, and the records themselves aren't changed, so hits can still be looked up in them
+__host__ blocked_bvh build_triangle_blocks(bvh_node* nodes, int num_nodes, triangle_record* triangles, int num_triangles) {
+    blocked_bvh result;
+    result.nodes = new bvh_node[num_nodes > 0 ? num_nodes : 1];
+    result.num_nodes = 0;
+    result.blocks = new triangle_block[num_triangles > 0 ? num_triangles : 1];          // Every block holds at least one triangle
+    result.num_blocks = 0;
+    if (num_nodes == 0) {
+        return result;
+    }
+
+    // Children always come after their parents in depth-first order, so going backwards sees both children of a node before the node itself
+    int* counts = new int[num_nodes];
+    int* firsts = new int[num_nodes];
+    for (int i = num_nodes - 1; i >= 0; i--) {
+        if (nodes[i].is_leaf()) {
+            counts[i] = nodes[i].num_triangles;
+            firsts[i] = nodes[i].offset;
+        } else {
+            counts[i] = counts[i + 1] + counts[nodes[i].offset];
+            firsts[i] = firsts[i + 1] < firsts[nodes[i].offset] ? firsts[i + 1] : firsts[nodes[i].offset];
+        }
+    }
+    build_triangle_block_node(nodes, 0, counts, firsts, triangles, &result);
+
+    delete[] counts;
+    delete[] firsts;
+    return result;
+}
+
+
+// The unrolled version of the block test, which works on both the GPU and the CPU: tests the ray against every triangle of the block and
+// updates closest with any hit closer than it. Every spot is tested without any early outs, so the whole loop unrolls into straight-line code
+struct triangle_block_unrolled {
+    __device__ __host__ static void closest_hit(ray* r, triangle_block* block, triangle_block_hit* closest) {
+        vec3 o = r->origin;
+        vec3 d = r->direction;
+#pragma unroll
+        for (int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; lane++) {
+            real e1_x = block->e1_x[lane];
+            real e1_y = block->e1_y[lane];
+            real e1_z = block->e1_z[lane];
+            real e2_x = block->e2_x[lane];
+            real e2_y = block->e2_y[lane];
+            real e2_z = block->e2_z[lane];
+            real p_x = d.y * e2_z - d.z * e2_y;
+            real p_y = d.z * e2_x - d.x * e2_z;
+            real p_z = d.x * e2_y - d.y * e2_x;
+            real determinant = (e1_x * p_x) + (e1_y * p_y) + (e1_z * p_z);
+            real inverse_determinant = 1 / determinant;
+
+            real s_x = o.x - block->v0_x[lane];
+            real s_y = o.y - block->v0_y[lane];
+            real s_z = o.z - block->v0_z[lane];
+            real u = ((s_x * p_x) + (s_y * p_y) + (s_z * p_z)) * inverse_determinant;
+            real q_x = s_y * e1_z - s_z * e1_y;
+            real q_y = s_z * e1_x - s_x * e1_z;
+            real q_z = s_x * e1_y - s_y * e1_x;
+            real v = ((d.x * q_x) + (d.y * q_y) + (d.z * q_z)) * inverse_determinant;
+            real t = ((e2_x * q_x) + (e2_y * q_y) + (e2_z * q_z)) * inverse_determinant;
+
+            bool hit = determinant != 0 && !(u < 0 || u > 1) && !(v < 0 || u + v > 1) && t > 0 && t < closest->t;
+            if (hit) {
+                closest->t = t;
+                closest->u = u;
+                closest->v = v;
+                closest->triangle = block->triangle[lane];
+            }
+        }
+    }
+};
+
+
+#ifdef RAY_PACKET_X86
+// Takes the hits of one SIMD pass (the lanes set in hit_mask, whose t's, u's, and v's are in the given arrays) and keeps the closest one if it's
+// closer than closest, going through them in order so that ties go to the earlier triangle, like they do one at a time
+__host__ void keep_closest_block_hit(triangle_block* block, int first_lane, int hit_mask, real* t, real* u, real* v, triangle_block_hit* closest) {
+    for (int lane = 0; hit_mask != 0; lane++, hit_mask >>= 1) {
+        if ((hit_mask & 1) && t[lane] < closest->t) {
+            closest->t = t[lane];
+            closest->u = u[lane];
+            closest->v = v[lane];
+            closest->triangle = block->triangle[first_lane + lane];
+        }
+    }
+}
+
+
+// The SSE version of the block test, SSE_LANES triangles per instruction (uses the SIMD operations from ray_packet.cpp)
+struct triangle_block_sse {
+    __host__ static void closest_hit(ray* r, triangle_block* block, triangle_block_hit* closest) {
+        alignas(16) real t_lanes[SSE_LANES];
+        alignas(16) real u_lanes[SSE_LANES];
+        alignas(16) real v_lanes[SSE_LANES];
+        sse_real o_x = sse_set1(r->origin.x);
+        sse_real o_y = sse_set1(r->origin.y);
+        sse_real o_z = sse_set1(r->origin.z);
+        sse_real d_x = sse_set1(r->direction.x);
+        sse_real d_y = sse_set1(r->direction.y);
+        sse_real d_z = sse_set1(r->direction.z);
+        for (int i = 0; i < TRIANGLE_BLOCK_WIDTH; i += SSE_LANES) {
+            sse_real e1_x = sse_load(block->e1_x + i);
+            sse_real e1_y = sse_load(block->e1_y + i);
+            sse_real e1_z = sse_load(block->e1_z + i);
+            sse_real e2_x = sse_load(block->e2_x + i);
+            sse_real e2_y = sse_load(block->e2_y + i);
+            sse_real e2_z = sse_load(block->e2_z + i);
+            sse_real p_x = sse_sub(sse_mul(d_y, e2_z), sse_mul(d_z, e2_y));
+            sse_real p_y = sse_sub(sse_mul(d_z, e2_x), sse_mul(d_x, e2_z));
+            sse_real p_z = sse_sub(sse_mul(d_x, e2_y), sse_mul(d_y, e2_x));
+            sse_real determinant = sse_add(sse_add(sse_mul(e1_x, p_x), sse_mul(e1_y, p_y)), sse_mul(e1_z, p_z));
+            sse_real valid = sse_not_equal(determinant, sse_set1(0));
+            sse_real inverse_determinant = sse_div(sse_set1(1), determinant);
+
+            sse_real s_x = sse_sub(o_x, sse_load(block->v0_x + i));
+            sse_real s_y = sse_sub(o_y, sse_load(block->v0_y + i));
+            sse_real s_z = sse_sub(o_z, sse_load(block->v0_z + i));
+            sse_real u = sse_mul(sse_add(sse_add(sse_mul(s_x, p_x), sse_mul(s_y, p_y)), sse_mul(s_z, p_z)), inverse_determinant);
+            valid = sse_and(valid, sse_and(sse_less_equal(sse_set1(0), u), sse_less_equal(u, sse_set1(1))));
+
+            sse_real q_x = sse_sub(sse_mul(s_y, e1_z), sse_mul(s_z, e1_y));
+            sse_real q_y = sse_sub(sse_mul(s_z, e1_x), sse_mul(s_x, e1_z));
+            sse_real q_z = sse_sub(sse_mul(s_x, e1_y), sse_mul(s_y, e1_x));
+            sse_real v = sse_mul(sse_add(sse_add(sse_mul(d_x, q_x), sse_mul(d_y, q_y)), sse_mul(d_z, q_z)), inverse_determinant);
+            valid = sse_and(valid, sse_and(sse_less_equal(sse_set1(0), v), sse_less_equal(sse_add(u, v), sse_set1(1))));
+
+            sse_real t = sse_mul(sse_add(sse_add(sse_mul(e2_x, q_x), sse_mul(e2_y, q_y)), sse_mul(e2_z, q_z)), inverse_determinant);
+            valid = sse_and(valid, sse_and(sse_less(sse_set1(0), t), sse_less(t, sse_set1(closest->t))));
+
+            int hit_mask = sse_movemask(valid);
+            if (hit_mask != 0) {
+                sse_store(t_lanes, t);
+                sse_store(u_lanes, u);
+                sse_store(v_lanes, v);
+                keep_closest_block_hit(block, i, hit_mask, t_lanes, u_lanes, v_lanes, closest);
+            }
+        }
+    }
+};
+
+
+// The AVX2 version of the block test, AVX_LANES triangles per instruction (only ever called on CPUs that have AVX2, see ray_packet_cpu_level())
+// With floats, a 4-wide block is narrower than one AVX register, so it just uses the SSE version (which already does the whole block at once)
+struct triangle_block_avx2 {
+#if TRIANGLE_BLOCK_WIDTH % AVX_LANES != 0
+    __host__ static void closest_hit(ray* r, triangle_block* block, triangle_block_hit* closest) {
+        triangle_block_sse::closest_hit(r, block, closest);
+    }
+#else
+    __attribute__((target("avx2"))) __host__ static void closest_hit(ray* r, triangle_block* block, triangle_block_hit* closest) {
+        alignas(32) real t_lanes[AVX_LANES];
+        alignas(32) real u_lanes[AVX_LANES];
+        alignas(32) real v_lanes[AVX_LANES];
+        avx_real o_x = avx_set1(r->origin.x);
+        avx_real o_y = avx_set1(r->origin.y);
+        avx_real o_z = avx_set1(r->origin.z);
+        avx_real d_x = avx_set1(r->direction.x);
+        avx_real d_y = avx_set1(r->direction.y);
+        avx_real d_z = avx_set1(r->direction.z);
+        for (int i = 0; i < TRIANGLE_BLOCK_WIDTH; i += AVX_LANES) {
+            avx_real e1_x = avx_load(block->e1_x + i);
+            avx_real e1_y = avx_load(block->e1_y + i);
+            avx_real e1_z = avx_load(block->e1_z + i);
+            avx_real e2_x = avx_load(block->e2_x + i);
+            avx_real e2_y = avx_load(block->e2_y + i);
+            avx_real e2_z = avx_load(block->e2_z + i);
+            avx_real p_x = avx_sub(avx_mul(d_y, e2_z), avx_mul(d_z, e2_y));
+            avx_real p_y = avx_sub(avx_mul(d_z, e2_x), avx_mul(d_x, e2_z));
+            avx_real p_z = avx_sub(avx_mul(d_x, e2_y), avx_mul(d_y, e2_x));
+            avx_real determinant = avx_add(avx_add(avx_mul(e1_x, p_x), avx_mul(e1_y, p_y)), avx_mul(e1_z, p_z));
+            avx_real valid = avx_not_equal(determinant, avx_set1(0));
+            avx_real inverse_determinant = avx_div(avx_set1(1), determinant);
+
+            avx_real s_x = avx_sub(o_x, avx_load(block->v0_x + i));
+            avx_real s_y = avx_sub(o_y, avx_load(block->v0_y + i));
+            avx_real s_z = avx_sub(o_z, avx_load(block->v0_z + i));
+            avx_real u = avx_mul(avx_add(avx_add(avx_mul(s_x, p_x), avx_mul(s_y, p_y)), avx_mul(s_z, p_z)), inverse_determinant);
+            valid = avx_and(valid, avx_and(avx_less_equal(avx_set1(0), u), avx_less_equal(u, avx_set1(1))));
+
+            avx_real q_x = avx_sub(avx_mul(s_y, e1_z), avx_mul(s_z, e1_y));
+            avx_real q_y = avx_sub(avx_mul(s_z, e1_x), avx_mul(s_x, e1_z));
+            avx_real q_z = avx_sub(avx_mul(s_x, e1_y), avx_mul(s_y, e1_x));
+            avx_real v = avx_mul(avx_add(avx_add(avx_mul(d_x, q_x), avx_mul(d_y, q_y)), avx_mul(d_z, q_z)), inverse_determinant);
+            valid = avx_and(valid, avx_and(avx_less_equal(avx_set1(0), v), avx_less_equal(avx_add(u, v), avx_set1(1))));
+
+            avx_real t = avx_mul(avx_add(avx_add(avx_mul(e2_x, q_x), avx_mul(e2_y, q_y)), avx_mul(e2_z, q_z)), inverse_determinant);
+            valid = avx_and(valid, avx_and(avx_less(avx_set1(0), t), avx_less(t, avx_set1(closest->t))));
+
+            int hit_mask = avx_movemask(valid);
+            if (hit_mask != 0) {
+                avx_store(t_lanes, t);
+                avx_store(u_lanes, u);
+                avx_store(v_lanes, v);
+                keep_closest_block_hit(block, i, hit_mask, t_lanes, u_lanes, v_lanes, closest);
+            }
+        }
+    }
+#endif
+};
+#endif
+
+
+// Finds the closest triangle the given ray hits (closer than t_max) by walking the given blocked BVH the same way bvh_closest_hit() walks a
+// regular one, testing each leaf's blocks with the given version of the block test
+template <typename block_test>
+__device__ __host__ collision blocked_bvh_closest_hit_with(ray* r, bvh_node* nodes, int num_nodes, triangle_block* blocks, real t_max) {
+    collision result;
+    if (num_nodes == 0) {
+        return result;
+    }
+
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    if (nodes[0].bounds.intersect(origin, inverse_direction, t_max) == INFINITY) {
+        return result;
+    }
+
+    triangle_block_hit closest;
+    closest.t = t_max;
+    closest.u = 0;
+    closest.v = 0;
+    closest.triangle = -1;
+    int stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        bvh_node* node = &nodes[node_index];
+        if (node->is_leaf()) {
+            int num_blocks = (node->num_triangles + TRIANGLE_BLOCK_WIDTH - 1) / TRIANGLE_BLOCK_WIDTH;
+            for (int i = node->offset; i < node->offset + num_blocks; i++) {
+                block_test::closest_hit(r, &blocks[i], &closest);
+            }
+        } else {
+            int near_index = node_index + 1;
+            int far_index = node->offset;
+            real t_near = nodes[near_index].bounds.intersect(origin, inverse_direction, closest.t);
+            real t_far = nodes[far_index].bounds.intersect(origin, inverse_direction, closest.t);
+            if (t_far < t_near) {
+                int temp_index = near_index;
+                near_index = far_index;
+                far_index = temp_index;
+                real temp_t = t_near;
+                t_near = t_far;
+                t_far = temp_t;
+            }
+
+            if (t_near != INFINITY) {
+                if (t_far != INFINITY) {
+                    stack[stack_size++] = far_index;
+                }
+                node_index = near_index;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        node_index = stack[--stack_size];
+    }
+
+    if (closest.triangle != -1) {
+        result.has_collision = true;
+        result.collision_distance = closest.t;
+        result.collision_point = get_point_from_t(r, closest.t);
+        result.barycentric_u = closest.u;
+        result.barycentric_v = closest.v;
+        result.triangle_index = closest.triangle;
+    }
+    return result;
+}
+
+
+// Finds the closest triangle the given ray hits (closer than t_max) in the given blocked BVH with the unrolled block test, on the GPU or the CPU
+__device__ __host__ collision blocked_bvh_closest_hit(ray* r, bvh_node* nodes, int num_nodes, triangle_block* blocks, real t_max) {
+    return blocked_bvh_closest_hit_with<triangle_block_unrolled>(r, nodes, num_nodes, blocks, t_max);
+}
+
+
+// Same as above, but on the host with the given version of the SIMD block test (which has to be one this CPU can run, see ray_packet_cpu_level(),
+// and RAY_PACKET_SCALAR means the unrolled test)
+__host__ collision blocked_bvh_closest_hit_simd(ray* r, bvh_node* nodes, int num_nodes, triangle_block* blocks, real t_max, ray_packet_level level) {
+#ifdef RAY_PACKET_X86
+    if (level == RAY_PACKET_AVX2) {
+        return blocked_bvh_closest_hit_with<triangle_block_avx2>(r, nodes, num_nodes, blocks, t_max);
+    }
+    if (level == RAY_PACKET_SSE) {
+        return blocked_bvh_closest_hit_with<triangle_block_sse>(r, nodes, num_nodes, blocks, t_max);
+    }
+#endif
+    return blocked_bvh_closest_hit(r, nodes, num_nodes, blocks, t_max);
+}
+
+
+// Returns whether the ray hits any triangle closer than t_max in the given blocked BVH, walking it like bvh_any_hit() (see occlusion.cpp) and
+// stopping after the first block with a hit in it
+__device__ __host__ bool blocked_bvh_any_hit(ray* r, bvh_node* nodes, int num_nodes, triangle_block* blocks, real t_max) {
+    if (num_nodes == 0) {
+        return false;
+    }
+
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+    triangle_block_hit closest;
+    closest.t = t_max;
+    closest.u = 0;
+    closest.v = 0;
+    closest.triangle = -1;
+    int stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        bvh_node* node = &nodes[node_index];
+        if (node->bounds.intersect(origin, inverse_direction, t_max) != INFINITY) {
+            if (node->is_leaf()) {
+                int num_blocks = (node->num_triangles + TRIANGLE_BLOCK_WIDTH - 1) / TRIANGLE_BLOCK_WIDTH;
+                for (int i = node->offset; i < node->offset + num_blocks; i++) {
+                    triangle_block_unrolled::closest_hit(r, &blocks[i], &closest);
+                    if (closest.triangle != -1) {
+                        return true;
+                    }
+                }
+            } else {
+                stack[stack_size++] = node->offset;
+                node_index++;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            return false;
+        }
+        node_index = stack[--stack_size];
+    }
+}
+
+
+// Traces primary rays and then incoherent rays (which is what blocks are for) through a BVH over the given number of random triangles, one
+// triangle at a time with bvh_closest_hit_moller_trumbore() and then through the blocked BVH with the unrolled test and every SIMD test this CPU
+// can run, and prints how long each took and how many rays each disagreed with the single triangle walk on (which has to be 0, see the top of
+// this file)
+__host__ void benchmark_triangle_blocks(int num_triangles, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, &random_state);
+    bvh tree = build_bvh(triangles, num_triangles);
+    auto build_start = std::chrono::high_resolution_clock::now();
+    blocked_bvh blocked = build_triangle_blocks(tree.nodes, tree.num_nodes, triangles, num_triangles);
+    auto build_end = std::chrono::high_resolution_clock::now();
+    double build_ms = std::chrono::duration_cast<std::chrono::microseconds>(build_end - build_start).count() / 1000.0;
+    ray_packet_level cpu_level = ray_packet_cpu_level();
+    const char* test_names[3] = {"unrolled", "sse", "avx2"};
+    printf("triangle block benchmark: %i triangles, %i rays, %i-wide blocks, %i nodes -> %i nodes and %i blocks (%.1f%% full) in %.2f ms\n",
+           num_triangles, num_rays, TRIANGLE_BLOCK_WIDTH, tree.num_nodes, blocked.num_nodes, blocked.num_blocks,
+           100.0 * num_triangles / ((double) blocked.num_blocks * TRIANGLE_BLOCK_WIDTH), build_ms);
+
+    for (int incoherent = 0; incoherent <= 1; incoherent++) {
+        ray* rays = incoherent ? make_incoherent_benchmark_rays(num_rays, &random_state) : make_benchmark_rays(num_rays, &random_state);
+
+        collision* single_hits = new collision[num_rays];
+        auto single_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < num_rays; i++) {
+            single_hits[i] = bvh_closest_hit_moller_trumbore(&rays[i], tree.nodes, tree.num_nodes, triangles, INFINITY);
+        }
+        auto single_end = std::chrono::high_resolution_clock::now();
+        double single_ms = std::chrono::duration_cast<std::chrono::microseconds>(single_end - single_start).count() / 1000.0;
+        printf("  %s rays: one triangle at a time %.2f ms", incoherent ? "incoherent" : "primary", single_ms);
+
+        for (int level = RAY_PACKET_SCALAR; level <= cpu_level; level++) {
+            int num_mismatches = 0;
+            auto block_start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < num_rays; i++) {
+                collision hit = blocked_bvh_closest_hit_simd(&rays[i], blocked.nodes, blocked.num_nodes, blocked.blocks, INFINITY,
+                                                             (ray_packet_level) level);
+                if (hit.has_collision != single_hits[i].has_collision ||
+                    (hit.has_collision && hit.collision_distance != single_hits[i].collision_distance)) {
+                    num_mismatches++;
+                }
+            }
+            auto block_end = std::chrono::high_resolution_clock::now();
+            double block_ms = std::chrono::duration_cast<std::chrono::microseconds>(block_end - block_start).count() / 1000.0;
+            printf(", %s blocks %.2f ms (%.2fx, %i mismatch(es))", test_names[level], block_ms, single_ms / block_ms, num_mismatches);
+            assert(num_mismatches == 0);
+        }
+        printf("\n");
+
+        delete[] single_hits;
+        delete[] rays;
+    }
+
+    delete[] blocked.nodes;
+    delete[] blocked.blocks;
+    delete[] tree.nodes;
+    delete[] triangles;
+}
@@ -0,0 +1,188 @@
+// This file has the Whitted shader, trace_ray(), which works out the color a camera ray sees: at the closest hit, the surface is lit by every light
+// that isn't blocked (see segment_occluded()), and then, depending on its material, the ray bounces off it (reflection) and/or goes through it
+// (refraction), and the colors those rays see get added in, weighted by how reflective and refractive the material is
+// A hit that both reflects and refracts splits into two rays, so the rays form a tree. Instead of recursing (which would need a deep, unbounded
+// call stack on the GPU), trace_ray() follows one branch of the tree at a time and keeps the other branches in a small fixed-size stack, and no
+// ray ever goes more than max_bounces bounces from the camera. The stack only ever holds one waiting branch per bounce, so it never needs more
+// than WHITTED_MAX_BOUNCES entries, no matter how the tree branches
+
+#ifndef WHITTED_MAX_BOUNCES
+#define WHITTED_MAX_BOUNCES 4           // The most bounces trace_ray() can follow (compile with -DWHITTED_MAX_BOUNCES=8 or so to allow more), which
+                                        // also sets the size of its stack
+#endif
+#define WHITTED_AMBIENT 0.1             // How much light every surface gets even when no light reaches it, so that shadows aren't pitch black
+#define WHITTED_REFRACTIVE_INDEX 1.5    // How much refractive materials bend light (about glass), since materials don't have their own yet
+#define WHITTED_MIN_WEIGHT 0.01         // Bounces that would add less than this much to the final color aren't traced at all
+#define WHITTED_RAY_EPSILON 1e-4        // How far bounced rays start off the surface, so they don't hit the surface they're leaving because of rounding
+
+// A ray that trace_ray() still has to follow, with how much its color counts toward the final color and how many bounces it is from the camera
+struct whitted_ray {
+    ray r;
+    real weight;
+    int depth;
+};
+
+
+// Returns the normal of the triangle a hit in the given packed scene is on, in world space (the triangles of an instanced scene are stored in their
+// mesh's own space, so their normals are moved into world space by the instance first, see instance_normal_to_world())
+__device__ __host__ vec3 scene_hit_normal(packed_scene* scene, collision* hit) {
+    triangle_record* tri = &scene->get_triangles()[hit->triangle_index];
+    if (hit->instance_index == -1) {
+        return tri->normal;
+    }
+    return instance_normal_to_world(&scene->get_instances()[hit->instance_index], tri->normal);
+}
+
+
+// Returns the light reaching the given point on a surface facing the given way (ambient light, plus every light that isn't blocked, brighter
+// the more head-on it hits the surface). rays_traced (if not null) gets the number of shadow rays added to it
+__device__ __host__ color whitted_direct_light(packed_scene* scene, vec3 point, vec3 normal, int* rays_traced) {
+    color result = color(WHITTED_AMBIENT, WHITTED_AMBIENT, WHITTED_AMBIENT);
+    light* lights = scene->get_lights();
+    for (int i = 0; i < scene->num_lights; i++) {
+        vec3 to_light = lights[i].position.sub(point);
+        real facing = normal.dot(to_light.normalize());
+        if (facing <= 0) {
+            continue;                                                                   // The light is behind the surface
+        }
+        if (rays_traced != nullptr) {
+            (*rays_traced)++;
+        }
+        if (segment_occluded(scene, point, lights[i].position)) {
+            continue;
+        }
+        result.r += lights[i].rgb.r * lights[i].intensity * facing;
+        result.g += lights[i].rgb.g * lights[i].intensity * facing;
+        result.b += lights[i].rgb.b * lights[i].intensity * facing;
+    }
+    return result;
+}
+
+
+// Returns the color the given camera ray sees in the given packed scene, following up to max_bounces bounces (at most WHITTED_MAX_BOUNCES)
+// Material colors go from 0 to 255 and light colors from 0 to 1, so the result is from 0 to 1 for a fully lit, purely diffuse white surface
+// Rays that hit nothing see black. rays_traced (if not null) gets the number of rays traced added to it, shadow rays included
+__device__ __host__ color trace_ray(packed_scene* scene, ray* primary_ray, int max_bounces, int* rays_traced) {
+    if (max_bounces > WHITTED_MAX_BOUNCES) {
+        max_bounces = WHITTED_MAX_BOUNCES;
+    }
+
+    color result;
+    material* materials = scene->get_materials();
+    whitted_ray stack[WHITTED_MAX_BOUNCES > 0 ? WHITTED_MAX_BOUNCES : 1];              // At most one waiting branch per bounce
+    int stack_size = 0;
+    whitted_ray current;
+    current.r = *primary_ray;
+    current.weight = 1;
+    current.depth = 0;
+    while (true) {
+        collision hit = scene_closest_hit(scene, &current.r, INFINITY);
+        if (rays_traced != nullptr) {
+            (*rays_traced)++;
+        }
+
+        int num_next = 0;
+        whitted_ray next[2];
+        if (hit.has_collision) {
+            material* m = &materials[scene->get_triangles()[hit.triangle_index].material_index];
+            vec3 d = current.r.direction;
+            vec3 normal = scene_hit_normal(scene, &hit);
+            bool entering = d.dot(normal) < 0;
+            vec3 facing_normal = entering ? normal : normal.scale(-1);                  // Triangles are two-sided, so lighting uses the side the
+                                                                                        // ray came from
+            // The surface's own color, lit by the lights
+            real diffuse_weight = current.weight * m->diffusion / 255;
+            if (diffuse_weight > 0) {
+                color lit = whitted_direct_light(scene, hit.collision_point, facing_normal, rays_traced);
+                result.r += diffuse_weight * m->material_color.r * lit.r;
+                result.g += diffuse_weight * m->material_color.g * lit.g;
+                result.b += diffuse_weight * m->material_color.b * lit.b;
+            }
+
+            if (current.depth < max_bounces) {
+                vec3 reflected = d.sub(facing_normal.scale(2 * d.dot(facing_normal)));
+                vec3 above = hit.collision_point.add(facing_normal.scale(WHITTED_RAY_EPSILON));
+                vec3 below = hit.collision_point.sub(facing_normal.scale(WHITTED_RAY_EPSILON));
+                if (current.weight * m->reflection >= WHITTED_MIN_WEIGHT) {
+                    next[num_next].r = ray(above, reflected);
+                    next[num_next].weight = current.weight * m->reflection;
+                    next[num_next].depth = current.depth + 1;
+                    num_next++;
+                }
+                if (current.weight * m->refraction >= WHITTED_MIN_WEIGHT) {
+                    // Snell's law, going into the material when entering and back out when leaving, or reflecting instead if the ray hits the
+                    // way out too steeply to get out (total internal reflection)
+                    real eta = entering ? 1 / (real) WHITTED_REFRACTIVE_INDEX : (real) WHITTED_REFRACTIVE_INDEX;
+                    real cos_in = -d.dot(facing_normal);
+                    real k = 1 - eta * eta * (1 - cos_in * cos_in);
+                    if (k < 0) {
+                        next[num_next].r = ray(above, reflected);
+                    } else {
+                        next[num_next].r = ray(below, d.scale(eta).add(facing_normal.scale(eta * cos_in - sqrt(k))).normalize());
+                    }
+                    next[num_next].weight = current.weight * m->refraction;
+                    next[num_next].depth = current.depth + 1;
+                    num_next++;
+                }
+            }
+        }
+
+        if (num_next == 2) {
+            stack[stack_size++] = next[1];
+        }
+        if (num_next > 0) {
+            current = next[0];
+            continue;
+        }
+        if (stack_size == 0) {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+    return result;
+}
+
+
+// Renders a scene of the given number of random triangles (a third of them diffuse, a third mirrors, and a third glass) lit by a few lights, at the
+// given resolution on the host, once for every bounce limit from 0 up to WHITTED_MAX_BOUNCES, and prints how many pixels and how many rays
+// (shadow rays included) per second each one got through
+__host__ void benchmark_whitted(int num_triangles, int width, int height) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* records = make_benchmark_triangles(num_triangles, &random_state);
+    triangle_soa triangles = triangle_soa_from_records(records, num_triangles, 3);
+    triangles.materials[0] = material(color(255, 255, 255), 1, 0, 0);
+    triangles.materials[1] = material(color(255, 200, 200), 0.2, 0.8, 0);
+    triangles.materials[2] = material(color(200, 200, 255), 0.1, 0.1, 0.8);
+    for (int i = 0; i < num_triangles; i++) {
+        triangles.material_index[i] = i % 3;
+    }
+    int num_lights = 4;
+    light* lights = make_benchmark_lights(num_lights, &random_state);
+    camera cam = camera(vec3(0, 0, 0), vec3(0, 0, 0), (real) width);
+    dimensions dims = dimensions(width, height);
+    packed_scene* scene = pack_scene(&cam, &dims, lights, num_lights, &triangles, ACCELERATOR_BVH, nullptr);
+    printf("whitted benchmark: %i triangles, %i lights, %ix%i pixels, %i bytes of ray stack per pixel\n", num_triangles, num_lights, width, height,
+           (int) (sizeof(whitted_ray) * WHITTED_MAX_BOUNCES));
+
+    int num_pixels = width * height;
+    for (int max_bounces = 0; max_bounces <= WHITTED_MAX_BOUNCES; max_bounces++) {
+        int rays_traced = 0;
+        real brightness = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < num_pixels; i++) {
+            ray primary_ray = generate_camera_ray(&cam, &dims, i % width, i / width);
+            color c = trace_ray(scene, &primary_ray, max_bounces, &rays_traced);
+            brightness += c.r + c.g + c.b;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double ms = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+        printf("  %i bounce(s): %.2f ms, %.2f Mpixels/s, %i rays (%.2f per pixel), %.2f Mrays/s, average brightness %.4f\n", max_bounces, ms,
+               num_pixels / ms / 1000.0, rays_traced, (double) rays_traced / num_pixels, rays_traced / ms / 1000.0,
+               (double) brightness / (3.0 * num_pixels));
+    }
+
+    delete[] (char*) scene;
+    delete[] lights;
+    delete[] records;
+    destroy_triangle_soa(&triangles);
+}
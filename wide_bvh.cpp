@@ -0,0 +1,331 @@
+// This file has the wide BVH, a more compact version of the binary BVH from bvh.cpp where every node has up to WIDE_BVH_WIDTH children instead of 2
+// A binary node spends a whole bounding_box (six reals, so 48 bytes with doubles) on its own bounds, and a ray has to load a new node for every
+// single box it tests. A wide node instead holds the boxes of all of its children, and stores each of them as 8-bit numbers relative to the node's
+// own box (a "parent frame"), so a ray tests 4 or 8 boxes for the price of one node load, and the whole tree takes up a fraction of the memory
+// The quantized boxes are always rounded outward, so they can only be a little bigger than the real boxes, never smaller -- a ray might test a
+// child it actually misses, but it can never skip a child it hits
+// A wide BVH is made by collapsing an existing binary BVH (from either builder) with collapse_bvh(), so it keeps the same triangle order and leaves
+
+// How many children each node has room for: 4 or 8, chosen at compile time with -DWIDE_BVH_WIDTH=4 (8 by default)
+#ifndef WIDE_BVH_WIDTH
+#define WIDE_BVH_WIDTH 8
+#endif
+static_assert(WIDE_BVH_WIDTH == 4 || WIDE_BVH_WIDTH == 8, "WIDE_BVH_WIDTH must be 4 or 8");
+
+// One node of a wide BVH
+// Each child's box is stored as 8-bit steps from the node's origin, where each step along an axis is 2^exponent long on that axis, so a child's box
+// is origin + lower * 2^exponent to origin + upper * 2^exponent. Children are filled in from the front, and unused slots have a child_offset of -1
+struct wide_bvh_node {
+    float origin_x;                     // The minimum corner of the node's own box, rounded down to fit in a float
+    float origin_y;
+    float origin_z;
+    int8_t exponent_x;
+    int8_t exponent_y;
+    int8_t exponent_z;
+
+    uint8_t lower_x[WIDE_BVH_WIDTH];
+    uint8_t lower_y[WIDE_BVH_WIDTH];
+    uint8_t lower_z[WIDE_BVH_WIDTH];
+    uint8_t upper_x[WIDE_BVH_WIDTH];
+    uint8_t upper_y[WIDE_BVH_WIDTH];
+    uint8_t upper_z[WIDE_BVH_WIDTH];
+
+    int child_offset[WIDE_BVH_WIDTH];           // For a leaf child, the index of its first triangle, and for an interior child, its node index
+    uint8_t child_triangles[WIDE_BVH_WIDTH];    // How many triangles a leaf child has, or 0 if the child is another node
+
+    // The length of one step along each axis (2^exponent)
+    __device__ __host__ vec3 scale() const {
+        return vec3(ldexp((real) 1, exponent_x), ldexp((real) 1, exponent_y), ldexp((real) 1, exponent_z));
+    }
+
+    // Turns the quantized box of the given child back into a regular bounding box, given this node's scale() (worked out once per node, instead of
+    // once per child)
+    __device__ __host__ bounding_box child_bounds(int child, vec3 step) const {
+        return bounding_box(vec3(origin_x + lower_x[child] * step.x, origin_y + lower_y[child] * step.y, origin_z + lower_z[child] * step.z),
+                            vec3(origin_x + upper_x[child] * step.x, origin_y + upper_y[child] * step.y, origin_z + upper_z[child] * step.z));
+    }
+};
+
+struct wide_bvh {
+    wide_bvh_node* nodes;
+    int num_nodes;
+};
+
+
+// Works out the parent frame for one axis of a node whose box goes from min to max: the origin is min rounded down to a float, and the exponent is
+// the smallest one where 255 steps still reach past max
+__host__ void quantization_frame(real min, real max, float* origin, int8_t* exponent) {
+    float rounded_min = (float) min;
+    if (rounded_min > min) {
+        rounded_min = nextafterf(rounded_min, -INFINITY);
+    }
+
+    real extent = max - rounded_min;
+    int e = extent > 0 ? (int) ceil(log2(extent / 255)) : -64;
+    e = e < -126 ? -126 : e;                                                            // Keeping 2^e a normal float
+    while (e < 127 && rounded_min + 255 * ldexp((real) 1, e) < max) {
+        e++;                                                                            // In case log2 rounded the wrong way
+    }
+
+    *origin = rounded_min;
+    *exponent = (int8_t) (e > 127 ? 127 : e);
+}
+
+
+// Quantizes one axis of a child's box, rounding the lower step down and the upper step up so that the quantized box always covers the real one
+__host__ void quantize_axis(real child_min, real child_max, float origin, int8_t exponent, uint8_t* lower, uint8_t* upper) {
+    real scale = ldexp((real) 1, exponent);
+    real low = floor((child_min - origin) / scale);
+    real high = ceil((child_max - origin) / scale);
+    *lower = (uint8_t) (low < 0 ? 0 : (low > 255 ? 255 : low));
+    *upper = (uint8_t) (high < 0 ? 0 : (high > 255 ? 255 : high));
+}
+
+
+// Everything collapse_bvh() needs while it recursively collapses the tree
+struct wide_bvh_collapse_state {
+    bvh_node* binary_nodes;
+    wide_bvh_node* nodes;
+    int num_nodes;
+};
+
+// Makes a wide node out of the given binary node, and then (recursively) out of every interior node among its new children, returning its index
+// The binary node's two children are the starting children, and then the interior child with the biggest box keeps being swapped out for its own
+// two children until there are WIDE_BVH_WIDTH children or only leaves left -- pulling up the biggest boxes first, since those are the ones rays
+// are most likely to go into
+__host__ int collapse_bvh_node(wide_bvh_collapse_state* state, int binary_index) {
+    bvh_node* binary_nodes = state->binary_nodes;
+    int children[WIDE_BVH_WIDTH];
+    int num_children = 0;
+    if (binary_nodes[binary_index].is_leaf()) {
+        children[num_children++] = binary_index;                                        // The root was a leaf, so it becomes the only child
+    } else {
+        children[num_children++] = binary_index + 1;
+        children[num_children++] = binary_nodes[binary_index].offset;
+    }
+
+    while (num_children < WIDE_BVH_WIDTH) {
+        int biggest = -1;
+        real biggest_area = -1;
+        for (int i = 0; i < num_children; i++) {
+            bvh_node* child = &binary_nodes[children[i]];
+            if (!child->is_leaf() && child->bounds.surface_area() > biggest_area) {
+                biggest = i;
+                biggest_area = child->bounds.surface_area();
+            }
+        }
+        if (biggest == -1) {
+            break;
+        }
+
+        int expanded = children[biggest];
+        children[biggest] = expanded + 1;
+        children[num_children++] = binary_nodes[expanded].offset;
+    }
+
+    int node_index = state->num_nodes++;
+    wide_bvh_node node;
+    bounding_box bounds = binary_nodes[binary_index].bounds;
+    quantization_frame(bounds.min.x, bounds.max.x, &node.origin_x, &node.exponent_x);
+    quantization_frame(bounds.min.y, bounds.max.y, &node.origin_y, &node.exponent_y);
+    quantization_frame(bounds.min.z, bounds.max.z, &node.origin_z, &node.exponent_z);
+
+    for (int i = 0; i < WIDE_BVH_WIDTH; i++) {
+        if (i >= num_children) {
+            node.lower_x[i] = node.lower_y[i] = node.lower_z[i] = 0;
+            node.upper_x[i] = node.upper_y[i] = node.upper_z[i] = 0;
+            node.child_offset[i] = -1;
+            node.child_triangles[i] = 0;
+            continue;
+        }
+
+        bvh_node* child = &binary_nodes[children[i]];
+        quantize_axis(child->bounds.min.x, child->bounds.max.x, node.origin_x, node.exponent_x, &node.lower_x[i], &node.upper_x[i]);
+        quantize_axis(child->bounds.min.y, child->bounds.max.y, node.origin_y, node.exponent_y, &node.lower_y[i], &node.upper_y[i]);
+        quantize_axis(child->bounds.min.z, child->bounds.max.z, node.origin_z, node.exponent_z, &node.lower_z[i], &node.upper_z[i]);
+        if (child->is_leaf()) {
+            assert(child->num_triangles <= 255);
+            node.child_offset[i] = child->offset;
+            node.child_triangles[i] = (uint8_t) child->num_triangles;
+        } else {
+            node.child_offset[i] = collapse_bvh_node(state, children[i]);
+            node.child_triangles[i] = 0;
+        }
+    }
+
+    state->nodes[node_index] = node;
+    return node_index;
+}
+
+
+// Collapses a binary BVH into a wide one, which uses the same (already rearranged) triangles
+__host__ wide_bvh collapse_bvh(bvh_node* binary_nodes, int num_binary_nodes) {
+    wide_bvh result;
+    result.nodes = nullptr;
+    result.num_nodes = 0;
+    if (num_binary_nodes == 0) {
+        return result;
+    }
+
+    wide_bvh_collapse_state state;
+    state.binary_nodes = binary_nodes;
+    state.nodes = new wide_bvh_node[num_binary_nodes];                                  // Every wide node swallows at least one binary node
+    state.num_nodes = 0;
+    collapse_bvh_node(&state, 0);
+
+    result.nodes = state.nodes;
+    result.num_nodes = state.num_nodes;
+    return result;
+}
+
+
+// A saved spot in the traversal of a wide BVH: a node, plus the children of it that the ray hit but hasn't gone into yet, nearest first
+// The children are packed into one number, 3 bits per child slot starting from the lowest bits, with how many are left in the top 4 bits. Saving
+// a whole node's leftover children as one entry means the stack only ever needs one entry per level of the tree
+struct wide_bvh_stack_entry {
+    int node;
+    uint32_t remaining;
+};
+
+
+// Finds the closest triangle the given ray hits (closer than t_max, and in front of the ray's origin) by walking the given wide BVH
+// At every node, the ray is tested against all of the node's children at once: leaf children that are hit get their triangles tested right away,
+// and the interior children that are hit get sorted from nearest to farthest, so the nearest one is gone into next and the rest are saved for later
+__device__ __host__ collision wide_bvh_closest_hit(ray* r, wide_bvh_node* nodes, int num_nodes, triangle_record* triangles, real t_max) {
+    collision closest;
+    if (num_nodes == 0) {
+        return closest;
+    }
+
+    vec3 origin = r->origin;
+    vec3 inverse_direction = vec3(1 / r->direction.x, 1 / r->direction.y, 1 / r->direction.z);
+
+    wide_bvh_stack_entry stack[BVH_MAX_DEPTH];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        wide_bvh_node* node = &nodes[node_index];
+        vec3 step = node->scale();
+
+        // Testing every child's box, and keeping the interior ones that were hit sorted by how far away they are
+        int hit_children[WIDE_BVH_WIDTH];
+        real hit_distances[WIDE_BVH_WIDTH];
+        int num_hit = 0;
+        for (int i = 0; i < WIDE_BVH_WIDTH; i++) {
+            if (node->child_offset[i] < 0) {
+                break;
+            }
+            real t = node->child_bounds(i, step).intersect(origin, inverse_direction, t_max);
+            if (t == INFINITY) {
+                continue;
+            }
+
+            if (node->child_triangles[i] > 0) {
+                int first = node->child_offset[i];
+                for (int j = first; j < first + node->child_triangles[i]; j++) {
+                    collision hit = ray_triangle_intersection_t(r, &triangles[j], j, t_max);
+                    if (hit.has_collision) {
+                        closest = hit;
+                        t_max = hit.collision_distance;
+                    }
+                }
+            } else {
+                int spot = num_hit++;
+                while (spot > 0 && hit_distances[spot - 1] > t) {
+                    hit_children[spot] = hit_children[spot - 1];
+                    hit_distances[spot] = hit_distances[spot - 1];
+                    spot--;
+                }
+                hit_children[spot] = i;
+                hit_distances[spot] = t;
+            }
+        }
+
+        // Going into the nearest interior child, and saving the rest (if any) as one stack entry
+        int next = -1;
+        for (int i = 0; i < num_hit; i++) {
+            if (hit_distances[i] >= t_max) {
+                break;                                                                  // Behind a triangle found in one of the leaves above
+            }
+            if (next == -1) {
+                next = node->child_offset[hit_children[i]];
+                continue;
+            }
+
+            if (i == 1) {
+                stack[stack_size++] = {node_index, 0};                                  // The first child being saved from this node
+            }
+            wide_bvh_stack_entry* entry = &stack[stack_size - 1];
+            uint32_t count = entry->remaining >> 28;
+            entry->remaining = (entry->remaining & 0x0FFFFFFF) | ((uint32_t) hit_children[i] << (3 * count)) | ((count + 1) << 28);
+        }
+
+        // If there was nothing to go into, picking up the nearest child saved on the stack that is still closer than the closest hit so far
+        while (next == -1 && stack_size > 0) {
+            wide_bvh_stack_entry* entry = &stack[stack_size - 1];
+            int count = entry->remaining >> 28;
+            int child = entry->remaining & 7;
+            wide_bvh_node* saved_node = &nodes[entry->node];
+            if (count == 1) {
+                stack_size--;
+            } else {
+                entry->remaining = ((entry->remaining & 0x0FFFFFFF) >> 3) | ((uint32_t) (count - 1) << 28);
+            }
+            if (saved_node->child_bounds(child, saved_node->scale()).intersect(origin, inverse_direction, t_max) != INFINITY) {
+                next = saved_node->child_offset[child];
+            }
+        }
+
+        if (next == -1) {
+            break;
+        }
+        node_index = next;
+    }
+    return closest;
+}
+
+
+// Compares the wide BVH against the binary BVH it was collapsed from, for a scene of the given number of random triangles, printing how much memory
+// each one's nodes take up and how many rays per second each one traces on the host (plus how many rays found a different closest hit, which
+// should always be 0)
+__host__ void benchmark_wide_bvh(int num_triangles, int num_rays) {
+    uint32_t random_state = 2463534242u;
+    triangle_record* triangles = make_benchmark_triangles(num_triangles, &random_state);
+    ray* rays = make_benchmark_rays(num_rays, &random_state);
+
+    bvh binary_tree = build_bvh(triangles, num_triangles);
+    wide_bvh wide_tree = collapse_bvh(binary_tree.nodes, binary_tree.num_nodes);
+
+    collision* binary_hits = new collision[num_rays];
+    auto binary_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_rays; i++) {
+        binary_hits[i] = bvh_closest_hit(&rays[i], binary_tree.nodes, binary_tree.num_nodes, triangles, INFINITY);
+    }
+    auto binary_end = std::chrono::high_resolution_clock::now();
+
+    int num_mismatches = 0;
+    auto wide_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_rays; i++) {
+        collision hit = wide_bvh_closest_hit(&rays[i], wide_tree.nodes, wide_tree.num_nodes, triangles, INFINITY);
+        if (hit.has_collision != binary_hits[i].has_collision || (hit.has_collision && hit.collision_distance != binary_hits[i].collision_distance)) {
+            num_mismatches++;
+        }
+    }
+    auto wide_end = std::chrono::high_resolution_clock::now();
+
+    double binary_seconds = std::chrono::duration_cast<std::chrono::microseconds>(binary_end - binary_start).count() / 1000000.0;
+    double wide_seconds = std::chrono::duration_cast<std::chrono::microseconds>(wide_end - wide_start).count() / 1000000.0;
+    size_t binary_bytes = sizeof(bvh_node) * binary_tree.num_nodes;
+    size_t wide_bytes = sizeof(wide_bvh_node) * wide_tree.num_nodes;
+    printf("wide bvh benchmark: %i triangles, %i rays, %i children per node\n", num_triangles, num_rays, WIDE_BVH_WIDTH);
+    printf("  binary: %i nodes, %zu bytes, %.0f rays/s\n", binary_tree.num_nodes, binary_bytes, binary_seconds > 0 ? num_rays / binary_seconds : 0);
+    printf("  wide: %i nodes, %zu bytes (%.1f%% of binary), %.0f rays/s, %i mismatch(es)\n", wide_tree.num_nodes, wide_bytes,
+           binary_bytes > 0 ? 100.0 * wide_bytes / binary_bytes : 0, wide_seconds > 0 ? num_rays / wide_seconds : 0, num_mismatches);
+    assert(num_mismatches == 0);
+
+    delete[] binary_tree.nodes;
+    delete[] wide_tree.nodes;
+    delete[] binary_hits;
+    delete[] triangles;
+    delete[] rays;
+}